@@ -0,0 +1,232 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+//! Accounting of the agent's own heap allocations.
+//!
+//! With the `alloc_stats` feature, the global allocator counts the
+//! allocations made on each thread, and the bytes requested, before passing
+//! them on to the system allocator. The ticker takes the difference across a
+//! sample, as it does for CPU time, and the HTTP exposition across a request,
+//! so that the rezolus sampler can report the allocations of each sampler and
+//! of the exposition. Without the feature the counts stay at zero and nothing
+//! is added to the allocation path.
+
+use std::sync::atomic::{AtomicU64, Ordering};
+
+/// Whether allocations are counted
+pub const ENABLED: bool = cfg!(feature = "alloc_stats");
+
+/// Allocations made on a thread, or within a span of work
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
+pub struct Allocations {
+    pub count: u64,
+    pub bytes: u64,
+}
+
+impl Allocations {
+    /// Allocations made on the current thread since it started
+    pub fn current() -> Self {
+        #[cfg(feature = "alloc_stats")]
+        {
+            counting::THREAD
+                .try_with(|allocations| allocations.get())
+                .unwrap_or_default()
+        }
+
+        #[cfg(not(feature = "alloc_stats"))]
+        Self::default()
+    }
+
+    /// Allocations made between an earlier reading and this one
+    pub fn since(self, earlier: Allocations) -> Allocations {
+        Allocations {
+            count: self.count.saturating_sub(earlier.count),
+            bytes: self.bytes.saturating_sub(earlier.bytes),
+        }
+    }
+}
+
+/// Totals of the allocations made for some kind of work, such as serving
+/// exposition requests
+pub struct AllocationStats {
+    events: AtomicU64,
+    count: AtomicU64,
+    bytes: AtomicU64,
+}
+
+impl AllocationStats {
+    const fn new() -> Self {
+        Self {
+            events: AtomicU64::new(0),
+            count: AtomicU64::new(0),
+            bytes: AtomicU64::new(0),
+        }
+    }
+
+    pub fn record(&self, allocations: Allocations) {
+        self.events.fetch_add(1, Ordering::Relaxed);
+        self.count.fetch_add(allocations.count, Ordering::Relaxed);
+        self.bytes.fetch_add(allocations.bytes, Ordering::Relaxed);
+    }
+
+    /// Number of times work was recorded
+    pub fn events(&self) -> u64 {
+        self.events.load(Ordering::Relaxed)
+    }
+
+    pub fn allocations(&self) -> u64 {
+        self.count.load(Ordering::Relaxed)
+    }
+
+    pub fn bytes(&self) -> u64 {
+        self.bytes.load(Ordering::Relaxed)
+    }
+}
+
+static EXPOSITION: AllocationStats = AllocationStats::new();
+
+/// Allocations made while serving exposition requests
+pub fn exposition() -> &'static AllocationStats {
+    &EXPOSITION
+}
+
+#[cfg(feature = "alloc_stats")]
+mod counting {
+    use std::alloc::{GlobalAlloc, Layout, System};
+    use std::cell::Cell;
+
+    use super::Allocations;
+
+    thread_local! {
+        // a `Cell` of plain integers needs no destructor, so accessing it
+        // never allocates
+        pub(super) static THREAD: Cell<Allocations> = Cell::new(Allocations { count: 0, bytes: 0 });
+    }
+
+    fn count(bytes: usize) {
+        // fails only while the thread is being torn down
+        let _ = THREAD.try_with(|allocations| {
+            let mut current = allocations.get();
+            current.count += 1;
+            current.bytes += bytes as u64;
+            allocations.set(current);
+        });
+    }
+
+    struct Counting;
+
+    unsafe impl GlobalAlloc for Counting {
+        unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+            count(layout.size());
+            System.alloc(layout)
+        }
+
+        unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+            count(layout.size());
+            System.alloc_zeroed(layout)
+        }
+
+        unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+            System.dealloc(ptr, layout)
+        }
+
+        unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+            count(new_size);
+            System.realloc(ptr, layout, new_size)
+        }
+    }
+
+    #[global_allocator]
+    static ALLOCATOR: Counting = Counting;
+}
+
+// run with `cargo test --features alloc_stats` to check that the steady-state
+// paths of sampling do not allocate
+#[cfg(all(test, feature = "alloc_stats"))]
+mod test {
+    use std::io::Write;
+    use std::time::{Duration, Instant};
+
+    use super::*;
+    use crate::common::procfs::{self, ProcFile};
+    use crate::metrics::{Metrics, Source, Statistic, Summary};
+
+    struct Counter;
+
+    impl Statistic for Counter {
+        fn name(&self) -> &str {
+            "counter"
+        }
+
+        fn source(&self) -> Source {
+            Source::Counter
+        }
+    }
+
+    fn allocations<F: FnMut()>(mut f: F) -> Allocations {
+        let start = Allocations::current();
+        f();
+        Allocations::current().since(start)
+    }
+
+    #[test]
+    fn counted() {
+        let allocated = allocations(|| {
+            let v: Vec<u8> = Vec::with_capacity(100);
+            drop(v);
+        });
+        assert_eq!(
+            allocated,
+            Allocations {
+                count: 1,
+                bytes: 100
+            }
+        );
+    }
+
+    #[test]
+    fn record_does_not_allocate() {
+        let metrics = Metrics::new();
+        let summary = Summary::heatmap(
+            1_000_000_000,
+            2,
+            Duration::from_secs(60),
+            Duration::from_secs(1),
+        );
+        metrics.add_summary(&Counter, summary);
+        let handle = metrics.register(&Counter);
+        let start = Instant::now();
+        handle.record_counter(start, 0);
+        let allocated = allocations(|| {
+            for i in 1..1_000 {
+                handle.record_counter(start + Duration::from_millis(i * 10), i * 1_000);
+            }
+        });
+        assert_eq!(allocated, Allocations::default());
+    }
+
+    #[test]
+    fn procfile_does_not_allocate() {
+        let path = std::env::temp_dir().join(format!("rezolus-alloc-{}", std::process::id()));
+        let mut file = std::fs::File::create(&path).unwrap();
+        for i in 0..100 {
+            writeln!(file, "cpu{} {} {} {}", i, i, i * 2, i * 3).unwrap();
+        }
+        let mut proc_file = ProcFile::open(&path).unwrap();
+        let mut sum = 0;
+        let mut read = |sum: &mut u64| {
+            for line in proc_file.lines().unwrap() {
+                *sum += procfs::fields(line)
+                    .filter_map(procfs::parse_u64)
+                    .sum::<u64>();
+            }
+        };
+        // the buffer grows to fit the file on the first read
+        read(&mut sum);
+        let allocated = allocations(|| read(&mut sum));
+        assert_eq!(allocated, Allocations::default());
+        assert!(sum > 0);
+        let _ = std::fs::remove_file(path);
+    }
+}
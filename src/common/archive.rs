@@ -0,0 +1,304 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+//! Recordings of the procfs and sysfs files read by the samplers.
+//!
+//! `capture` reads the files once per interval for a number of ticks and
+//! writes them to an archive. Each tick only holds the files whose contents
+//! changed since the tick before, so that files which rarely change, such as
+//! the names of cpuidle states, are stored once. An `Archive` is extracted a
+//! tick at a time under a procfs and a sysfs root, which the samplers then read
+//! as they would the real ones. Files are rewritten in place so that samplers
+//! which keep them open read the contents of each tick.
+
+use std::fs::{File, OpenOptions};
+use std::io::{BufReader, BufWriter, Error, ErrorKind, Read, Write};
+use std::path::{Component, Path};
+use std::time::{Duration, Instant};
+
+const MAGIC: &[u8; 8] = b"RZARCH01";
+
+// files read by the samplers which only use procfs and sysfs, relative to the
+// root of each. a component ending in `*` matches any entry which starts with
+// the rest of it.
+const PROC_FILES: &[&str] = &[
+    "cpuinfo",
+    "diskstats",
+    "interrupts",
+    "meminfo",
+    "net/dev",
+    "net/netstat",
+    "net/snmp",
+    "net/softnet_stat",
+    "stat",
+    "vmstat",
+];
+
+const SYS_FILES: &[&str] = &[
+    "devices/system/cpu/present",
+    "devices/system/cpu/cpu*/cpuidle/state*/name",
+    "devices/system/cpu/cpu*/cpuidle/state*/time",
+    "devices/system/node/node*/cpulist",
+];
+
+// prefixes of the paths in the archive for each root
+const PROC: &str = "proc/";
+const SYS: &str = "sys/";
+
+/// Contents of the files on each tick of a capture
+pub struct Archive {
+    // paths with a `proc/` or `sys/` prefix for the root they are under
+    paths: Vec<String>,
+    // the index and contents of each file which changed on the tick
+    ticks: Vec<Vec<(u32, Vec<u8>)>>,
+}
+
+/// Reads the files under the procfs and sysfs roots on each of `ticks` ticks
+/// of the interval, and writes them to an archive at `path`
+pub fn capture(
+    proc_root: &Path,
+    sys_root: &Path,
+    interval: Duration,
+    ticks: usize,
+    path: &Path,
+) -> Result<(), Error> {
+    let mut archive = Archive {
+        paths: Vec::new(),
+        ticks: Vec::with_capacity(ticks),
+    };
+    let mut sources = Vec::new();
+    for (root, prefix, files) in &[(proc_root, PROC, PROC_FILES), (sys_root, SYS, SYS_FILES)] {
+        for pattern in files.iter() {
+            for file in expand(root, pattern) {
+                sources.push(root.join(&file));
+                archive.paths.push(format!("{}{}", prefix, file));
+            }
+        }
+    }
+
+    let mut previous: Vec<Option<Vec<u8>>> = vec![None; sources.len()];
+    let mut next = Instant::now();
+    for tick in 0..ticks {
+        if tick > 0 {
+            next += interval;
+            let now = Instant::now();
+            if next > now {
+                std::thread::sleep(next - now);
+            }
+        }
+        let mut changed = Vec::new();
+        for (index, source) in sources.iter().enumerate() {
+            // a file which cannot be read keeps its previous contents
+            if let Ok(contents) = std::fs::read(source) {
+                if previous[index].as_ref() != Some(&contents) {
+                    changed.push((index as u32, contents.clone()));
+                    previous[index] = Some(contents);
+                }
+            }
+        }
+        archive.ticks.push(changed);
+        debug!("captured tick {} of {}", tick + 1, ticks);
+    }
+
+    archive.write(path)
+}
+
+// the files under the root which match the pattern, relative to the root
+fn expand(root: &Path, pattern: &str) -> Vec<String> {
+    let mut matches = vec![String::new()];
+    for component in pattern.split('/') {
+        let mut next = Vec::new();
+        for parent in &matches {
+            if let Some(start) = component.strip_suffix('*') {
+                if let Ok(entries) = std::fs::read_dir(root.join(parent)) {
+                    let mut names: Vec<String> = entries
+                        .filter_map(|entry| entry.ok()?.file_name().into_string().ok())
+                        .filter(|name| name.starts_with(start))
+                        .collect();
+                    names.sort();
+                    next.extend(names.iter().map(|name| join(parent, name)));
+                }
+            } else {
+                next.push(join(parent, component));
+            }
+        }
+        matches = next;
+    }
+    matches.retain(|file| root.join(file).is_file());
+    matches
+}
+
+fn join(parent: &str, name: &str) -> String {
+    if parent.is_empty() {
+        name.to_string()
+    } else {
+        format!("{}/{}", parent, name)
+    }
+}
+
+impl Archive {
+    pub fn open(path: &Path) -> Result<Self, Error> {
+        let mut reader = BufReader::new(File::open(path)?);
+        let mut magic = [0; 8];
+        reader.read_exact(&mut magic)?;
+        if &magic != MAGIC {
+            return Err(invalid("not an archive"));
+        }
+        let mut paths = Vec::new();
+        for _ in 0..read_u32(&mut reader)? {
+            let path = String::from_utf8(read_bytes(&mut reader)?)
+                .map_err(|_| invalid("path is not utf-8"))?;
+            // paths are joined to the roots on extraction, and must stay
+            // under them
+            let relative = path.strip_prefix(PROC).or_else(|| path.strip_prefix(SYS));
+            if !relative.map(is_relative).unwrap_or(false) {
+                return Err(invalid("path outside of procfs and sysfs"));
+            }
+            paths.push(path);
+        }
+        let mut ticks = Vec::new();
+        for _ in 0..read_u32(&mut reader)? {
+            let mut changed = Vec::new();
+            for _ in 0..read_u32(&mut reader)? {
+                let index = read_u32(&mut reader)?;
+                if index as usize >= paths.len() {
+                    return Err(invalid("file index out of range"));
+                }
+                changed.push((index, read_bytes(&mut reader)?));
+            }
+            ticks.push(changed);
+        }
+        Ok(Self { paths, ticks })
+    }
+
+    fn write(&self, path: &Path) -> Result<(), Error> {
+        let mut writer = BufWriter::new(File::create(path)?);
+        writer.write_all(MAGIC)?;
+        writer.write_all(&(self.paths.len() as u32).to_le_bytes())?;
+        for path in &self.paths {
+            write_bytes(&mut writer, path.as_bytes())?;
+        }
+        writer.write_all(&(self.ticks.len() as u32).to_le_bytes())?;
+        for changed in &self.ticks {
+            writer.write_all(&(changed.len() as u32).to_le_bytes())?;
+            for (index, contents) in changed {
+                writer.write_all(&index.to_le_bytes())?;
+                write_bytes(&mut writer, contents)?;
+            }
+        }
+        writer.flush()
+    }
+
+    /// Number of ticks captured
+    pub fn ticks(&self) -> usize {
+        self.ticks.len()
+    }
+
+    /// Writes the files which changed on the tick under the procfs and sysfs
+    /// roots. Ticks are extracted in order, starting from the first, which
+    /// holds every file.
+    pub fn extract(&self, tick: usize, proc_root: &Path, sys_root: &Path) -> Result<(), Error> {
+        for (index, contents) in &self.ticks[tick] {
+            let path = &self.paths[*index as usize];
+            let target = match path.strip_prefix(PROC) {
+                Some(file) => proc_root.join(file),
+                None => sys_root.join(&path[SYS.len()..]),
+            };
+            write_in_place(&target, contents)?;
+        }
+        Ok(())
+    }
+}
+
+// overwrites the file without replacing it, so open descriptors read the new
+// contents
+fn write_in_place(path: &Path, contents: &[u8]) -> Result<(), Error> {
+    if let Some(parent) = path.parent() {
+        std::fs::create_dir_all(parent)?;
+    }
+    let mut file = OpenOptions::new()
+        .write(true)
+        .create(true)
+        .truncate(true)
+        .open(path)?;
+    file.write_all(contents)
+}
+
+fn is_relative(path: &str) -> bool {
+    Path::new(path)
+        .components()
+        .all(|component| matches!(component, Component::Normal(_)))
+}
+
+fn invalid(message: &str) -> Error {
+    Error::new(ErrorKind::InvalidData, message)
+}
+
+fn read_u32<R: Read>(reader: &mut R) -> Result<u32, Error> {
+    let mut bytes = [0; 4];
+    reader.read_exact(&mut bytes)?;
+    Ok(u32::from_le_bytes(bytes))
+}
+
+fn read_bytes<R: Read>(reader: &mut R) -> Result<Vec<u8>, Error> {
+    let len = read_u32(reader)? as usize;
+    let mut bytes = Vec::new();
+    reader.take(len as u64).read_to_end(&mut bytes)?;
+    if bytes.len() != len {
+        return Err(Error::new(ErrorKind::UnexpectedEof, "truncated archive"));
+    }
+    Ok(bytes)
+}
+
+fn write_bytes<W: Write>(writer: &mut W, bytes: &[u8]) -> Result<(), Error> {
+    writer.write_all(&(bytes.len() as u32).to_le_bytes())?;
+    writer.write_all(bytes)
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn capture_and_extract() {
+        let dir = std::env::temp_dir().join(format!("rezolus-archive-{}", std::process::id()));
+        let _ = std::fs::remove_dir_all(&dir);
+        let (proc_root, sys_root) = (dir.join("proc"), dir.join("sys"));
+        write_in_place(&proc_root.join("net/dev"), b"eth0 1 2 3\n").unwrap();
+        for cpu in &["cpu0", "cpu1", "cpufreq"] {
+            let state = sys_root.join(format!("devices/system/cpu/{}/cpuidle/state0", cpu));
+            write_in_place(&state.join("name"), b"POLL\n").unwrap();
+            write_in_place(&state.join("time"), b"10\n").unwrap();
+        }
+
+        let path = dir.join("archive");
+        capture(&proc_root, &sys_root, Duration::from_millis(1), 2, &path).unwrap();
+        let archive = Archive::open(&path).unwrap();
+        assert_eq!(archive.ticks(), 2);
+        assert_eq!(archive.paths.len(), 7);
+        assert_eq!(
+            archive.paths[1],
+            "sys/devices/system/cpu/cpu0/cpuidle/state0/name"
+        );
+        // nothing changed between the two ticks
+        assert_eq!(archive.ticks[0].len(), 7);
+        assert!(archive.ticks[1].is_empty());
+
+        let replay = dir.join("replay");
+        let (proc_replay, sys_replay) = (replay.join("proc"), replay.join("sys"));
+        archive.extract(0, &proc_replay, &sys_replay).unwrap();
+        let mut file = crate::common::procfs::ProcFile::open(proc_replay.join("net/dev")).unwrap();
+        assert_eq!(file.read().unwrap(), b"eth0 1 2 3\n");
+
+        // a later tick is visible through the open file
+        let changed = Archive {
+            paths: archive.paths.clone(),
+            ticks: vec![vec![(0, b"eth0 4 5\n".to_vec())]],
+        };
+        changed.extract(0, &proc_replay, &sys_replay).unwrap();
+        assert_eq!(file.read().unwrap(), b"eth0 4 5\n");
+
+        let _ = std::fs::remove_dir_all(&dir);
+    }
+}
@@ -2,6 +2,11 @@
 // Licensed under the Apache License, Version 2.0
 // http://www.apache.org/licenses/LICENSE-2.0
 
+#[cfg(feature = "bpf")]
+pub mod iter;
+#[cfg(feature = "bpf")]
+pub mod stats;
+
 #[cfg(feature = "bpf")]
 pub struct BPF {
     pub inner: bcc::BPF,
@@ -10,6 +15,533 @@ pub struct BPF {
 #[cfg(not(feature = "bpf"))]
 pub struct BPF {}
 
+#[cfg(feature = "bpf")]
+use std::path::{Path, PathBuf};
+#[cfg(feature = "bpf")]
+use std::sync::atomic::{AtomicBool, Ordering};
+#[cfg(feature = "bpf")]
+use std::sync::{Arc, Mutex};
+
+/// Version of the layout of pinned objects under the pin path. This must be
+/// incremented if the directory structure changes.
+#[cfg(feature = "bpf")]
+const PIN_LAYOUT_VERSION: u32 = 1;
+
+#[cfg(feature = "bpf")]
+#[derive(Clone, Copy, Debug)]
+enum ProbeKind {
+    Kprobe,
+    Kretprobe,
+    Tracepoint,
+}
+
+#[cfg(feature = "bpf")]
+#[derive(Clone, Debug)]
+struct Probe {
+    kind: ProbeKind,
+    handler: String,
+    // candidate kernel functions, or `subsystem:tracepoint`. all but the last
+    // candidate are only used if they exist on the running kernel
+    targets: Vec<String>,
+    optional: bool,
+}
+
+/// The BPF code for a sampler together with the probes which should be
+/// attached once it has been compiled. The maps, functions and types which
+/// the code declares are written as `NS(name)`, and are referred to here and
+/// in `BpfHandle` by their plain name.
+#[cfg(feature = "bpf")]
+pub struct BpfProgram {
+    name: String,
+    code: String,
+    defines: Vec<String>,
+    probes: Vec<Probe>,
+}
+
+#[cfg(feature = "bpf")]
+impl BpfProgram {
+    pub fn new(name: &str, code: &str) -> Self {
+        Self {
+            name: name.to_string(),
+            code: code.to_string(),
+            defines: Vec::new(),
+            probes: Vec::new(),
+        }
+    }
+
+    /// Define `ENABLE_<TABLE>` so that code guarded by `#ifdef` for the table
+    /// is compiled. Code for tables which are not enabled is left out.
+    pub fn enable(mut self, table: &str) -> Self {
+        self.defines.push(enable_define(table));
+        self
+    }
+
+    // the code with its defines, which are undefined again at the end so
+    // they do not leak into other programs in a shared module
+    fn source(&self) -> String {
+        let mut source = String::new();
+        for define in &self.defines {
+            source.push_str(&format!("#define {}\n", define));
+        }
+        source.push_str(&self.code);
+        source.push('\n');
+        for define in &self.defines {
+            source.push_str(&format!("#undef {}\n", define));
+        }
+        source
+    }
+
+    fn probe(mut self, kind: ProbeKind, handler: &str, targets: &[&str], optional: bool) -> Self {
+        self.probes.push(Probe {
+            kind,
+            handler: handler.to_string(),
+            targets: targets.iter().map(|t| t.to_string()).collect(),
+            optional,
+        });
+        self
+    }
+
+    pub fn kprobe(self, handler: &str, function: &str) -> Self {
+        self.probe(ProbeKind::Kprobe, handler, &[function], false)
+    }
+
+    /// Attach the kprobe only if the function exists on the running kernel
+    pub fn kprobe_optional(self, handler: &str, function: &str) -> Self {
+        self.probe(ProbeKind::Kprobe, handler, &[function], true)
+    }
+
+    /// Attach the kprobe to the first of the functions which exists on the
+    /// running kernel
+    pub fn kprobe_first(self, handler: &str, functions: &[&str]) -> Self {
+        self.probe(ProbeKind::Kprobe, handler, functions, false)
+    }
+
+    pub fn kretprobe(self, handler: &str, function: &str) -> Self {
+        self.probe(ProbeKind::Kretprobe, handler, &[function], false)
+    }
+
+    pub fn tracepoint(self, handler: &str, subsystem: &str, tracepoint: &str) -> Self {
+        let target = format!("{}:{}", subsystem, tracepoint);
+        self.probe(ProbeKind::Tracepoint, handler, &[&target], false)
+    }
+
+    fn attach(&self, bpf: &mut bcc::BPF, prefix: Option<&str>) -> Result<(), anyhow::Error> {
+        for probe in &self.probes {
+            let handler = symbol(prefix, &probe.handler);
+            let exists = |function: &str| {
+                bpf.get_kprobe_functions(function)
+                    .map(|results| !results.is_empty())
+                    .unwrap_or(false)
+            };
+            let target = match probe.kind {
+                ProbeKind::Tracepoint => probe.targets.last().cloned(),
+                _ => {
+                    let last = probe.targets.len() - 1;
+                    probe
+                        .targets
+                        .iter()
+                        .enumerate()
+                        .find(|(id, function)| {
+                            (*id == last && !probe.optional) || exists(function.as_str())
+                        })
+                        .map(|(_, function)| function.clone())
+                }
+            };
+            let target = match target {
+                Some(target) => target,
+                None => continue,
+            };
+            match probe.kind {
+                ProbeKind::Kprobe => {
+                    bcc::Kprobe::new()
+                        .handler(&handler)
+                        .function(&target)
+                        .attach(bpf)?;
+                }
+                ProbeKind::Kretprobe => {
+                    bcc::Kretprobe::new()
+                        .handler(&handler)
+                        .function(&target)
+                        .attach(bpf)?;
+                }
+                ProbeKind::Tracepoint => {
+                    let mut parts = target.splitn(2, ':');
+                    let subsystem = parts.next().unwrap_or("");
+                    let tracepoint = parts.next().unwrap_or("");
+                    bcc::Tracepoint::new()
+                        .handler(&handler)
+                        .subsystem(subsystem)
+                        .tracepoint(tracepoint)
+                        .attach(bpf)?;
+                }
+            }
+        }
+        Ok(())
+    }
+}
+
+/// Name of the preprocessor macro which enables the code for a BPF table
+#[cfg(feature = "bpf")]
+pub fn enable_define(table: &str) -> String {
+    format!("ENABLE_{}", table.to_uppercase())
+}
+
+/// Name of a symbol from a sampler's BPF code after it has been namespaced
+/// for inclusion in the shared module
+#[cfg(feature = "bpf")]
+fn symbol(prefix: Option<&str>, name: &str) -> String {
+    match prefix {
+        Some(prefix) => format!("{}_{}", prefix, name),
+        None => name.to_string(),
+    }
+}
+
+/// Expands the `NS(name)` markers with which a sampler's BPF code marks the
+/// maps, functions and types it declares. In the shared module they are
+/// prefixed with the sampler name, so that the code from all samplers can be
+/// concatenated and compiled as a single module. Only marked names are
+/// renamed, so kernel struct fields, locals and macro arguments which share a
+/// name with a map are left alone.
+#[cfg(feature = "bpf")]
+fn namespace(prefix: Option<&str>, code: &str) -> String {
+    use regex::{Captures, Regex};
+
+    let re = Regex::new(r"\bNS\(\s*(\w+)\s*\)").expect("failed to compile regex");
+    re.replace_all(code, |caps: &Captures| symbol(prefix, &caps[1]))
+        .into_owned()
+}
+
+// fnv-1a, which unlike the std hasher is stable across releases
+#[cfg(feature = "bpf")]
+fn fingerprint(code: &str) -> u64 {
+    let mut hash: u64 = 0xcbf2_9ce4_8422_2325;
+    for byte in code.bytes() {
+        hash ^= byte as u64;
+        hash = hash.wrapping_mul(0x0100_0000_01b3);
+    }
+    hash
+}
+
+/// Maps of a sampler to pin in bpffs once its code has been loaded
+#[cfg(feature = "bpf")]
+struct Pins {
+    directory: PathBuf,
+    tables: Vec<String>,
+}
+
+/// Names of the maps which a sampler's BPF code declares with one of the
+/// `BPF_TABLE` macros, as `BPF_HASH(NS(name), ...)`
+#[cfg(feature = "bpf")]
+fn tables(source: &str) -> Vec<String> {
+    use regex::Regex;
+
+    let re = Regex::new(r"\bBPF_[A-Z_]+\(\s*NS\(\s*(\w+)\s*\)").expect("failed to compile regex");
+    re.captures_iter(source)
+        .map(|caps| caps[1].to_string())
+        .collect()
+}
+
+/// Prepares BPF C code so that its maps are pinned in bpffs. Maps are pinned
+/// in a directory named by the program name and a fingerprint of the code, so
+/// a restarted agent re-uses the existing maps, and the data in them, only if
+/// they were created by identical code. Directories for other versions of the
+/// program are removed.
+///
+/// bcc fails to load code which declares a pinned map that does not exist, so
+/// the code is only rewritten to declare its maps pinned when all of them are.
+/// Otherwise it is loaded as is, and the returned maps are pinned with
+/// `pin_tables` once it has been.
+#[cfg(feature = "bpf")]
+fn pin(
+    root: &Path,
+    name: &str,
+    code: String,
+    tables: Vec<String>,
+) -> Result<(String, Option<Pins>), anyhow::Error> {
+    let layout = root.join(format!("v{}", PIN_LAYOUT_VERSION));
+    let prefix = format!("{}-", name);
+    let current = format!("{}{:016x}", prefix, fingerprint(&code));
+    if let Ok(entries) = std::fs::read_dir(&layout) {
+        for entry in entries.flatten() {
+            let entry = entry.file_name().to_string_lossy().to_string();
+            if entry.starts_with(&prefix) && entry != current {
+                debug!("removing stale pinned bpf maps: {}", entry);
+                let _ = std::fs::remove_dir_all(layout.join(entry));
+            }
+        }
+    }
+    let directory = layout.join(current);
+    std::fs::create_dir_all(&directory)?;
+
+    if !tables.iter().all(|table| directory.join(table).exists()) {
+        // maps left by an agent which stopped while pinning are replaced
+        for entry in std::fs::read_dir(&directory)?.flatten() {
+            let _ = std::fs::remove_file(entry.path());
+        }
+        return Ok((code, Some(Pins { directory, tables })));
+    }
+
+    // every map type used by the samplers is declared through BPF_TABLE,
+    // which is replaced by its pinned variant for just this code
+    let code = format!(
+        r#"#pragma push_macro("BPF_TABLE")
+#undef BPF_TABLE
+#define BPF_TABLE(_table_type, _key_type, _leaf_type, _name, _max_entries) \
+BPF_F_TABLE(_table_type ":" "{}/" #_name, _key_type, _leaf_type, _name, _max_entries, 0)
+{}
+#pragma pop_macro("BPF_TABLE")
+"#,
+        directory.display(),
+        code
+    );
+    Ok((code, None))
+}
+
+/// Pins the maps of code loaded without pinned maps, so that the next start
+/// with the same code re-uses them. A map which cannot be pinned is only
+/// logged, as the code is loaded and works without.
+#[cfg(feature = "bpf")]
+fn pin_tables(bpf: &bcc::BPF, pins: &Pins) {
+    use std::ffi::CString;
+    use std::os::unix::ffi::OsStrExt;
+
+    // from uapi/linux/bpf.h
+    const BPF_OBJ_PIN: libc::c_int = 6;
+
+    #[repr(C)]
+    struct ObjPinAttr {
+        pathname: u64,
+        bpf_fd: u32,
+        file_flags: u32,
+    }
+
+    for name in &pins.tables {
+        let path = pins.directory.join(name);
+        let result = match (bpf.table(name), CString::new(path.as_os_str().as_bytes())) {
+            (Ok(mut table), Ok(pathname)) => {
+                let mut attr = ObjPinAttr {
+                    pathname: pathname.as_ptr() as u64,
+                    bpf_fd: table.fd() as u32,
+                    file_flags: 0,
+                };
+                self::iter::sys_bpf(BPF_OBJ_PIN, &mut attr).map(|_| ())
+            }
+            _ => Err(std::io::Error::from_raw_os_error(libc::ENOENT)),
+        };
+        match result {
+            Ok(()) => debug!("pinned bpf map: {:?}", path),
+            Err(e) => error!("failed to pin bpf map {:?}: {}", path, e),
+        }
+    }
+}
+
+/// Handle to the compiled BPF code for a sampler. When the shared module is
+/// enabled, the module is only available once all samplers have been
+/// initialized and `BpfLoader::finalize` has run.
+#[derive(Clone)]
+pub struct BpfHandle {
+    #[cfg(feature = "bpf")]
+    module: Arc<Mutex<Option<BPF>>>,
+    #[cfg(feature = "bpf")]
+    prefix: Option<String>,
+}
+
+#[cfg(feature = "bpf")]
+impl BpfHandle {
+    /// Run a function against the named table, returning `None` if the module
+    /// is not yet loaded or the table does not exist
+    pub fn with_table<T, F: FnOnce(&mut bcc::table::Table) -> T>(
+        &self,
+        name: &str,
+        f: F,
+    ) -> Option<T> {
+        let module = self.module.lock().unwrap();
+        let bpf = module.as_ref()?;
+        let mut table = bpf
+            .inner
+            .table(&symbol(self.prefix.as_deref(), name))
+            .ok()?;
+        Some(f(&mut table))
+    }
+}
+
+/// Compiles the BPF code for samplers, either as one module per sampler or as
+/// a single module shared by all samplers
+pub struct BpfLoader {
+    #[cfg(feature = "bpf")]
+    shared: bool,
+    #[cfg(feature = "bpf")]
+    pending: Mutex<Vec<BpfProgram>>,
+    #[cfg(feature = "bpf")]
+    module: Arc<Mutex<Option<BPF>>>,
+    #[cfg(feature = "bpf")]
+    pin_path: Option<PathBuf>,
+    #[cfg(feature = "bpf")]
+    finalized: AtomicBool,
+    // programs compiled as modules of their own, kept so that their probes
+    // can be detached and attached again
+    #[cfg(feature = "bpf")]
+    loaded: Mutex<Vec<(BpfProgram, Arc<Mutex<Option<BPF>>>)>>,
+}
+
+impl BpfLoader {
+    #[allow(unused_variables)]
+    pub fn new(shared: bool, pin_path: Option<String>) -> Self {
+        Self {
+            #[cfg(feature = "bpf")]
+            shared,
+            #[cfg(feature = "bpf")]
+            pin_path: pin_path.map(PathBuf::from),
+            #[cfg(feature = "bpf")]
+            pending: Mutex::new(Vec::new()),
+            #[cfg(feature = "bpf")]
+            module: Arc::new(Mutex::new(None)),
+            #[cfg(feature = "bpf")]
+            finalized: AtomicBool::new(false),
+            #[cfg(feature = "bpf")]
+            loaded: Mutex::new(Vec::new()),
+        }
+    }
+
+    /// Load the program for a sampler. With the shared module, compilation
+    /// and probe attachment are deferred until `finalize`. A program loaded
+    /// after `finalize`, by a sampler enabled at runtime, gets a module of its
+    /// own.
+    #[cfg(feature = "bpf")]
+    pub fn load(&self, program: BpfProgram) -> Result<BpfHandle, anyhow::Error> {
+        if self.shared && !self.finalized.load(Ordering::Relaxed) {
+            let prefix = program.name.clone();
+            self.pending.lock().unwrap().push(program);
+            Ok(BpfHandle {
+                module: self.module.clone(),
+                prefix: Some(prefix),
+            })
+        } else {
+            let module = Arc::new(Mutex::new(Some(self.compile(&program)?)));
+            self.loaded.lock().unwrap().push((program, module.clone()));
+            Ok(BpfHandle {
+                module,
+                prefix: None,
+            })
+        }
+    }
+
+    #[cfg(feature = "bpf")]
+    fn compile(&self, program: &BpfProgram) -> Result<BPF, anyhow::Error> {
+        let (code, pins) = self.pinned(program, None)?;
+        let mut bpf = bcc::BPF::new(&code)?;
+        if let Some(pins) = pins {
+            pin_tables(&bpf, &pins);
+        }
+        program.attach(&mut bpf, None)?;
+        Ok(BPF { inner: bpf })
+    }
+
+    /// Detach the probes of the named program by unloading its module, so
+    /// that a disabled sampler costs nothing in the kernel. Its handle finds
+    /// no tables until the program is attached again. Programs in the shared
+    /// module cannot be detached on their own and stay attached.
+    #[allow(unused_variables)]
+    pub fn detach(&self, name: &str) {
+        #[cfg(feature = "bpf")]
+        {
+            let loaded = self.loaded.lock().unwrap();
+            match loaded.iter().find(|(program, _)| program.name == name) {
+                Some((_, module)) => {
+                    if module.lock().unwrap().take().is_some() {
+                        debug!("detached bpf probes for {}", name);
+                    }
+                }
+                None if self.shared => {
+                    debug!("bpf probes for {} stay attached in the shared module", name);
+                }
+                None => {}
+            }
+        }
+    }
+
+    /// Compile and attach the named program again after `detach`
+    #[allow(unused_variables)]
+    pub fn attach(&self, name: &str) -> Result<(), anyhow::Error> {
+        #[cfg(feature = "bpf")]
+        {
+            let loaded = self.loaded.lock().unwrap();
+            if let Some((program, module)) = loaded.iter().find(|(program, _)| program.name == name)
+            {
+                let mut module = module.lock().unwrap();
+                if module.is_none() {
+                    *module = Some(self.compile(program)?);
+                    debug!("attached bpf probes for {}", name);
+                }
+            }
+        }
+        Ok(())
+    }
+
+    // the namespaced code of the program, and any maps to pin once it is
+    // loaded
+    #[cfg(feature = "bpf")]
+    fn pinned(
+        &self,
+        program: &BpfProgram,
+        prefix: Option<&str>,
+    ) -> Result<(String, Option<Pins>), anyhow::Error> {
+        let source = program.source();
+        let code = namespace(prefix, &source);
+        match self.pin_path {
+            Some(ref root) => {
+                let tables = tables(&source)
+                    .iter()
+                    .map(|table| symbol(prefix, table))
+                    .collect();
+                pin(root, &program.name, code, tables)
+            }
+            None => Ok((code, None)),
+        }
+    }
+
+    /// Compile the shared module from all pending programs and attach their
+    /// probes. Failure to attach the probes for one sampler does not prevent
+    /// the others from being attached, the first such error is returned.
+    pub fn finalize(&self) -> Result<(), anyhow::Error> {
+        #[cfg(feature = "bpf")]
+        {
+            self.finalized.store(true, Ordering::Relaxed);
+            let pending: Vec<BpfProgram> = self.pending.lock().unwrap().drain(..).collect();
+            if pending.is_empty() {
+                return Ok(());
+            }
+            debug!("compiling shared bpf module for {} samplers", pending.len());
+            let mut code = String::new();
+            let mut pins = Vec::new();
+            for program in &pending {
+                let (source, program_pins) = self.pinned(program, Some(&program.name))?;
+                code.push_str(&source);
+                code.push('\n');
+                pins.extend(program_pins);
+            }
+            let mut bpf = bcc::BPF::new(&code)?;
+            for pins in &pins {
+                pin_tables(&bpf, pins);
+            }
+            let mut result = Ok(());
+            for program in &pending {
+                if let Err(e) = program.attach(&mut bpf, Some(&program.name)) {
+                    error!("failed to attach bpf probes for {}: {}", program.name, e);
+                    if result.is_ok() {
+                        result = Err(e);
+                    }
+                }
+            }
+            *self.module.lock().unwrap() = Some(BPF { inner: bpf });
+            result
+        }
+
+        #[cfg(not(feature = "bpf"))]
+        Ok(())
+    }
+}
+
 #[cfg(feature = "bpf")]
 pub fn key_to_value(index: u64) -> Option<u64> {
     let index = index;
@@ -53,11 +585,23 @@ pub fn symbol_lookup(name: &str) -> Option<String> {
     None
 }
 
+/// Values of the buckets of the BPF histograms, which are indexed by
+/// `value_to_index2()` in the BPF code, where each unit of the value in the
+/// kernel is worth `scale`
 #[cfg(feature = "bpf")]
-pub fn map_from_table(table: &mut bcc::table::Table) -> std::collections::HashMap<u64, u32> {
-    use std::collections::HashMap;
+pub fn histogram_values(scale: u64) -> Arc<[u64]> {
+    let mut values = Vec::new();
+    while let Some(value) = key_to_value(values.len() as u64) {
+        values.push(value * scale);
+    }
+    values.into()
+}
 
-    let mut current = HashMap::new();
+/// Reads the count of each bucket of a BPF histogram, indexed by bucket, and
+/// clears them in the kernel
+#[cfg(feature = "bpf")]
+pub fn histogram_from_table(table: &mut bcc::table::Table) -> Vec<u64> {
+    let mut counts = Vec::new();
 
     trace!("transferring data to userspace");
     for (id, mut entry) in table.iter().enumerate() {
@@ -72,7 +616,7 @@ pub fn map_from_table(table: &mut bcc::table::Table) -> std::collections::HashMa
             continue;
         }
         key.copy_from_slice(&entry.key);
-        let key = u32::from_ne_bytes(key);
+        let key = u32::from_ne_bytes(key) as usize;
 
         let mut value = [0; 8];
         if value.len() != entry.value.len() {
@@ -85,16 +629,16 @@ pub fn map_from_table(table: &mut bcc::table::Table) -> std::collections::HashMa
             continue;
         }
         value.copy_from_slice(&entry.value);
-        let value = u64::from_ne_bytes(value);
 
-        if let Some(key) = key_to_value(key as u64) {
-            current.insert(key, value as u32);
+        if key >= counts.len() {
+            counts.resize(key + 1, 0);
         }
+        counts[key] = u64::from_ne_bytes(value);
 
         // clear the source counter
         let _ = table.set(&mut entry.key, &mut [0_u8; 8]);
     }
-    current
+    counts
 }
 
 #[cfg(feature = "bpf")]
@@ -0,0 +1,133 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+//! Runtime statistics for the BPF programs loaded by this process.
+//!
+//! The kernel only accounts `run_cnt` and `run_time_ns` for programs while
+//! stats collection is enabled, either through `BPF_ENABLE_STATS` (5.8+) for
+//! as long as the returned fd is held open, or globally with the
+//! `kernel.bpf_stats_enabled` sysctl.
+
+use std::collections::HashSet;
+use std::fs::File;
+use std::io::Error;
+use std::os::unix::io::{FromRawFd, RawFd};
+
+use super::iter::sys_bpf;
+
+// from uapi/linux/bpf.h
+const BPF_OBJ_GET_INFO_BY_FD: libc::c_int = 15;
+const BPF_ENABLE_STATS: libc::c_int = 32;
+const BPF_STATS_RUN_TIME: u32 = 0;
+
+const SYSCTL: &str = "/proc/sys/kernel/bpf_stats_enabled";
+
+/// Runtime statistics for one loaded BPF program
+#[derive(Clone, Debug, Default, PartialEq)]
+pub struct ProgramStats {
+    pub id: u32,
+    pub name: String,
+    pub run_cnt: u64,
+    pub run_time_ns: u64,
+}
+
+// prefix of `struct bpf_prog_info` up to and including `run_cnt`, with the
+// fields we do not need left as padding
+#[repr(C)]
+#[derive(Default)]
+struct ProgInfo {
+    _prog_type: u32,
+    id: u32,
+    _tag: [u8; 8],
+    _reserved0: [u64; 6],
+    name: [u8; 16],
+    _reserved1: [u64; 14],
+    run_time_ns: u64,
+    run_cnt: u64,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct InfoByFdAttr {
+    bpf_fd: u32,
+    info_len: u32,
+    info: u64,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct EnableStatsAttr {
+    stats_type: u32,
+}
+
+/// Enables runtime stats collection. Returns the fd which keeps stats enabled
+/// when `BPF_ENABLE_STATS` is supported, otherwise falls back to setting the
+/// sysctl, which stays enabled after exit.
+pub fn enable() -> Result<Option<File>, Error> {
+    let mut attr = EnableStatsAttr {
+        stats_type: BPF_STATS_RUN_TIME,
+    };
+    match sys_bpf(BPF_ENABLE_STATS, &mut attr) {
+        Ok(fd) => Ok(Some(unsafe { File::from_raw_fd(fd) })),
+        Err(_) => {
+            std::fs::write(SYSCTL, "1")?;
+            Ok(None)
+        }
+    }
+}
+
+fn info(fd: RawFd) -> Result<ProgramStats, Error> {
+    let mut info = ProgInfo::default();
+    let mut attr = InfoByFdAttr {
+        bpf_fd: fd as u32,
+        info_len: std::mem::size_of::<ProgInfo>() as u32,
+        info: &mut info as *mut ProgInfo as u64,
+    };
+    sys_bpf(BPF_OBJ_GET_INFO_BY_FD, &mut attr)?;
+    let len = info.name.iter().position(|c| *c == 0).unwrap_or(16);
+    Ok(ProgramStats {
+        id: info.id,
+        name: String::from_utf8_lossy(&info.name[..len]).to_string(),
+        run_cnt: info.run_cnt,
+        run_time_ns: info.run_time_ns,
+    })
+}
+
+/// Returns the stats for each BPF program which this process holds open,
+/// regardless of which module loaded it
+pub fn programs() -> Result<Vec<ProgramStats>, Error> {
+    let mut seen = HashSet::new();
+    let mut result = Vec::new();
+    for entry in std::fs::read_dir("/proc/self/fd")? {
+        let entry = entry?;
+        let is_prog = std::fs::read_link(entry.path())
+            .map(|target| target.to_string_lossy() == "anon_inode:bpf-prog")
+            .unwrap_or(false);
+        if !is_prog {
+            continue;
+        }
+        let fd: RawFd = match entry.file_name().to_string_lossy().parse() {
+            Ok(fd) => fd,
+            Err(_) => continue,
+        };
+        // the fd may have been closed since it was listed
+        if let Ok(stats) = info(fd) {
+            if seen.insert(stats.id) {
+                result.push(stats);
+            }
+        }
+    }
+    Ok(result)
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn prog_info_layout() {
+        // offsetof(struct bpf_prog_info, run_cnt) + sizeof(__u64)
+        assert_eq!(std::mem::size_of::<ProgInfo>(), 208);
+    }
+}
@@ -0,0 +1,467 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+//! Central tick scheduler for the samplers.
+//!
+//! Ticks for each sampling interval are produced by one task and fanned out
+//! to every sampler with that interval. Ticks land on multiples of their
+//! interval since the unix epoch, so samplers with different intervals tick
+//! together whenever their intervals coincide, and every sampler records the
+//! readings for a tick with the same timestamp. A sampler which is still busy
+//! when its next tick fires skips to the most recent tick rather than
+//! catching up, and the ticks it skipped are counted as missed.
+//!
+//! The ticker also measures the work a sampler does between two ticks: the
+//! elapsed time, and the CPU time and heap allocations of the worker thread.
+//! These are collected in `SamplerStats` and exported by the rezolus sampler.
+//!
+//! A sampler's interval may be stretched to a multiple of its configured
+//! interval by setting its scale, in which case it only acts on every n-th
+//! tick and remains aligned with the other samplers. A sampler whose interval
+//! is changed by a config reload takes a new ticker, which keeps the same
+//! instrumentation. The task of an interval ends once no ticker uses it.
+
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Mutex, Weak};
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+use tokio::runtime::Runtime;
+use tokio::sync::watch;
+
+use crate::common::alloc::Allocations;
+
+/// A single tick of an interval
+#[derive(Clone, Copy, Debug)]
+pub struct Tick {
+    /// Number of intervals since the unix epoch
+    pub sequence: u64,
+    /// Time at which the tick was scheduled, shared by all samplers
+    pub time: Instant,
+}
+
+pub struct Clock {
+    // the same moment as an instant and as time since the unix epoch
+    instant: Instant,
+    unix: Duration,
+    // receivers of the ticks of each interval, held by its tickers so that
+    // its task ends when the last of them is dropped
+    intervals: Mutex<HashMap<Duration, Weak<watch::Receiver<Tick>>>>,
+    samplers: Mutex<Vec<Arc<SamplerStats>>>,
+}
+
+impl Clock {
+    pub fn new() -> Self {
+        Self {
+            instant: Instant::now(),
+            unix: SystemTime::now()
+                .duration_since(UNIX_EPOCH)
+                .unwrap_or_default(),
+            intervals: Mutex::new(HashMap::new()),
+            samplers: Mutex::new(Vec::new()),
+        }
+    }
+
+    /// Returns a ticker for the interval, starting the task which produces its
+    /// ticks if no other ticker uses the interval
+    pub fn ticker(
+        &self,
+        runtime: &Runtime,
+        name: &'static str,
+        interval: Duration,
+        priority: u8,
+    ) -> Ticker {
+        let stats = {
+            let mut samplers = self.samplers.lock().unwrap();
+            match samplers.iter().find(|stats| stats.name == name) {
+                Some(stats) => {
+                    stats
+                        .interval
+                        .store(interval.as_nanos() as u64, Ordering::Relaxed);
+                    stats.clone()
+                }
+                None => {
+                    let stats = Arc::new(SamplerStats::new(name, interval, priority));
+                    samplers.push(stats.clone());
+                    stats
+                }
+            }
+        };
+        let mut intervals = self.intervals.lock().unwrap();
+        intervals.retain(|_, ticks| ticks.strong_count() > 0);
+        let ticks = match intervals.get(&interval).and_then(Weak::upgrade) {
+            Some(ticks) => ticks,
+            None => {
+                let (sender, receiver) = watch::channel(Tick {
+                    sequence: 0,
+                    time: self.instant,
+                });
+                runtime.spawn(drive(sender, self.instant, self.unix, interval));
+                let ticks = Arc::new(receiver);
+                intervals.insert(interval, Arc::downgrade(&ticks));
+                ticks
+            }
+        };
+        Ticker {
+            receiver: (*ticks).clone(),
+            _ticks: ticks,
+            created: Instant::now(),
+            last: None,
+            time: None,
+            started: None,
+            stats,
+        }
+    }
+
+    /// Instrumentation of each sampler which has started ticking
+    pub fn samplers(&self) -> Vec<Arc<SamplerStats>> {
+        self.samplers.lock().unwrap().clone()
+    }
+}
+
+impl Default for Clock {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+// returns the next tick of the interval after `now`
+fn next(instant: Instant, unix: Duration, interval: Duration, now: Instant) -> Tick {
+    let interval = interval.as_nanos().max(1);
+    let since = unix + now.saturating_duration_since(instant);
+    let sequence = since.as_nanos() / interval + 1;
+    Tick {
+        sequence: sequence as u64,
+        time: instant + Duration::from_nanos((sequence * interval - unix.as_nanos()) as u64),
+    }
+}
+
+async fn drive(sender: watch::Sender<Tick>, instant: Instant, unix: Duration, interval: Duration) {
+    loop {
+        // computed from the current time so that a late wakeup skips ahead
+        let tick = next(instant, unix, interval, Instant::now());
+        tokio::time::sleep_until(tick.time.into()).await;
+        if sender.send(tick).is_err() {
+            return;
+        }
+    }
+}
+
+// bound on durations held between reads by the rezolus sampler
+const MAX_PENDING: usize = 1024;
+
+/// Self-instrumentation of one sampler
+pub struct SamplerStats {
+    name: &'static str,
+    // nanoseconds
+    interval: AtomicU64,
+    priority: u8,
+    scale: AtomicU64,
+    missed: AtomicU64,
+    late: AtomicU64,
+    skipped: AtomicU64,
+    cpu_time: AtomicU64,
+    allocations: AtomicU64,
+    allocated_bytes: AtomicU64,
+    durations: Mutex<Vec<u64>>,
+}
+
+impl SamplerStats {
+    pub fn new(name: &'static str, interval: Duration, priority: u8) -> Self {
+        Self {
+            name,
+            interval: AtomicU64::new(interval.as_nanos() as u64),
+            priority,
+            scale: AtomicU64::new(1),
+            missed: AtomicU64::new(0),
+            late: AtomicU64::new(0),
+            skipped: AtomicU64::new(0),
+            cpu_time: AtomicU64::new(0),
+            allocations: AtomicU64::new(0),
+            allocated_bytes: AtomicU64::new(0),
+            durations: Mutex::new(Vec::new()),
+        }
+    }
+
+    pub fn name(&self) -> &'static str {
+        self.name
+    }
+
+    /// Samplers with a lower priority are slowed down first
+    pub fn priority(&self) -> u8 {
+        self.priority
+    }
+
+    /// Multiple of the configured interval at which the sampler runs
+    pub fn scale(&self) -> u64 {
+        self.scale.load(Ordering::Relaxed)
+    }
+
+    pub fn set_scale(&self, scale: u64) {
+        self.scale.store(scale.max(1), Ordering::Relaxed);
+    }
+
+    /// Configured interval of the sampler, before it is stretched
+    pub fn base_interval(&self) -> Duration {
+        Duration::from_nanos(self.interval.load(Ordering::Relaxed))
+    }
+
+    /// Configured interval stretched by the scale
+    pub fn interval(&self) -> Duration {
+        self.base_interval() * self.scale() as u32
+    }
+
+    /// Ticks which were skipped because the sampler was busy
+    pub fn missed(&self) -> u64 {
+        self.missed.load(Ordering::Relaxed)
+    }
+
+    /// Ticks which fired while the sampler was still busy
+    pub fn late(&self) -> u64 {
+        self.late.load(Ordering::Relaxed)
+    }
+
+    /// Samples which were cancelled for taking longer than the interval
+    pub fn skipped(&self) -> u64 {
+        self.skipped.load(Ordering::Relaxed)
+    }
+
+    /// Nanoseconds of CPU time spent sampling
+    pub fn cpu_time(&self) -> u64 {
+        self.cpu_time.load(Ordering::Relaxed)
+    }
+
+    /// Heap allocations made while sampling, counted with the `alloc_stats`
+    /// feature
+    pub fn allocations(&self) -> u64 {
+        self.allocations.load(Ordering::Relaxed)
+    }
+
+    /// Bytes requested by the heap allocations made while sampling
+    pub fn allocated_bytes(&self) -> u64 {
+        self.allocated_bytes.load(Ordering::Relaxed)
+    }
+
+    /// Takes the duration in nanoseconds of each sample since the last call
+    pub fn take_durations(&self, durations: &mut Vec<u64>) {
+        durations.clear();
+        std::mem::swap(durations, &mut self.durations.lock().unwrap());
+    }
+
+    fn record(&self, duration: Duration, thread: Option<(u64, Allocations)>) {
+        let mut durations = self.durations.lock().unwrap();
+        if durations.len() < MAX_PENDING {
+            durations.push(duration.as_nanos() as u64);
+        }
+        if let Some((cpu_time, allocations)) = thread {
+            self.cpu_time.fetch_add(cpu_time, Ordering::Relaxed);
+            self.allocations
+                .fetch_add(allocations.count, Ordering::Relaxed);
+            self.allocated_bytes
+                .fetch_add(allocations.bytes, Ordering::Relaxed);
+        }
+    }
+}
+
+// start of a sample, to measure the work done until the next tick
+struct Start {
+    time: Instant,
+    thread: libc::pthread_t,
+    cpu_time: u64,
+    allocations: Allocations,
+}
+
+impl Start {
+    fn now() -> Self {
+        Self {
+            time: Instant::now(),
+            thread: unsafe { libc::pthread_self() },
+            cpu_time: thread_cpu_time(),
+            allocations: Allocations::current(),
+        }
+    }
+}
+
+fn thread_cpu_time() -> u64 {
+    let mut ts = libc::timespec {
+        tv_sec: 0,
+        tv_nsec: 0,
+    };
+    unsafe {
+        libc::clock_gettime(libc::CLOCK_THREAD_CPUTIME_ID, &mut ts);
+    }
+    ts.tv_sec as u64 * 1_000_000_000 + ts.tv_nsec as u64
+}
+
+/// Receives the ticks of one interval for a sampler
+pub struct Ticker {
+    receiver: watch::Receiver<Tick>,
+    // shared by the tickers of the interval, which keep its task running
+    _ticks: Arc<watch::Receiver<Tick>>,
+    created: Instant,
+    last: Option<u64>,
+    time: Option<Instant>,
+    started: Option<Start>,
+    stats: Arc<SamplerStats>,
+}
+
+impl Ticker {
+    /// Waits for the next tick. The time since the previous tick was returned
+    /// is recorded as the duration of a sample.
+    pub async fn tick(&mut self) -> Tick {
+        let now = Instant::now();
+        if let Some(start) = self.started.take() {
+            // thread cpu time and allocations are only meaningful if the
+            // sample did not move to another worker thread at an await point
+            let thread = if unsafe { libc::pthread_equal(start.thread, libc::pthread_self()) } != 0
+            {
+                Some((
+                    thread_cpu_time().saturating_sub(start.cpu_time),
+                    Allocations::current().since(start.allocations),
+                ))
+            } else {
+                None
+            };
+            self.stats.record(now - start.time, thread);
+        }
+        loop {
+            if self.receiver.changed().await.is_err() {
+                // the runtime is shutting down
+                std::future::pending::<()>().await;
+            }
+            let tick = *self.receiver.borrow();
+            // a new receiver may see a tick from before it was created
+            if self.last.is_none() && tick.time < self.created {
+                continue;
+            }
+            let scale = self.stats.scale();
+            if tick.sequence % scale != 0 {
+                continue;
+            }
+            if let Some(last) = self.last {
+                // ticks of the stretched interval between the last and this one
+                let missed = ((tick.sequence - 1) / scale).saturating_sub(last / scale);
+                if missed > 0 {
+                    debug!("{} missed {} ticks", self.stats.name, missed);
+                    self.stats.missed.fetch_add(missed, Ordering::Relaxed);
+                }
+                if tick.time < now {
+                    self.stats.late.fetch_add(1, Ordering::Relaxed);
+                }
+            }
+            self.last = Some(tick.sequence);
+            self.time = Some(tick.time);
+            self.started = Some(Start::now());
+            return tick;
+        }
+    }
+
+    /// Time of the most recent tick
+    pub fn time(&self) -> Option<Instant> {
+        self.time
+    }
+
+    /// Current interval between the ticks acted on
+    pub fn interval(&self) -> Duration {
+        self.stats.interval()
+    }
+
+    /// Interval of the ticks, before it is stretched
+    pub fn base_interval(&self) -> Duration {
+        self.stats.base_interval()
+    }
+
+    /// Counts a sample which was cancelled
+    pub fn skip(&self) {
+        self.stats.skipped.fetch_add(1, Ordering::Relaxed);
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn aligned() {
+        let instant = Instant::now();
+        let unix = Duration::from_millis(1_000_250);
+        let second = Duration::from_secs(1);
+
+        let tick = next(instant, unix, second, instant);
+        assert_eq!(tick.sequence, 1001);
+        assert_eq!(tick.time, instant + Duration::from_millis(750));
+
+        // different intervals share the timestamp of coinciding ticks
+        let ten = next(instant, unix, second * 10, instant);
+        assert_eq!(ten.sequence, 101);
+        let later = next(instant, unix, second, ten.time - Duration::from_millis(1));
+        assert_eq!(later.time, ten.time);
+
+        // the tick after one which fired is the next interval
+        let after = next(instant, unix, second, tick.time);
+        assert_eq!(after.sequence, 1002);
+        assert_eq!(after.time, tick.time + second);
+    }
+
+    #[test]
+    fn skips_missed() {
+        let runtime = Runtime::new().unwrap();
+        let clock = Clock::new();
+        let interval = Duration::from_millis(10);
+        let mut ticker = clock.ticker(&runtime, "test", interval, 0);
+        let (first, second) = runtime.block_on(async {
+            let first = ticker.tick().await;
+            std::thread::sleep(interval * 3);
+            (first, ticker.tick().await)
+        });
+        assert!(second.sequence > first.sequence + 1);
+
+        let stats = &clock.samplers()[0];
+        assert_eq!(stats.name(), "test");
+        assert_eq!(stats.missed(), second.sequence - first.sequence - 1);
+        assert_eq!(stats.late(), 1);
+        let mut durations = Vec::new();
+        stats.take_durations(&mut durations);
+        assert_eq!(durations.len(), 1);
+        assert!(durations[0] >= (interval * 3).as_nanos() as u64);
+        stats.take_durations(&mut durations);
+        assert!(durations.is_empty());
+    }
+
+    #[test]
+    fn stretched() {
+        let runtime = Runtime::new().unwrap();
+        let clock = Clock::new();
+        let interval = Duration::from_millis(5);
+        let mut ticker = clock.ticker(&runtime, "test", interval, 0);
+        let stats = clock.samplers()[0].clone();
+        stats.set_scale(3);
+        assert_eq!(stats.interval(), interval * 3);
+        runtime.block_on(async {
+            for _ in 0..3 {
+                assert_eq!(ticker.tick().await.sequence % 3, 0);
+            }
+        });
+        assert_eq!(stats.missed(), 0);
+    }
+
+    #[test]
+    fn changed_interval() {
+        let runtime = Runtime::new().unwrap();
+        let clock = Clock::new();
+        let ticker = clock.ticker(&runtime, "test", Duration::from_millis(5), 0);
+        clock.samplers()[0].set_scale(2);
+        let ticker = {
+            drop(ticker);
+            clock.ticker(&runtime, "test", Duration::from_millis(10), 0)
+        };
+        // the interval which is no longer used is forgotten, and its task
+        // ends on its next tick
+        assert_eq!(clock.intervals.lock().unwrap().len(), 1);
+        // the instrumentation carries over to the new ticker
+        assert_eq!(clock.samplers().len(), 1);
+        assert_eq!(ticker.base_interval(), Duration::from_millis(10));
+        assert_eq!(ticker.interval(), Duration::from_millis(20));
+    }
+}
@@ -4,13 +4,19 @@
 
 use std::collections::HashMap;
 use std::io::BufRead;
-use std::io::SeekFrom;
+use std::path::Path;
 
 use dashmap::DashMap;
-use tokio::fs::File;
-use tokio::io::{AsyncBufReadExt, AsyncSeekExt, BufReader};
 
+pub mod alloc;
+pub mod archive;
 pub mod bpf;
+pub mod clock;
+pub mod peak;
+pub mod placement;
+pub mod procfs;
+
+use procfs::ProcFile;
 
 pub const VERSION: &str = env!("CARGO_PKG_VERSION");
 pub const NAME: &str = env!("CARGO_PKG_NAME");
@@ -25,31 +31,18 @@ pub struct HardwareInfo {
 }
 
 impl HardwareInfo {
-    pub fn new() -> Self {
+    /// Reads the cpus of each numa node from sysfs mounted at `sys_root`
+    pub fn new(sys_root: &Path) -> Self {
         let numa_mapping = DashMap::new();
         let mut node = 0;
         loop {
-            let path = format!("/sys/devices/system/node/node{}/cpulist", node);
+            let path = sys_root.join(format!("devices/system/node/node{}/cpulist", node));
             if let Ok(f) = std::fs::File::open(path) {
                 let mut reader = std::io::BufReader::new(f);
                 let mut line = String::new();
                 if reader.read_line(&mut line).is_ok() {
-                    let ranges: Vec<&str> = line.trim().split(',').collect();
-                    for range in ranges {
-                        let parts: Vec<&str> = range.split('-').collect();
-                        if parts.len() == 1 {
-                            if let Ok(id) = parts[0].parse() {
-                                numa_mapping.insert(id, node);
-                            }
-                        } else if parts.len() == 2 {
-                            if let Ok(start) = parts[0].parse() {
-                                if let Ok(stop) = parts[1].parse() {
-                                    for id in start..=stop {
-                                        numa_mapping.insert(id, node);
-                                    }
-                                }
-                            }
-                        }
+                    for id in placement::parse_cpulist(&line).unwrap_or_default() {
+                        numa_mapping.insert(id as u64, node);
                     }
                 }
             } else {
@@ -65,11 +58,12 @@ impl HardwareInfo {
     }
 }
 
-/// helper function to discover the number of hardware threads
-pub fn hardware_threads() -> Result<u64, ()> {
-    let path = "/sys/devices/system/cpu/present";
-    let f =
-        std::fs::File::open(path).map_err(|e| debug!("failed to open file ({:?}): {}", path, e))?;
+/// helper function to discover the number of hardware threads from sysfs
+/// mounted at `sys_root`
+pub fn hardware_threads(sys_root: &Path) -> Result<u64, ()> {
+    let path = sys_root.join("devices/system/cpu/present");
+    let f = std::fs::File::open(&path)
+        .map_err(|e| debug!("failed to open file ({:?}): {}", path, e))?;
     let mut f = std::io::BufReader::new(f);
 
     let mut line = String::new();
@@ -88,33 +82,29 @@ pub fn hardware_threads() -> Result<u64, ()> {
 /// pkey1 lkey1 lkey2 ... lkeyN
 /// pkey1 value1 value2 ... valueN
 /// pkey2 ...
-pub async fn nested_map_from_file(
-    file: &mut File,
+pub fn nested_map_from_file(
+    file: &mut ProcFile,
 ) -> Result<HashMap<String, HashMap<String, u64>>, std::io::Error> {
-    file.seek(SeekFrom::Start(0)).await?;
     let mut ret = HashMap::<String, HashMap<String, u64>>::new();
-    let mut reader = BufReader::new(file);
-    let mut keys = String::new();
-    let mut values = String::new();
-    while reader.read_line(&mut keys).await? > 0 {
-        if reader.read_line(&mut values).await? > 0 {
-            let mut keys_split = keys.trim().split_whitespace();
-            let mut values_split = values.trim().split_whitespace();
+    let mut lines = file.lines()?;
+    while let Some(keys) = lines.next() {
+        if let Some(values) = lines.next() {
+            let mut keys_split = procfs::fields(keys);
+            let mut values_split = procfs::fields(values);
 
             if let Some(pkey) = keys_split.next() {
                 let _ = values_split.next();
+                let pkey = procfs::as_str(pkey);
                 if !ret.contains_key(pkey) {
                     ret.insert(pkey.to_string(), Default::default());
                 }
                 let inner = ret.get_mut(pkey).unwrap();
                 for key in keys_split {
-                    if let Some(Ok(value)) = values_split.next().map(|v| v.parse()) {
-                        inner.insert(key.to_owned(), value);
+                    if let Some(value) = values_split.next().and_then(procfs::parse_u64) {
+                        inner.insert(procfs::as_str(key).to_owned(), value);
                     }
                 }
             }
-            keys.clear();
-            values.clear();
         }
     }
     Ok(ret)
@@ -0,0 +1,231 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+//! Detection of bursts in counters between the samples of a sampler.
+//!
+//! A `PeakDetector` reads a few chosen counters at a much shorter interval
+//! than the sampler, through a reader which keeps its file or table open, and
+//! keeps the highest rate of each counter, and when it occurred, over a
+//! rolling window. A burst which is averaged away over the sampler's interval
+//! is still visible as the peak rate. Samplers export the peaks as
+//! `<statistic>/peak`, the rate per second, and `<statistic>/peak/time`, the
+//! unix time in milliseconds at which it was read.
+
+use std::sync::{Arc, Mutex, Weak};
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+use tokio::runtime::Runtime;
+
+use crate::metrics::{Source, Statistic};
+
+/// Statistic for the peak rate of a counter, or the time of the peak
+pub struct PeakStatistic {
+    name: String,
+}
+
+impl PeakStatistic {
+    pub fn rate(counter: &dyn Statistic) -> Self {
+        Self {
+            name: format!("{}/peak", counter.name()),
+        }
+    }
+
+    pub fn time(counter: &dyn Statistic) -> Self {
+        Self {
+            name: format!("{}/peak/time", counter.name()),
+        }
+    }
+}
+
+impl Statistic for PeakStatistic {
+    fn name(&self) -> &str {
+        &self.name
+    }
+
+    fn source(&self) -> Source {
+        Source::Gauge
+    }
+}
+
+/// Highest rate of a counter within the window
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct Peak {
+    /// Rate per second
+    pub rate: u64,
+    /// Unix time in milliseconds of the reading which completed the peak
+    pub time: u64,
+}
+
+#[derive(Clone, Copy, Default)]
+struct Slice {
+    // second since the detector was created, starting from one so that zero
+    // marks an unused slice
+    sequence: u64,
+    rate: u64,
+    time: u64,
+}
+
+struct Counter {
+    previous: Option<(u64, u64)>,
+    slices: Box<[Slice]>,
+}
+
+pub struct PeakDetector {
+    // the same moment as an instant and as milliseconds since the unix epoch
+    instant: Instant,
+    unix: u64,
+    counters: Mutex<Vec<Counter>>,
+    // readings taken by the task, reused between reads
+    values: Mutex<Vec<u64>>,
+}
+
+impl PeakDetector {
+    /// Creates a detector for `counters` counters, which keeps their peaks
+    /// for the window in one second slices
+    pub fn new(counters: usize, window: Duration) -> Self {
+        let slices = std::cmp::max(window.as_secs(), 1) as usize;
+        Self {
+            instant: Instant::now(),
+            unix: SystemTime::now()
+                .duration_since(UNIX_EPOCH)
+                .unwrap_or_default()
+                .as_millis() as u64,
+            counters: Mutex::new(
+                (0..counters)
+                    .map(|_| Counter {
+                        previous: None,
+                        slices: vec![Slice::default(); slices].into_boxed_slice(),
+                    })
+                    .collect(),
+            ),
+            values: Mutex::new(vec![0; counters]),
+        }
+    }
+
+    /// Records a reading of each of the counters, in order, taken at `time`
+    pub fn record(&self, time: Instant, values: &[u64]) {
+        let nanos = time.saturating_duration_since(self.instant).as_nanos() as u64;
+        let sequence = nanos / 1_000_000_000 + 1;
+        let unix = self.unix + nanos / 1_000_000;
+        let mut counters = self.counters.lock().unwrap();
+        for (counter, value) in counters.iter_mut().zip(values) {
+            let previous = counter.previous.replace((nanos, *value));
+            // a counter which went backwards was reset
+            let rate = match previous {
+                Some((previous_time, previous)) if nanos > previous_time && *value >= previous => {
+                    (*value - previous) as u128 * 1_000_000_000 / (nanos - previous_time) as u128
+                }
+                _ => continue,
+            } as u64;
+            let len = counter.slices.len() as u64;
+            let slice = &mut counter.slices[(sequence % len) as usize];
+            if slice.sequence != sequence {
+                *slice = Slice {
+                    sequence,
+                    rate,
+                    time: unix,
+                };
+            } else if rate > slice.rate {
+                slice.rate = rate;
+                slice.time = unix;
+            }
+        }
+    }
+
+    /// Highest rate of each counter within the window ending at `now`, in
+    /// the same order as the readings
+    pub fn peaks(&self, now: Instant) -> Vec<Option<Peak>> {
+        let newest = now.saturating_duration_since(self.instant).as_secs() + 1;
+        let counters = self.counters.lock().unwrap();
+        counters
+            .iter()
+            .map(|counter| {
+                let oldest = newest.saturating_sub(counter.slices.len() as u64 - 1);
+                counter
+                    .slices
+                    .iter()
+                    .filter(|slice| slice.sequence >= oldest && slice.sequence != 0)
+                    .max_by_key(|slice| (slice.rate, slice.time))
+                    .map(|slice| Peak {
+                        rate: slice.rate,
+                        time: slice.time,
+                    })
+            })
+            .collect()
+    }
+
+    /// Spawns a task which calls `read` every `interval` to fill in the
+    /// current value of each counter. The task stops when the detector is
+    /// dropped, and skips a reading which fails.
+    pub fn spawn<F>(self: &Arc<Self>, runtime: &Runtime, interval: Duration, read: F)
+    where
+        F: FnMut(&mut [u64]) -> Result<(), std::io::Error> + Send + 'static,
+    {
+        runtime.spawn(drive(Arc::downgrade(self), interval, read));
+    }
+}
+
+async fn drive<F>(detector: Weak<PeakDetector>, interval: Duration, mut read: F)
+where
+    F: FnMut(&mut [u64]) -> Result<(), std::io::Error> + Send + 'static,
+{
+    let interval = std::cmp::max(interval, Duration::from_millis(1));
+    let mut next = Instant::now();
+    loop {
+        let detector = match detector.upgrade() {
+            Some(detector) => detector,
+            None => return,
+        };
+        {
+            let mut values = detector.values.lock().unwrap();
+            match read(&mut values) {
+                Ok(()) => detector.record(Instant::now(), &values),
+                Err(e) => debug!("peak detector read failed: {}", e),
+            }
+        }
+        drop(detector);
+        // a late wakeup skips the readings it missed rather than bunching up
+        next += interval;
+        let now = Instant::now();
+        if next < now {
+            next = now + interval;
+        }
+        tokio::time::sleep_until(next.into()).await;
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn peaks() {
+        let detector = PeakDetector::new(2, Duration::from_secs(3));
+        let start = detector.instant;
+        let ms = |ms| start + Duration::from_millis(ms);
+        assert_eq!(detector.peaks(start), vec![None, None]);
+
+        // a 10ms burst within the first second
+        detector.record(ms(0), &[0, 100]);
+        detector.record(ms(10), &[10, 100]);
+        detector.record(ms(20), &[1_010, 100]);
+        detector.record(ms(1_020), &[2_010, 50]);
+        let peaks = detector.peaks(ms(1_500));
+        assert_eq!(
+            peaks[0],
+            Some(Peak {
+                rate: 100_000,
+                time: detector.unix + 20,
+            })
+        );
+        // the reset counter has a rate of zero since
+        assert_eq!(peaks[1].map(|peak| peak.rate), Some(0));
+
+        // the burst leaves the window after three seconds
+        detector.record(ms(3_020), &[4_010, 50]);
+        let peaks = detector.peaks(ms(3_500));
+        assert_eq!(peaks[0].map(|peak| peak.rate), Some(1_000));
+        assert_eq!(detector.peaks(ms(10_000)), vec![None, None]);
+    }
+}
@@ -0,0 +1,135 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+//! Placement of the agent on the host.
+//!
+//! Rezolus can be kept off the cores of latency-critical services by pinning
+//! it to a set of housekeeping CPUs, running it at `SCHED_IDLE` or a higher
+//! nice value, that is a lower priority, and moving it into a cgroup of its
+//! own with a CPU quota. The CPU affinity and scheduling of a thread are inherited by the threads it
+//! creates, so they are applied to the main thread before any other thread is
+//! started, and so cover the runtime workers, the exposition and the rest.
+
+use std::io::{Error, ErrorKind};
+use std::path::{Path, PathBuf};
+
+use crate::config::General;
+
+// root of the cgroup v2 hierarchy, relative to sysfs
+const CGROUP_ROOT: &str = "fs/cgroup";
+
+// period of the cgroup cpu quota in microseconds
+const CPU_PERIOD: u64 = 100_000;
+
+/// Applies the configured CPU affinity, scheduling and cgroup to the process
+pub fn apply(general: &General) -> Result<(), Error> {
+    if let Some(cpus) = general.cpus() {
+        let cpus = parse_cpulist(cpus)
+            .ok_or_else(|| Error::new(ErrorKind::InvalidInput, "invalid cpu list"))?;
+        pin(&cpus)?;
+        debug!("pinned to cpus: {:?}", cpus);
+    }
+    if general.sched_idle() {
+        let param = libc::sched_param { sched_priority: 0 };
+        if unsafe { libc::sched_setscheduler(0, libc::SCHED_IDLE, &param) } != 0 {
+            return Err(Error::last_os_error());
+        }
+        debug!("running at SCHED_IDLE");
+    } else if let Some(nice) = general.nice() {
+        if unsafe { libc::setpriority(libc::PRIO_PROCESS, 0, nice) } != 0 {
+            return Err(Error::last_os_error());
+        }
+        debug!("running at nice {}", nice);
+    }
+    if let Some(cgroup) = general.cgroup() {
+        let path = cgroup_path(general.sys_root(), cgroup);
+        join_cgroup(&path, general.cgroup_cpu_quota())?;
+        debug!("moved to cgroup: {:?}", path);
+    }
+    Ok(())
+}
+
+/// Parses a list of CPUs in the kernel's format, such as `0-3,8,10-11`
+pub fn parse_cpulist(list: &str) -> Option<Vec<usize>> {
+    let mut cpus = Vec::new();
+    for range in list.trim().split(',').filter(|range| !range.is_empty()) {
+        let mut parts = range.splitn(2, '-');
+        let start: usize = parts.next()?.trim().parse().ok()?;
+        let stop: usize = match parts.next() {
+            Some(stop) => stop.trim().parse().ok()?,
+            None => start,
+        };
+        if stop < start {
+            return None;
+        }
+        cpus.extend(start..=stop);
+    }
+    Some(cpus)
+}
+
+fn pin(cpus: &[usize]) -> Result<(), Error> {
+    // an empty set would be rejected by the kernel with EINVAL
+    if cpus.is_empty() {
+        return Err(Error::new(ErrorKind::InvalidInput, "empty cpu list"));
+    }
+    let mut set: libc::cpu_set_t = unsafe { std::mem::zeroed() };
+    for cpu in cpus {
+        if *cpu >= libc::CPU_SETSIZE as usize {
+            return Err(Error::new(ErrorKind::InvalidInput, "cpu out of range"));
+        }
+        unsafe { libc::CPU_SET(*cpu, &mut set) };
+    }
+    if unsafe { libc::sched_setaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &set) } != 0 {
+        return Err(Error::last_os_error());
+    }
+    Ok(())
+}
+
+// moves the process into the cgroup, creating it if needed, with a quota of
+// `cores` of cpu time. this requires cgroup v2.
+fn join_cgroup(path: &Path, cores: Option<f64>) -> Result<(), Error> {
+    std::fs::create_dir_all(path)?;
+    if let Some(cores) = cores {
+        // the cpu controller must be enabled for the children of the parent,
+        // which fails harmlessly if it already is or cannot be
+        if let Some(parent) = path.parent() {
+            let _ = std::fs::write(parent.join("cgroup.subtree_control"), "+cpu");
+        }
+        let quota = ((cores * CPU_PERIOD as f64) as u64).max(1_000);
+        std::fs::write(path.join("cpu.max"), format!("{} {}", quota, CPU_PERIOD))?;
+    }
+    std::fs::write(path.join("cgroup.procs"), std::process::id().to_string())
+}
+
+// the cgroup, relative to the root of the cgroup v2 hierarchy
+fn cgroup_path(sys_root: &Path, cgroup: &str) -> PathBuf {
+    sys_root
+        .join(CGROUP_ROOT)
+        .join(cgroup.trim_start_matches('/'))
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn cpulist() {
+        assert_eq!(
+            parse_cpulist("0-3,8,10-11\n"),
+            Some(vec![0, 1, 2, 3, 8, 10, 11])
+        );
+        assert_eq!(parse_cpulist("5"), Some(vec![5]));
+        assert_eq!(parse_cpulist(""), Some(vec![]));
+        assert_eq!(parse_cpulist("3-1"), None);
+        assert_eq!(parse_cpulist("a"), None);
+    }
+
+    #[test]
+    fn pin_empty() {
+        // a node without cpus has an empty list, which cannot be pinned to
+        let error = pin(&parse_cpulist(",\n").unwrap()).unwrap_err();
+        assert_eq!(error.kind(), ErrorKind::InvalidInput);
+        assert_eq!(error.to_string(), "empty cpu list");
+    }
+}
@@ -0,0 +1,222 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+//! Synchronous reads of procfs and sysfs files for samplers.
+//!
+//! Files are opened once and re-read from the start with `pread` into a
+//! buffer which is kept across reads, so steady-state sampling costs one or
+//! two syscalls per file and does not allocate. Contents are parsed in place
+//! with the line and field iterators over bytes.
+//!
+//! Samplers which read many small files each interval, such as per-CPU sysfs
+//! attributes, should use a `BatchReader`, which reads all of them with a
+//! single io_uring submission.
+
+use std::fs::File;
+use std::io::{Error, ErrorKind};
+use std::os::unix::fs::FileExt;
+use std::path::Path;
+
+mod batch;
+
+pub use batch::BatchReader;
+
+const INITIAL_CAPACITY: usize = 4096;
+
+/// A procfs or sysfs file which is kept open and re-read on each sample
+pub struct ProcFile {
+    file: File,
+    buf: Vec<u8>,
+}
+
+impl ProcFile {
+    pub fn open<P: AsRef<Path>>(path: P) -> Result<Self, Error> {
+        Ok(Self {
+            file: File::open(path)?,
+            buf: vec![0; INITIAL_CAPACITY],
+        })
+    }
+
+    /// Reads the current contents of the file. The buffer grows to fit the
+    /// file and is reused for later reads.
+    pub fn read(&mut self) -> Result<&[u8], Error> {
+        let len = read_from(&self.file, &mut self.buf, 0)?;
+        Ok(&self.buf[..len])
+    }
+
+    /// Reads the file and iterates over its lines
+    pub fn lines(&mut self) -> Result<Lines<'_>, Error> {
+        Ok(lines(self.read()?))
+    }
+
+    /// Reads a file which holds a single integer, as is common in sysfs
+    pub fn read_u64(&mut self) -> Result<u64, Error> {
+        fields(self.read()?)
+            .next()
+            .and_then(parse_u64)
+            .ok_or_else(|| Error::new(ErrorKind::InvalidData, "expected an integer"))
+    }
+}
+
+// reads the file into the buffer with pread, starting from `offset` bytes
+// which are already in the buffer, and grows the buffer until the whole file
+// fits. returns the length of the file.
+fn read_from(file: &File, buf: &mut Vec<u8>, offset: usize) -> Result<usize, Error> {
+    let mut len = offset;
+    loop {
+        if len == buf.len() {
+            buf.resize(std::cmp::max(buf.len() * 2, INITIAL_CAPACITY), 0);
+        }
+        match file.read_at(&mut buf[len..], len as u64) {
+            Ok(0) => return Ok(len),
+            Ok(n) => len += n,
+            Err(e) if e.kind() == ErrorKind::Interrupted => continue,
+            Err(e) => return Err(e),
+        }
+    }
+}
+
+/// Iterator over the lines of a buffer, without the trailing newline
+pub struct Lines<'a> {
+    remaining: &'a [u8],
+}
+
+pub fn lines(buf: &[u8]) -> Lines<'_> {
+    Lines { remaining: buf }
+}
+
+impl<'a> Iterator for Lines<'a> {
+    type Item = &'a [u8];
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.remaining.is_empty() {
+            return None;
+        }
+        match self.remaining.iter().position(|b| *b == b'\n') {
+            Some(end) => {
+                let line = &self.remaining[..end];
+                self.remaining = &self.remaining[(end + 1)..];
+                Some(line)
+            }
+            None => {
+                let line = self.remaining;
+                self.remaining = &[];
+                Some(line)
+            }
+        }
+    }
+}
+
+/// Iterator over the whitespace separated fields of a line
+pub fn fields(line: &[u8]) -> impl Iterator<Item = &[u8]> {
+    line.split(|b| b.is_ascii_whitespace())
+        .filter(|field| !field.is_empty())
+}
+
+/// Parses an unsigned decimal integer, returning `None` if the field has any
+/// other characters
+pub fn parse_u64(field: &[u8]) -> Option<u64> {
+    if field.is_empty() {
+        return None;
+    }
+    let mut value: u64 = 0;
+    for b in field {
+        if !b.is_ascii_digit() {
+            return None;
+        }
+        value = value.checked_mul(10)?.checked_add((b - b'0') as u64)?;
+    }
+    Some(value)
+}
+
+/// Interprets a field as a string. Fields in procfs and sysfs are ascii.
+pub fn as_str(field: &[u8]) -> &str {
+    std::str::from_utf8(field).unwrap_or("")
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn parse_lines_and_fields() {
+        let buf = b"cpu  131586 0 53564\ncpu0 1 2 3\n\nintr 42";
+        let lines: Vec<&[u8]> = lines(buf).collect();
+        assert_eq!(lines.len(), 4);
+        assert!(lines[2].is_empty());
+
+        let mut fields = fields(lines[0]);
+        assert_eq!(fields.next(), Some(&b"cpu"[..]));
+        assert_eq!(fields.next().and_then(parse_u64), Some(131586));
+        assert_eq!(fields.next().and_then(parse_u64), Some(0));
+        assert_eq!(fields.next().and_then(parse_u64), Some(53564));
+        assert_eq!(fields.next(), None);
+
+        assert_eq!(parse_u64(b"12a"), None);
+        assert_eq!(parse_u64(b"18446744073709551616"), None);
+    }
+
+    #[test]
+    fn read_proc_file() {
+        let mut file = ProcFile::open("/proc/self/stat").unwrap();
+        let first = file.read().unwrap().len();
+        assert!(first > 0);
+        // re-reading starts from the beginning
+        assert_eq!(file.lines().unwrap().count(), 1);
+    }
+
+    // compares the cost of sampling /proc/stat with tokio::fs against this
+    // module, run with:
+    // cargo test --release -- --ignored --nocapture bench_proc_stat
+    #[test]
+    #[ignore]
+    fn bench_proc_stat() {
+        use std::time::Instant;
+        use tokio::io::{AsyncBufReadExt, AsyncSeekExt};
+
+        const ITERATIONS: u32 = 10_000;
+
+        let runtime = tokio::runtime::Builder::new_multi_thread()
+            .enable_all()
+            .worker_threads(1)
+            .build()
+            .unwrap();
+        let tokio_elapsed = runtime.block_on(async {
+            let mut file = tokio::fs::File::open("/proc/stat").await.unwrap();
+            let start = Instant::now();
+            let mut total = 0;
+            for _ in 0..ITERATIONS {
+                file.seek(std::io::SeekFrom::Start(0)).await.unwrap();
+                let mut reader = tokio::io::BufReader::new(&mut file);
+                let mut line = String::new();
+                while reader.read_line(&mut line).await.unwrap() > 0 {
+                    total += line
+                        .split_whitespace()
+                        .filter_map(|v| v.parse::<u64>().ok())
+                        .count();
+                    line.clear();
+                }
+            }
+            assert!(total > 0);
+            start.elapsed()
+        });
+
+        let mut file = ProcFile::open("/proc/stat").unwrap();
+        let start = Instant::now();
+        let mut total = 0;
+        for _ in 0..ITERATIONS {
+            for line in file.lines().unwrap() {
+                total += fields(line).filter_map(parse_u64).count();
+            }
+        }
+        assert!(total > 0);
+        let procfs_elapsed = start.elapsed();
+
+        println!(
+            "/proc/stat tokio::fs: {:?}/read procfs: {:?}/read",
+            tokio_elapsed / ITERATIONS,
+            procfs_elapsed / ITERATIONS
+        );
+    }
+}
@@ -0,0 +1,642 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+//! Batched reads of many small procfs and sysfs files.
+//!
+//! All registered files are read with one io_uring submission per interval
+//! and the results are harvested in a single pass over the completion queue.
+//! The files are registered with the ring as fixed files so the kernel does
+//! not need to look up each fd on every read. Reads of files which cannot be
+//! read without blocking, as most procfs and sysfs files, are completed by the
+//! io-wq workers of the ring; `bench_batch` compares the time and cpu this
+//! takes with `pread`. When the ring cannot be set up or its probe reports no
+//! IORING_OP_READ (kernels before 5.6, or blocked by seccomp) the files are
+//! read with `pread` instead. A read which fails only fails for its own file.
+
+use std::fs::File;
+use std::io::{Error, ErrorKind};
+use std::os::unix::io::{AsRawFd, RawFd};
+use std::path::Path;
+use std::sync::atomic::{AtomicU32, Ordering};
+
+use super::{fields, parse_u64, read_from};
+
+// most sysfs attributes are a single short value
+const SLOT_SIZE: usize = 64;
+
+// upper bound on the ring size, larger batches are submitted in chunks
+const MAX_ENTRIES: usize = 4096;
+
+/// A set of files which are all re-read on each call to `read`
+pub struct BatchReader {
+    entries: Vec<Entry>,
+    ring: Option<Ring>,
+    // io_uring failed and should not be retried
+    fallback: bool,
+    // files were added since they were last registered with the ring
+    registered: bool,
+}
+
+struct Entry {
+    file: File,
+    buf: Vec<u8>,
+    len: Option<usize>,
+}
+
+impl BatchReader {
+    pub fn new() -> Self {
+        Self {
+            entries: Vec::new(),
+            ring: None,
+            fallback: false,
+            registered: false,
+        }
+    }
+
+    /// Reader which never uses io_uring
+    pub fn with_pread() -> Self {
+        Self {
+            fallback: true,
+            ..Self::new()
+        }
+    }
+
+    /// Opens a file and adds it to the batch, returning its index
+    pub fn add<P: AsRef<Path>>(&mut self, path: P) -> Result<usize, Error> {
+        self.entries.push(Entry {
+            file: File::open(path)?,
+            buf: vec![0; SLOT_SIZE],
+            len: None,
+        });
+        self.registered = false;
+        Ok(self.entries.len() - 1)
+    }
+
+    /// Reads the current contents of all files in the batch. Individual files
+    /// which fail to read are reported as `None` by `get`.
+    pub fn read(&mut self) {
+        if !self.fallback && !self.entries.is_empty() {
+            match self.read_uring() {
+                Ok(()) => return,
+                Err(e) => {
+                    debug!("io_uring unavailable, falling back to pread: {}", e);
+                    if let Some(ring) = self.ring.take() {
+                        if ring.in_flight > 0 {
+                            // the kernel may still write into the buffers of
+                            // reads which could not be waited for, so they
+                            // are leaked rather than read into
+                            for entry in &mut self.entries {
+                                std::mem::forget(std::mem::replace(
+                                    &mut entry.buf,
+                                    vec![0; SLOT_SIZE],
+                                ));
+                            }
+                        }
+                    }
+                    self.fallback = true;
+                }
+            }
+        }
+        for entry in &mut self.entries {
+            entry.len = read_from(&entry.file, &mut entry.buf, 0).ok();
+        }
+    }
+
+    /// Contents of the file at `index` from the most recent `read`
+    pub fn get(&self, index: usize) -> Option<&[u8]> {
+        let entry = self.entries.get(index)?;
+        entry.len.map(|len| &entry.buf[..len])
+    }
+
+    /// Parses the file at `index` as a single integer
+    pub fn get_u64(&self, index: usize) -> Option<u64> {
+        fields(self.get(index)?).next().and_then(parse_u64)
+    }
+
+    // errors are from setting up or entering the ring, which are retried with
+    // pread. the result of each read only applies to its file.
+    fn read_uring(&mut self) -> Result<(), Error> {
+        if self.ring.is_none() {
+            let entries = self.entries.len().min(MAX_ENTRIES).next_power_of_two();
+            self.ring = Some(Ring::new(entries as u32)?);
+        }
+        let ring = self.ring.as_mut().unwrap();
+        if !self.registered {
+            let fds: Vec<RawFd> = self.entries.iter().map(|e| e.file.as_raw_fd()).collect();
+            ring.register_files(&fds)?;
+            self.registered = true;
+        }
+
+        let size = ring.entries as usize;
+        for start in (0..self.entries.len()).step_by(size) {
+            let end = (start + size).min(self.entries.len());
+            for (index, entry) in self.entries[start..end].iter_mut().enumerate() {
+                entry.len = None;
+                ring.push_read(start + index, &mut entry.buf);
+            }
+            let entries = &mut self.entries;
+            ring.submit_and_wait(end - start, |index, result| {
+                if let Some(entry) = entries.get_mut(index) {
+                    entry.len = if result < 0 {
+                        None
+                    } else if result as usize == entry.buf.len() {
+                        // the file did not fit, read the remainder directly
+                        read_from(&entry.file, &mut entry.buf, result as usize).ok()
+                    } else {
+                        Some(result as usize)
+                    };
+                }
+            })?;
+        }
+        Ok(())
+    }
+}
+
+impl Default for BatchReader {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+// from uapi/linux/io_uring.h
+const IORING_OFF_SQ_RING: libc::off_t = 0;
+const IORING_OFF_CQ_RING: libc::off_t = 0x8000000;
+const IORING_OFF_SQES: libc::off_t = 0x10000000;
+const IORING_ENTER_GETEVENTS: u32 = 1;
+const IORING_REGISTER_FILES: u32 = 2;
+const IORING_UNREGISTER_FILES: u32 = 3;
+const IORING_REGISTER_PROBE: u32 = 8;
+const IO_URING_OP_SUPPORTED: u16 = 1;
+const IORING_OP_READ: u8 = 22;
+const IOSQE_FIXED_FILE: u8 = 1;
+
+#[repr(C)]
+#[derive(Default)]
+struct SqringOffsets {
+    head: u32,
+    tail: u32,
+    ring_mask: u32,
+    ring_entries: u32,
+    flags: u32,
+    dropped: u32,
+    array: u32,
+    _resv1: u32,
+    _resv2: u64,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct CqringOffsets {
+    head: u32,
+    tail: u32,
+    ring_mask: u32,
+    ring_entries: u32,
+    overflow: u32,
+    cqes: u32,
+    flags: u32,
+    _resv1: u32,
+    _resv2: u64,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct Params {
+    sq_entries: u32,
+    cq_entries: u32,
+    flags: u32,
+    sq_thread_cpu: u32,
+    sq_thread_idle: u32,
+    features: u32,
+    wq_fd: u32,
+    _resv: [u32; 3],
+    sq_off: SqringOffsets,
+    cq_off: CqringOffsets,
+}
+
+#[repr(C)]
+struct Sqe {
+    opcode: u8,
+    flags: u8,
+    ioprio: u16,
+    fd: i32,
+    off: u64,
+    addr: u64,
+    len: u32,
+    rw_flags: u32,
+    user_data: u64,
+    _pad: [u64; 3],
+}
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+struct ProbeOp {
+    op: u8,
+    _resv: u8,
+    flags: u16,
+    _resv2: u32,
+}
+
+#[repr(C)]
+struct Probe {
+    last_op: u8,
+    ops_len: u8,
+    _resv: u16,
+    _resv2: [u32; 3],
+    ops: [ProbeOp; 256],
+}
+
+#[repr(C)]
+struct Cqe {
+    user_data: u64,
+    res: i32,
+    flags: u32,
+}
+
+struct Mmap {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+impl Mmap {
+    fn new(fd: RawFd, len: usize, offset: libc::off_t) -> Result<Self, Error> {
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                len,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_SHARED | libc::MAP_POPULATE,
+                fd,
+                offset,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(Error::last_os_error());
+        }
+        Ok(Self { ptr, len })
+    }
+
+    fn at<T>(&self, offset: u32) -> *mut T {
+        unsafe { (self.ptr as *mut u8).add(offset as usize) as *mut T }
+    }
+}
+
+impl Drop for Mmap {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.ptr, self.len);
+        }
+    }
+}
+
+// an io_uring instance with its submission and completion queues mapped.
+// each batch is submitted and fully reaped before the next one, so the queues
+// are never shared with another thread.
+struct Ring {
+    fd: RawFd,
+    entries: u32,
+    params: Params,
+    sq: Mmap,
+    cq: Mmap,
+    sqes: Mmap,
+    files: usize,
+    // reads which were submitted but not reaped when waiting for them failed
+    in_flight: usize,
+}
+
+// the mappings are only accessed through `&mut self`
+unsafe impl Send for Ring {}
+
+impl Ring {
+    fn new(entries: u32) -> Result<Self, Error> {
+        let mut params = Params::default();
+        let fd = unsafe {
+            libc::syscall(
+                libc::SYS_io_uring_setup,
+                entries,
+                &mut params as *mut Params,
+            )
+        };
+        if fd < 0 {
+            return Err(Error::last_os_error());
+        }
+        let fd = fd as RawFd;
+        let map = || -> Result<(Mmap, Mmap, Mmap), Error> {
+            let sq_len = params.sq_off.array as usize + params.sq_entries as usize * 4;
+            let cq_len = params.cq_off.cqes as usize
+                + params.cq_entries as usize * std::mem::size_of::<Cqe>();
+            let sqes_len = params.sq_entries as usize * std::mem::size_of::<Sqe>();
+            Ok((
+                Mmap::new(fd, sq_len, IORING_OFF_SQ_RING)?,
+                Mmap::new(fd, cq_len, IORING_OFF_CQ_RING)?,
+                Mmap::new(fd, sqes_len, IORING_OFF_SQES)?,
+            ))
+        };
+        let (sq, cq, sqes) = match map() {
+            Ok(maps) => maps,
+            Err(e) => {
+                unsafe {
+                    libc::close(fd);
+                }
+                return Err(e);
+            }
+        };
+        let ring = Self {
+            fd,
+            entries: params.sq_entries,
+            params,
+            sq,
+            cq,
+            sqes,
+            files: 0,
+            in_flight: 0,
+        };
+        // kernels before 5.6 have neither the probe nor IORING_OP_READ
+        if !ring.supports(IORING_OP_READ)? {
+            return Err(Error::new(
+                ErrorKind::Other,
+                "io_uring does not support IORING_OP_READ",
+            ));
+        }
+        Ok(ring)
+    }
+
+    fn supports(&self, opcode: u8) -> Result<bool, Error> {
+        let mut probe: Probe = unsafe { std::mem::zeroed() };
+        self.register(
+            IORING_REGISTER_PROBE,
+            &mut probe as *mut Probe as *const libc::c_void,
+            probe.ops.len() as u32,
+        )?;
+        let op = &probe.ops[opcode as usize];
+        Ok(opcode < probe.ops_len && op.flags & IO_URING_OP_SUPPORTED != 0)
+    }
+
+    fn register(&self, opcode: u32, arg: *const libc::c_void, count: u32) -> Result<(), Error> {
+        let ret =
+            unsafe { libc::syscall(libc::SYS_io_uring_register, self.fd, opcode, arg, count) };
+        if ret < 0 {
+            Err(Error::last_os_error())
+        } else {
+            Ok(())
+        }
+    }
+
+    fn register_files(&mut self, fds: &[RawFd]) -> Result<(), Error> {
+        if self.files > 0 {
+            self.register(IORING_UNREGISTER_FILES, std::ptr::null(), 0)?;
+            self.files = 0;
+        }
+        self.register(
+            IORING_REGISTER_FILES,
+            fds.as_ptr() as *const libc::c_void,
+            fds.len() as u32,
+        )?;
+        self.files = fds.len();
+        Ok(())
+    }
+
+    // queues a read of the registered file at `index` into the buffer. the
+    // buffer must not move until the read is reaped.
+    fn push_read(&mut self, index: usize, buf: &mut [u8]) {
+        let off = &self.params.sq_off;
+        unsafe {
+            let tail = &*self.sq.at::<AtomicU32>(off.tail);
+            let mask = *self.sq.at::<u32>(off.ring_mask);
+            let position = tail.load(Ordering::Relaxed);
+            let slot = position & mask;
+            self.sqes.at::<Sqe>(0).add(slot as usize).write(Sqe {
+                opcode: IORING_OP_READ,
+                flags: IOSQE_FIXED_FILE,
+                ioprio: 0,
+                fd: index as i32,
+                off: 0,
+                addr: buf.as_mut_ptr() as u64,
+                len: buf.len() as u32,
+                rw_flags: 0,
+                user_data: index as u64,
+                _pad: [0; 3],
+            });
+            *self.sq.at::<u32>(off.array).add(slot as usize) = slot;
+            tail.store(position.wrapping_add(1), Ordering::Release);
+        }
+    }
+
+    // submits the queued reads and calls `f` with the index and result of
+    // each one as it completes. on error, the reads which were submitted are
+    // waited for, and `in_flight` counts any which could not be.
+    fn submit_and_wait<F: FnMut(usize, i32)>(
+        &mut self,
+        count: usize,
+        mut f: F,
+    ) -> Result<(), Error> {
+        let mut to_submit = count as u32;
+        let mut remaining = count;
+        while remaining > 0 {
+            match self.enter(to_submit, remaining as u32) {
+                Ok(submitted) => to_submit -= submitted.min(to_submit),
+                Err(e) => {
+                    // queued reads which were not submitted never will be
+                    self.in_flight = remaining - to_submit as usize;
+                    self.drain();
+                    return Err(e);
+                }
+            }
+            remaining -= self.reap(&mut f);
+        }
+        Ok(())
+    }
+
+    // waits for the reads in flight to complete, so that their buffers may
+    // be reused, until waiting fails
+    fn drain(&mut self) {
+        while self.in_flight > 0 {
+            if self.enter(0, self.in_flight as u32).is_err() {
+                return;
+            }
+            self.in_flight -= self.reap(|_, _| {});
+        }
+    }
+
+    fn enter(&self, to_submit: u32, min_complete: u32) -> Result<u32, Error> {
+        loop {
+            let ret = unsafe {
+                libc::syscall(
+                    libc::SYS_io_uring_enter,
+                    self.fd,
+                    to_submit,
+                    min_complete,
+                    IORING_ENTER_GETEVENTS,
+                    std::ptr::null::<libc::sigset_t>(),
+                    0,
+                )
+            };
+            if ret >= 0 {
+                return Ok(ret as u32);
+            }
+            let e = Error::last_os_error();
+            if e.raw_os_error() != Some(libc::EINTR) {
+                return Err(e);
+            }
+        }
+    }
+
+    // calls `f` for each completion in the queue, returning how many there
+    // were
+    fn reap<F: FnMut(usize, i32)>(&mut self, mut f: F) -> usize {
+        let off = &self.params.cq_off;
+        let mut reaped = 0;
+        unsafe {
+            let head = &*self.cq.at::<AtomicU32>(off.head);
+            let tail = &*self.cq.at::<AtomicU32>(off.tail);
+            let mask = *self.cq.at::<u32>(off.ring_mask);
+            let cqes = self.cq.at::<Cqe>(off.cqes);
+            let mut position = head.load(Ordering::Relaxed);
+            let end = tail.load(Ordering::Acquire);
+            while position != end {
+                let cqe = &*cqes.add((position & mask) as usize);
+                f(cqe.user_data as usize, cqe.res);
+                position = position.wrapping_add(1);
+                reaped += 1;
+            }
+            head.store(position, Ordering::Release);
+        }
+        reaped
+    }
+}
+
+impl Drop for Ring {
+    fn drop(&mut self) {
+        unsafe {
+            libc::close(self.fd);
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    use std::time::{Duration, Instant};
+
+    fn check(mut reader: BatchReader) {
+        let dir = std::env::temp_dir().join(format!(
+            "rezolus-batch-{}-{}",
+            std::process::id(),
+            reader.fallback
+        ));
+        std::fs::create_dir_all(&dir).unwrap();
+        let large = "x".repeat(SLOT_SIZE * 3);
+        let contents = ["42\n", "", large.as_str()];
+        for (i, content) in contents.iter().enumerate() {
+            let path = dir.join(i.to_string());
+            std::fs::write(&path, content).unwrap();
+            assert_eq!(reader.add(&path).unwrap(), i);
+        }
+
+        for _ in 0..2 {
+            reader.read();
+            for (i, content) in contents.iter().enumerate() {
+                assert_eq!(reader.get(i), Some(content.as_bytes()));
+            }
+            assert_eq!(reader.get_u64(0), Some(42));
+            assert_eq!(reader.get_u64(1), None);
+        }
+
+        // files are re-read from the start and may be added later
+        std::fs::write(dir.join("0"), "7\n").unwrap();
+        std::fs::write(dir.join("3"), "8\n").unwrap();
+        assert_eq!(reader.add(dir.join("3")).unwrap(), 3);
+        reader.read();
+        assert_eq!(reader.get_u64(0), Some(7));
+        assert_eq!(reader.get_u64(3), Some(8));
+        assert_eq!(reader.get(4), None);
+
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn batch_uring() {
+        // falls back to pread where io_uring is not permitted
+        check(BatchReader::new());
+    }
+
+    #[test]
+    fn batch_pread() {
+        check(BatchReader::with_pread());
+    }
+
+    #[test]
+    fn sqe_layout() {
+        assert_eq!(std::mem::size_of::<Sqe>(), 64);
+        assert_eq!(std::mem::size_of::<Cqe>(), 16);
+        assert_eq!(std::mem::size_of::<Params>(), 120);
+        assert_eq!(std::mem::size_of::<Probe>(), 16 + 256 * 8);
+    }
+
+    // compares reading sysfs attributes with io_uring and with pread, run
+    // with:
+    // cargo test --release -- --ignored --nocapture bench_batch
+    #[test]
+    #[ignore]
+    fn bench_batch() {
+        const READS: u32 = 10_000;
+
+        let mut paths = Vec::new();
+        for pattern in &[
+            "/sys/devices/system/cpu/cpu*/cpuidle/state*/time",
+            "/sys/class/net/*/statistics/*",
+        ] {
+            let mut matches = vec![std::path::PathBuf::from("/")];
+            for component in pattern.split('/').skip(1) {
+                let mut next = Vec::new();
+                for parent in &matches {
+                    if component == "*" || component.ends_with('*') {
+                        let start = component.trim_end_matches('*');
+                        if let Ok(entries) = std::fs::read_dir(parent) {
+                            for entry in entries.flatten() {
+                                if entry.file_name().to_string_lossy().starts_with(start) {
+                                    next.push(entry.path());
+                                }
+                            }
+                        }
+                    } else {
+                        next.push(parent.join(component));
+                    }
+                }
+                matches = next;
+            }
+            paths.extend(matches.into_iter().filter(|path| path.is_file()));
+        }
+
+        for mut reader in vec![BatchReader::new(), BatchReader::with_pread()] {
+            for path in &paths {
+                reader.add(path).unwrap();
+            }
+            reader.read();
+            let uring = reader.ring.is_some();
+            let (start, cpu) = (Instant::now(), cpu_time());
+            for _ in 0..READS {
+                reader.read();
+            }
+            println!(
+                "{} files with {}: {:?} per read, {:?} of cpu",
+                paths.len(),
+                if uring { "io_uring" } else { "pread" },
+                start.elapsed() / READS,
+                (cpu_time() - cpu) / READS
+            );
+        }
+    }
+
+    // user and system time of all threads of the process, including the io-wq
+    // workers which complete reads punted by io_uring
+    fn cpu_time() -> Duration {
+        let mut usage: libc::rusage = unsafe { std::mem::zeroed() };
+        unsafe {
+            libc::getrusage(libc::RUSAGE_SELF, &mut usage);
+        }
+        let time = |t: libc::timeval| Duration::new(t.tv_sec as u64, t.tv_usec as u32 * 1_000);
+        time(usage.ru_utime) + time(usage.ru_stime)
+    }
+}
@@ -2,6 +2,8 @@
 // Licensed under the Apache License, Version 2.0
 // http://www.apache.org/licenses/LICENSE-2.0
 
+use std::path::Path;
+
 use rustcommon_atomics::*;
 
 use crate::config::*;
@@ -19,10 +21,40 @@ pub struct General {
     threads: usize,
     #[serde(default = "default_window")]
     window: AtomicUsize,
+    #[serde(default)]
+    windows: Vec<usize>,
     #[serde(default = "default_fault_tolerant")]
     fault_tolerant: AtomicBool,
     #[serde(default = "default_reading_suffix")]
     reading_suffix: String,
+    #[serde(default)]
+    bpf_shared_module: bool,
+    #[serde(default)]
+    bpf_pin_path: Option<String>,
+    #[serde(default)]
+    handoff_path: Option<String>,
+    #[serde(default)]
+    cpu_budget: Option<f64>,
+    #[serde(default)]
+    registry_memory: Option<usize>,
+    #[serde(default)]
+    dynamic_series: Option<usize>,
+    #[serde(default)]
+    stale_windows: Option<usize>,
+    #[serde(default)]
+    cpus: Option<String>,
+    #[serde(default)]
+    sched_idle: bool,
+    #[serde(default)]
+    nice: Option<i32>,
+    #[serde(default)]
+    cgroup: Option<String>,
+    #[serde(default)]
+    cgroup_cpu_quota: Option<f64>,
+    #[serde(default = "default_proc_root")]
+    proc_root: String,
+    #[serde(default = "default_sys_root")]
+    sys_root: String,
 }
 
 impl General {
@@ -43,6 +75,11 @@ impl General {
         self.interval.load(Ordering::Relaxed)
     }
 
+    /// applies the settings which may change at runtime from a reloaded config
+    pub(crate) fn reload(&self, general: &General) {
+        self.interval.store(general.interval(), Ordering::Relaxed);
+    }
+
     pub fn threads(&self) -> usize {
         self.threads
     }
@@ -52,6 +89,11 @@ impl General {
         self.window.load(Ordering::Relaxed) as usize
     }
 
+    /// additional windows, in seconds, over which percentiles are exported
+    pub fn windows(&self) -> &[usize] {
+        &self.windows
+    }
+
     pub fn fault_tolerant(&self) -> bool {
         self.fault_tolerant.load(Ordering::Relaxed)
     }
@@ -63,6 +105,92 @@ impl General {
             Some(&self.reading_suffix)
         }
     }
+
+    /// compile the bpf code for all samplers as a single module
+    pub fn bpf_shared_module(&self) -> bool {
+        self.bpf_shared_module
+    }
+
+    /// bpffs directory under which bpf maps are pinned so they survive a
+    /// restart, pinning is disabled if not set
+    pub fn bpf_pin_path(&self) -> Option<String> {
+        self.bpf_pin_path.clone()
+    }
+
+    /// unix socket used to hand the listener to a new instance on upgrade
+    pub fn handoff_path(&self) -> Option<String> {
+        self.handoff_path.clone()
+    }
+
+    /// cores of cpu time Rezolus may use before sampling intervals are
+    /// stretched, unlimited if not set
+    pub fn cpu_budget(&self) -> Option<f64> {
+        self.cpu_budget
+    }
+
+    /// estimated bytes of all metrics, beyond which statistics discovered
+    /// while sampling are not registered, unlimited if not set
+    pub fn registry_memory(&self) -> Option<usize> {
+        self.registry_memory
+    }
+
+    /// statistics each sampler may register while sampling, unlimited if not
+    /// set
+    pub fn dynamic_series(&self) -> Option<usize> {
+        self.dynamic_series
+    }
+
+    /// windows after which a statistic discovered while sampling is removed
+    /// if it was not seen again, never if not set
+    pub fn stale_windows(&self) -> Option<usize> {
+        self.stale_windows
+    }
+
+    /// cpus, as a list such as `0-1,8`, which all threads are pinned to,
+    /// unpinned if not set
+    pub fn cpus(&self) -> Option<&str> {
+        self.cpus.as_deref()
+    }
+
+    /// run all threads with the SCHED_IDLE scheduling policy
+    pub fn sched_idle(&self) -> bool {
+        self.sched_idle
+    }
+
+    /// nice value for all threads, unless running at SCHED_IDLE
+    pub fn nice(&self) -> Option<i32> {
+        self.nice
+    }
+
+    /// cgroup, relative to the cgroup v2 root, which the process moves into
+    /// at startup, creating it if needed
+    pub fn cgroup(&self) -> Option<&str> {
+        self.cgroup.as_deref()
+    }
+
+    /// cores of cpu time the cgroup is limited to, unlimited if not set
+    pub fn cgroup_cpu_quota(&self) -> Option<f64> {
+        self.cgroup_cpu_quota
+    }
+
+    /// directory procfs is read from, such as `/host/proc` when the host's
+    /// procfs is mounted into a container
+    pub fn proc_root(&self) -> &Path {
+        Path::new(&self.proc_root)
+    }
+
+    /// directory sysfs is read from, such as `/host/sys` when the host's
+    /// sysfs is mounted into a container
+    pub fn sys_root(&self) -> &Path {
+        Path::new(&self.sys_root)
+    }
+
+    /// reads procfs and sysfs from `proc` and `sys` under the directory,
+    /// where a replay extracts them
+    pub(crate) fn set_root(&mut self, dir: &Path) {
+        self.proc_root = dir.join("proc").to_string_lossy().into_owned();
+        self.sys_root = dir.join("sys").to_string_lossy().into_owned();
+    }
 }
 
 impl Default for General {
@@ -73,8 +201,23 @@ impl Default for General {
             interval: default_interval(),
             threads: default_threads(),
             window: default_window(),
+            windows: Default::default(),
             fault_tolerant: default_fault_tolerant(),
             reading_suffix: default_reading_suffix(),
+            bpf_shared_module: Default::default(),
+            bpf_pin_path: Default::default(),
+            handoff_path: Default::default(),
+            cpu_budget: Default::default(),
+            registry_memory: Default::default(),
+            dynamic_series: Default::default(),
+            stale_windows: Default::default(),
+            cpus: Default::default(),
+            sched_idle: Default::default(),
+            nice: Default::default(),
+            cgroup: Default::default(),
+            cgroup_cpu_quota: Default::default(),
+            proc_root: default_proc_root(),
+            sys_root: default_sys_root(),
         }
     }
 }
@@ -99,6 +242,14 @@ fn default_reading_suffix() -> String {
     "count".to_string()
 }
 
+fn default_proc_root() -> String {
+    "/proc".to_string()
+}
+
+fn default_sys_root() -> String {
+    "/sys".to_string()
+}
+
 #[derive(Clone, Deserialize, Debug)]
 #[serde(rename_all = "lowercase")]
 #[serde(remote = "Level")]
@@ -10,6 +10,7 @@ use std::io::Read;
 use std::net::{SocketAddr, ToSocketAddrs};
 
 use clap::{App, Arg};
+use rustcommon_atomics::{AtomicBool, AtomicUsize};
 use rustcommon_logger::Level;
 use serde_derive::*;
 
@@ -31,6 +32,16 @@ pub struct Config {
     general: General,
     #[serde(default)]
     samplers: Samplers,
+    // file the config was loaded from, which is read again on reload
+    #[serde(skip)]
+    path: Option<String>,
+    // archive to capture, or to replay, instead of running the agent
+    #[serde(skip)]
+    capture: Option<String>,
+    #[serde(skip)]
+    ticks: usize,
+    #[serde(skip)]
+    replay: Option<String>,
 }
 
 impl Config {
@@ -47,6 +58,29 @@ impl Config {
                     .help("TOML config file")
                     .takes_value(true),
             )
+            .arg(
+                Arg::with_name("capture")
+                    .long("capture")
+                    .value_name("FILE")
+                    .help("Record the procfs and sysfs files read by the samplers to an archive and exit")
+                    .takes_value(true)
+                    .conflicts_with("replay"),
+            )
+            .arg(
+                Arg::with_name("ticks")
+                    .long("ticks")
+                    .value_name("N")
+                    .help("Number of intervals to capture")
+                    .takes_value(true)
+                    .default_value("60"),
+            )
+            .arg(
+                Arg::with_name("replay")
+                    .long("replay")
+                    .value_name("FILE")
+                    .help("Benchmark the procfs and sysfs samplers against a captured archive and exit")
+                    .takes_value(true),
+            )
             .arg(
                 Arg::with_name("verbose")
                     .short("v")
@@ -58,12 +92,33 @@ impl Config {
         let matches = app.get_matches();
 
         let mut config = if let Some(file) = matches.value_of("config") {
-            Config::load_from_file(file)
+            let mut config = Config::load_from_file(file);
+            config.path = Some(file.to_string());
+            config
         } else {
             println!("NOTE: using builtin base configuration");
             Default::default()
         };
 
+        if let Some(file) = matches.value_of("capture") {
+            config.capture = Some(file.to_string());
+            config.ticks = matches
+                .value_of("ticks")
+                .and_then(|ticks| ticks.parse().ok())
+                .unwrap_or_else(|| {
+                    println!("ERROR: --ticks must be a number");
+                    std::process::exit(1);
+                });
+        }
+
+        if let Some(file) = matches.value_of("replay") {
+            // the samplers read the files of each tick from where they are
+            // extracted
+            let dir = std::env::temp_dir().join(format!("{}-replay-{}", NAME, std::process::id()));
+            config.general.set_root(&dir);
+            config.replay = Some(file.to_string());
+        }
+
         match matches.occurrences_of("verbose") {
             0 => {} // don't do anything, default is Info
             1 => {
@@ -106,13 +161,29 @@ impl Config {
         self.general().fault_tolerant()
     }
 
+    /// archive to capture into, and the number of ticks to capture
+    pub fn capture(&self) -> Option<(&str, usize)> {
+        self.capture.as_deref().map(|file| (file, self.ticks))
+    }
+
+    /// archive to replay through the samplers
+    pub fn replay(&self) -> Option<&str> {
+        self.replay.as_deref()
+    }
+
+    /// Reads the config file again and applies the settings which may change
+    /// at runtime: the interval and whether each sampler is enabled. Returns
+    /// the samplers which were enabled or disabled.
+    pub fn reload(&self) -> Result<Vec<(&'static str, bool)>, String> {
+        let path = self.path.as_ref().ok_or("no config file to reload")?;
+        let config = Config::parse(path)?;
+        self.general.reload(&config.general);
+        Ok(self.samplers.reload(&config.samplers))
+    }
+
     fn load_from_file(filename: &str) -> Config {
-        let mut file = std::fs::File::open(filename).expect("failed to open workload file");
-        let mut content = String::new();
-        file.read_to_string(&mut content).expect("failed to read");
-        let toml = toml::from_str(&content);
-        match toml {
-            Ok(toml) => toml,
+        match Config::parse(filename) {
+            Ok(config) => config,
             Err(e) => {
                 println!("Failed to parse TOML config: {}", filename);
                 println!("{}", e);
@@ -120,6 +191,80 @@ impl Config {
             }
         }
     }
+
+    fn parse(filename: &str) -> Result<Config, String> {
+        let mut file = std::fs::File::open(filename).map_err(|e| e.to_string())?;
+        let mut content = String::new();
+        file.read_to_string(&mut content)
+            .map_err(|e| e.to_string())?;
+        toml::from_str(&content).map_err(|e| e.to_string())
+    }
+}
+
+/// Summary kept for the percentiles of a sampler's counters and gauges
+#[derive(Clone, Copy, Debug, Deserialize, PartialEq)]
+#[serde(rename_all = "lowercase")]
+pub enum SummaryKind {
+    /// Every value recorded within the window, which is exact but grows with
+    /// the sampling rate
+    Stream,
+    /// Fixed-size sketch with a bounded relative error for values within the
+    /// range of its bins
+    Sketch,
+}
+
+impl Default for SummaryKind {
+    fn default() -> Self {
+        Self::Stream
+    }
+}
+
+/// Default for whether a sampler is enabled, which may be changed by a reload
+pub(crate) fn disabled() -> AtomicBool {
+    AtomicBool::new(false)
+}
+
+/// Default for a sampler's interval, where zero leaves it unset so that the
+/// general interval is used
+pub(crate) fn unset_interval() -> AtomicUsize {
+    AtomicUsize::new(0)
+}
+
+/// Implements the `SamplerConfig` methods for the `enabled: AtomicBool` and
+/// `interval: AtomicUsize` fields of a sampler config, which a reload changes
+/// in place
+macro_rules! reloadable {
+    () => {
+        fn enabled(&self) -> bool {
+            rustcommon_atomics::Atomic::load(&self.enabled, rustcommon_atomics::Ordering::Relaxed)
+        }
+
+        fn set_enabled(&self, enabled: bool) {
+            rustcommon_atomics::Atomic::store(
+                &self.enabled,
+                enabled,
+                rustcommon_atomics::Ordering::Relaxed,
+            )
+        }
+
+        fn interval(&self) -> Option<usize> {
+            match rustcommon_atomics::Atomic::load(
+                &self.interval,
+                rustcommon_atomics::Ordering::Relaxed,
+            ) {
+                0 => None,
+                interval => Some(interval),
+            }
+        }
+
+        fn set_interval(&self, interval: Option<usize>) {
+            rustcommon_atomics::Atomic::store(
+                &self.interval,
+                interval.unwrap_or(0),
+                rustcommon_atomics::Ordering::Relaxed,
+            )
+        }
+    };
 }
 
 pub trait SamplerConfig {
@@ -130,8 +275,16 @@ pub trait SamplerConfig {
     fn enabled(&self) -> bool {
         false
     }
+    fn set_enabled(&self, enabled: bool);
     fn interval(&self) -> Option<usize>;
+    fn set_interval(&self, interval: Option<usize>);
     fn percentiles(&self) -> &[f64];
+    fn priority(&self) -> u8 {
+        0
+    }
+    fn summary(&self) -> SummaryKind {
+        SummaryKind::Stream
+    }
     fn perf_events(&self) -> bool {
         false
     }
@@ -136,4 +136,47 @@ impl Samplers {
     pub fn xfs(&self) -> &XfsConfig {
         &self.xfs
     }
+
+    /// Applies the interval and enabled state of each sampler from a reloaded
+    /// config, returning the samplers which were enabled or disabled
+    pub fn reload(&self, new: &Samplers) -> Vec<(&'static str, bool)> {
+        let mut changed = Vec::new();
+        reload("cpu", &self.cpu, &new.cpu, &mut changed);
+        reload("disk", &self.disk, &new.disk, &mut changed);
+        reload("ext4", &self.ext4, &new.ext4, &mut changed);
+        reload("http", &self.http, &new.http, &mut changed);
+        reload("interrupt", &self.interrupt, &new.interrupt, &mut changed);
+        reload("usercall", &self.usercall, &new.usercall, &mut changed);
+        reload("memcache", &self.memcache, &new.memcache, &mut changed);
+        reload("memory", &self.memory, &new.memory, &mut changed);
+        reload("network", &self.network, &new.network, &mut changed);
+        reload("ntp", &self.ntp, &new.ntp, &mut changed);
+        reload("nvidia", &self.nvidia, &new.nvidia, &mut changed);
+        reload(
+            "page_cache",
+            &self.page_cache,
+            &new.page_cache,
+            &mut changed,
+        );
+        reload("rezolus", &self.rezolus, &new.rezolus, &mut changed);
+        reload("scheduler", &self.scheduler, &new.scheduler, &mut changed);
+        reload("softnet", &self.softnet, &new.softnet, &mut changed);
+        reload("tcp", &self.tcp, &new.tcp, &mut changed);
+        reload("udp", &self.udp, &new.udp, &mut changed);
+        reload("xfs", &self.xfs, &new.xfs, &mut changed);
+        changed
+    }
+}
+
+fn reload<T: SamplerConfig>(
+    name: &'static str,
+    current: &T,
+    new: &T,
+    changed: &mut Vec<(&'static str, bool)>,
+) {
+    current.set_interval(new.interval());
+    if current.enabled() != new.enabled() {
+        current.set_enabled(new.enabled());
+        changed.push((name, new.enabled()));
+    }
 }
@@ -0,0 +1,244 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+//! Hands the HTTP listener of a running Rezolus to its replacement so that
+//! scrapers are never refused during an upgrade.
+//!
+//! The running instance listens on a unix socket. A new instance connects to
+//! it once its samplers are initialized and receives the listening socket as
+//! `SCM_RIGHTS` ancillary data, followed by the most recent percentiles of
+//! the running instance. The running instance then exits. When started with
+//! systemd socket activation, the listener is taken from `LISTEN_FDS`
+//! instead.
+
+use std::io::{Error, ErrorKind, Read, Write};
+use std::net::TcpListener;
+use std::os::unix::fs::{MetadataExt, PermissionsExt};
+use std::os::unix::io::{AsRawFd, FromRawFd, RawFd};
+use std::os::unix::net::{UnixListener, UnixStream};
+use std::path::{Path, PathBuf};
+
+use tokio::io::unix::AsyncFd;
+
+// first fd passed with systemd socket activation
+const SD_LISTEN_FDS_START: RawFd = 3;
+
+/// Unix socket on which a running instance waits for its replacement
+pub struct Handoff {
+    path: PathBuf,
+    inode: Option<u64>,
+    listener: UnixListener,
+}
+
+impl Handoff {
+    pub fn bind(path: &Path) -> Result<Self, Error> {
+        // the socket of a previous instance is left behind when it exits
+        let _ = std::fs::remove_file(path);
+        let listener = UnixListener::bind(path)?;
+        // only the user of the agent may connect, `accept` checks the peer
+        // as well for a connection made before this
+        std::fs::set_permissions(path, std::fs::Permissions::from_mode(0o600))?;
+        listener.set_nonblocking(true)?;
+        Ok(Self {
+            path: path.to_path_buf(),
+            inode: inode(path),
+            listener,
+        })
+    }
+
+    /// Waits on the runtime for a new instance to connect. Connections from
+    /// users other than the one the agent runs as, or root, are refused.
+    pub async fn accept(&self) -> Result<UnixStream, Error> {
+        let listener = AsyncFd::new(self.listener.try_clone()?)?;
+        loop {
+            let mut ready = listener.readable().await?;
+            if let Ok(result) = ready.try_io(|listener| listener.get_ref().accept()) {
+                let (stream, _) = result?;
+                let uid = peer_uid(&stream)?;
+                if uid != 0 && uid != unsafe { libc::geteuid() } {
+                    warn!("refused handoff to uid {}", uid);
+                    continue;
+                }
+                stream.set_nonblocking(false)?;
+                return Ok(stream);
+            }
+        }
+    }
+}
+
+impl Drop for Handoff {
+    fn drop(&mut self) {
+        // a new instance may already have replaced the socket
+        if inode(&self.path) == self.inode {
+            let _ = std::fs::remove_file(&self.path);
+        }
+    }
+}
+
+fn peer_uid(stream: &UnixStream) -> Result<u32, Error> {
+    let mut cred: libc::ucred = unsafe { std::mem::zeroed() };
+    let mut len = std::mem::size_of::<libc::ucred>() as libc::socklen_t;
+    let ret = unsafe {
+        libc::getsockopt(
+            stream.as_raw_fd(),
+            libc::SOL_SOCKET,
+            libc::SO_PEERCRED,
+            &mut cred as *mut libc::ucred as *mut libc::c_void,
+            &mut len,
+        )
+    };
+    if ret != 0 {
+        return Err(Error::last_os_error());
+    }
+    Ok(cred.uid)
+}
+
+fn inode(path: &Path) -> Option<u64> {
+    std::fs::metadata(path).ok().map(|m| m.ino())
+}
+
+/// Sends the listener and state to the new instance
+pub fn send(stream: &mut UnixStream, listener: &TcpListener, state: &[u8]) -> Result<(), Error> {
+    let header = (state.len() as u64).to_le_bytes();
+    send_fd(stream, listener.as_raw_fd(), &header)?;
+    stream.write_all(state)?;
+    stream.flush()
+}
+
+/// Takes over the listener from systemd or a running instance. Returns the
+/// state sent by the running instance, which is empty for systemd.
+pub fn acquire(path: Option<&Path>) -> Result<Option<(TcpListener, Vec<u8>)>, Error> {
+    if let Some(listener) = systemd_listener() {
+        debug!("using listener from systemd socket activation");
+        return Ok(Some((listener, Vec::new())));
+    }
+    let path = match path {
+        Some(path) => path,
+        None => return Ok(None),
+    };
+    let mut stream = match UnixStream::connect(path) {
+        Ok(stream) => stream,
+        // no instance is running
+        Err(e) if e.kind() == ErrorKind::NotFound || e.kind() == ErrorKind::ConnectionRefused => {
+            return Ok(None)
+        }
+        Err(e) => return Err(e),
+    };
+    let mut header = [0; 8];
+    let fd = recv_fd(&mut stream, &mut header)?;
+    let listener = unsafe { TcpListener::from_raw_fd(fd) };
+    let mut state = vec![0; u64::from_le_bytes(header) as usize];
+    stream.read_exact(&mut state)?;
+    info!("took over listener from running instance");
+    Ok(Some((listener, state)))
+}
+
+fn systemd_listener() -> Option<TcpListener> {
+    let pid: u32 = std::env::var("LISTEN_PID").ok()?.parse().ok()?;
+    let fds: i32 = std::env::var("LISTEN_FDS").ok()?.parse().ok()?;
+    if pid != std::process::id() || fds < 1 {
+        return None;
+    }
+    std::env::remove_var("LISTEN_PID");
+    std::env::remove_var("LISTEN_FDS");
+    std::env::remove_var("LISTEN_FDNAMES");
+    unsafe {
+        libc::fcntl(SD_LISTEN_FDS_START, libc::F_SETFD, libc::FD_CLOEXEC);
+        Some(TcpListener::from_raw_fd(SD_LISTEN_FDS_START))
+    }
+}
+
+fn send_fd(stream: &mut UnixStream, fd: RawFd, data: &[u8]) -> Result<(), Error> {
+    let space = unsafe { libc::CMSG_SPACE(std::mem::size_of::<RawFd>() as u32) } as usize;
+    let mut control = vec![0_u8; space];
+    let mut iov = libc::iovec {
+        iov_base: data.as_ptr() as *mut libc::c_void,
+        iov_len: data.len(),
+    };
+    let mut msg: libc::msghdr = unsafe { std::mem::zeroed() };
+    msg.msg_iov = &mut iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.as_mut_ptr() as *mut libc::c_void;
+    msg.msg_controllen = space as _;
+    unsafe {
+        let cmsg = libc::CMSG_FIRSTHDR(&msg);
+        (*cmsg).cmsg_level = libc::SOL_SOCKET;
+        (*cmsg).cmsg_type = libc::SCM_RIGHTS;
+        (*cmsg).cmsg_len = libc::CMSG_LEN(std::mem::size_of::<RawFd>() as u32) as _;
+        std::ptr::write_unaligned(libc::CMSG_DATA(cmsg) as *mut RawFd, fd);
+        if libc::sendmsg(stream.as_raw_fd(), &msg, 0) < 0 {
+            return Err(Error::last_os_error());
+        }
+    }
+    Ok(())
+}
+
+fn recv_fd(stream: &mut UnixStream, data: &mut [u8]) -> Result<RawFd, Error> {
+    let space = unsafe { libc::CMSG_SPACE(std::mem::size_of::<RawFd>() as u32) } as usize;
+    let mut control = vec![0_u8; space];
+    let mut iov = libc::iovec {
+        iov_base: data.as_mut_ptr() as *mut libc::c_void,
+        iov_len: data.len(),
+    };
+    let mut msg: libc::msghdr = unsafe { std::mem::zeroed() };
+    msg.msg_iov = &mut iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.as_mut_ptr() as *mut libc::c_void;
+    msg.msg_controllen = space as _;
+    unsafe {
+        let len = libc::recvmsg(stream.as_raw_fd(), &mut msg, libc::MSG_CMSG_CLOEXEC);
+        if len < 0 {
+            return Err(Error::last_os_error());
+        }
+        if len as usize != data.len() {
+            return Err(Error::new(ErrorKind::InvalidData, "short handoff header"));
+        }
+        let cmsg = libc::CMSG_FIRSTHDR(&msg);
+        if cmsg.is_null()
+            || (*cmsg).cmsg_level != libc::SOL_SOCKET
+            || (*cmsg).cmsg_type != libc::SCM_RIGHTS
+        {
+            return Err(Error::new(ErrorKind::InvalidData, "no listener in handoff"));
+        }
+        Ok(std::ptr::read_unaligned(
+            libc::CMSG_DATA(cmsg) as *const RawFd
+        ))
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn handoff() {
+        let path = std::env::temp_dir().join(format!("rezolus-handoff-{}", std::process::id()));
+        let handoff = Handoff::bind(&path).unwrap();
+        let mode = std::fs::metadata(&path).unwrap().permissions().mode();
+        assert_eq!(mode & 0o777, 0o600);
+        let tcp = TcpListener::bind("127.0.0.1:0").unwrap();
+        let address = tcp.local_addr().unwrap();
+
+        let receiver = std::thread::spawn({
+            let path = path.clone();
+            move || acquire(Some(&path)).unwrap().unwrap()
+        });
+        let runtime = tokio::runtime::Builder::new_current_thread()
+            .enable_io()
+            .build()
+            .unwrap();
+        let mut stream = runtime.block_on(handoff.accept()).unwrap();
+        send(&mut stream, &tcp, b"state").unwrap();
+
+        let (listener, state) = receiver.join().unwrap();
+        assert_eq!(listener.local_addr().unwrap(), address);
+        assert_eq!(state, b"state");
+    }
+
+    #[test]
+    fn peer() {
+        let (stream, _) = UnixStream::pair().unwrap();
+        assert_eq!(peer_uid(&stream).unwrap(), unsafe { libc::geteuid() });
+    }
+}
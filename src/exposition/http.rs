@@ -2,82 +2,489 @@
 // Licensed under the Apache License, Version 2.0
 // http://www.apache.org/licenses/LICENSE-2.0
 
-use std::net::SocketAddr;
-use std::sync::Arc;
+//! HTTP exposition on the async runtime.
+//!
+//! Each connection is served by its own task, so a slow client only holds up
+//! itself, and the server does no work while there are no requests.
+//! Connections are kept alive between requests until the client closes them
+//! or they are idle for `IDLE_TIMEOUT`, or `BUSY_IDLE_TIMEOUT` while more
+//! than half of `MAX_CONNECTIONS` are open, so that idle connections cannot
+//! keep out scrapes. Only requests being served count against
+//! `MAX_REQUESTS`. Responses are compressed with zstd or
+//! gzip when the client accepts either. Only the request line and headers are
+//! read, since all requests which are served are GETs.
+
+use std::io::{Error, ErrorKind, Write};
+use std::net::{SocketAddr, TcpListener};
+use std::os::unix::net::UnixStream;
+use std::sync::{Arc, Mutex};
 use std::time::{Duration, Instant};
 
+use flate2::write::GzEncoder;
 use rustcommon_logger::*;
-use rustcommon_metrics::*;
-use tiny_http::{Method, Response, Server};
+use tokio::io::{AsyncReadExt, AsyncWriteExt};
+use tokio::net::TcpStream;
+use tokio::runtime::Runtime;
+use tokio::sync::Semaphore;
+use tokio::task::JoinHandle;
+use tokio::time::timeout;
+
+use crate::common::alloc::{self, Allocations};
+use crate::metrics::*;
 
 use super::MetricsSnapshot;
 
+// connections open at once, further connections wait in the backlog
+const MAX_CONNECTIONS: usize = 1024;
+
+// requests served at once, further requests wait for one to finish
+const MAX_REQUESTS: usize = 64;
+
+// how long a kept-alive connection may wait for its next request
+const IDLE_TIMEOUT: Duration = Duration::from_secs(90);
+
+// how long it may wait while more than half of the connections are open
+const BUSY_IDLE_TIMEOUT: Duration = Duration::from_secs(1);
+
+// how long a client may take to receive a response
+const WRITE_TIMEOUT: Duration = Duration::from_secs(10);
+
+// longest request line and headers which are accepted
+const MAX_HEAD: usize = 8192;
+
+// smallest response body which is compressed
+const MIN_COMPRESS: usize = 1024;
+
 pub struct Http {
-    snapshot: MetricsSnapshot,
-    server: Server,
-    updated: Instant,
+    // kept so that the listening socket can be handed to a new instance
+    listener: TcpListener,
+    state: Arc<State>,
+    server: JoinHandle<()>,
+}
+
+struct State {
+    snapshot: Mutex<(MetricsSnapshot, Instant)>,
 }
 
 impl Http {
+    /// Serves on the given listener, which was taken over from a previous
+    /// instance, or binds a new one
     pub fn new(
         address: SocketAddr,
-        metrics: Arc<Metrics<AtomicU64, AtomicU32>>,
+        listener: Option<TcpListener>,
+        metrics: Arc<Metrics>,
         count_label: Option<&str>,
+        runtime: &Runtime,
     ) -> Self {
-        let server = tiny_http::Server::http(address);
+        let listener = match listener {
+            Some(listener) => Ok(listener),
+            None => TcpListener::bind(address),
+        };
+        let server = listener.and_then(|listener| {
+            // a listener taken over is in whichever mode the previous
+            // instance or systemd left it
+            listener.set_nonblocking(true)?;
+            let server = {
+                let _guard = runtime.enter();
+                tokio::net::TcpListener::from_std(listener.try_clone()?)?
+            };
+            Ok((listener, server))
+        });
         if server.is_err() {
             fatal!("Failed to open {} for HTTP Stats listener", address);
         }
+        let (listener, server) = server.unwrap();
+        let state = Arc::new(State {
+            snapshot: Mutex::new((MetricsSnapshot::new(metrics, count_label), Instant::now())),
+        });
+        let server = runtime.spawn(serve(server, state.clone()));
         Self {
-            snapshot: MetricsSnapshot::new(metrics, count_label),
-            server: server.unwrap(),
-            updated: Instant::now(),
+            listener,
+            state,
+            server,
         }
     }
 
-    pub fn run(&mut self) {
-        if let Ok(Some(request)) = self.server.try_recv() {
-            if self.updated.elapsed() >= Duration::from_millis(500) {
-                self.snapshot.refresh();
-                self.updated = Instant::now();
-            }
-            let url = request.url();
-            let parts: Vec<&str> = url.split('?').collect();
-            let url = parts[0];
-            match request.method() {
-                Method::Get => match url {
-                    "/" => {
-                        debug!("Serving GET on index");
-                        let _ = request.respond(Response::from_string(format!(
-                            "Welcome to {}\nVersion: {}\n",
-                            crate::config::NAME,
-                            crate::config::VERSION,
-                        )));
-                    }
-                    "/metrics" => {
-                        debug!("Serving Prometheus compatible stats");
-                        let _ = request.respond(Response::from_string(self.snapshot.prometheus()));
-                    }
-                    "/metrics.json" | "/vars.json" | "/admin/metrics.json" => {
-                        debug!("Serving machine readable stats");
-                        let _ = request.respond(Response::from_string(self.snapshot.json(false)));
-                    }
-                    "/vars" => {
-                        debug!("Serving human readable stats");
-                        let _ = request.respond(Response::from_string(self.snapshot.human()));
-                    }
-                    url => {
-                        debug!("GET on non-existent url: {}", url);
-                        debug!("Serving machine readable stats");
-                        let _ = request.respond(Response::from_string(self.snapshot.json(false)));
+    /// Use the percentiles from a previous instance until the summaries
+    /// have data for a full window
+    pub fn carry_over(&self, percentiles: &[u8], window: Duration) {
+        let mut snapshot = self.state.snapshot.lock().unwrap();
+        snapshot.0.carry_over(percentiles, window);
+    }
+
+    /// Stops accepting connections and sends the listener and current
+    /// percentiles to a new instance. Connections which arrive meanwhile wait
+    /// in the backlog.
+    pub fn handoff(self, mut stream: UnixStream) -> Result<(), Error> {
+        self.server.abort();
+        let mut snapshot = self.state.snapshot.lock().unwrap();
+        snapshot.0.refresh();
+        super::handoff::send(&mut stream, &self.listener, &snapshot.0.percentiles())
+    }
+}
+
+async fn serve(listener: tokio::net::TcpListener, state: Arc<State>) {
+    let connections = Arc::new(Semaphore::new(MAX_CONNECTIONS));
+    let requests = Arc::new(Semaphore::new(MAX_REQUESTS));
+    loop {
+        let permit = match connections.clone().acquire_owned().await {
+            Ok(permit) => permit,
+            Err(_) => return,
+        };
+        match listener.accept().await {
+            Ok((stream, _)) => {
+                let state = state.clone();
+                let connections = connections.clone();
+                let requests = requests.clone();
+                tokio::spawn(async move {
+                    if let Err(e) = connection(stream, state, &connections, &requests).await {
+                        debug!("http connection closed: {}", e);
                     }
-                },
-                method => {
-                    debug!("unsupported request method: {}", method);
-                    let _ = request.respond(Response::empty(404));
+                    drop(permit);
+                });
+            }
+            Err(e) => error!("failed to accept http connection: {}", e),
+        }
+    }
+}
+
+// serves the requests of one connection until it is closed
+async fn connection(
+    mut stream: TcpStream,
+    state: Arc<State>,
+    connections: &Semaphore,
+    requests: &Semaphore,
+) -> Result<(), Error> {
+    let mut buf = Vec::new();
+    loop {
+        let len = match next_head(&mut stream, &mut buf, connections).await? {
+            Some(len) => len,
+            None => return Ok(()),
+        };
+        // held until the response is written, but not while idle
+        let _permit = requests
+            .acquire()
+            .await
+            .map_err(|e| Error::new(ErrorKind::Other, e))?;
+        // the head is moved out, leaving any pipelined request in the buffer
+        let rest = buf.split_off(len);
+        let head = std::mem::replace(&mut buf, rest);
+        // refreshing the snapshot and compressing the response take long
+        // enough to hold up the samplers, so they run on the blocking pool
+        let state = state.clone();
+        let (response, keep_alive) = tokio::task::spawn_blocking(move || {
+            let start = Allocations::current();
+            let result = match Request::parse(&head) {
+                Some(request) => (state.respond(&request), request.keep_alive),
+                None => (response("400 Bad Request", b"", None, false), false),
+            };
+            alloc::exposition().record(Allocations::current().since(start));
+            result
+        })
+        .await
+        .map_err(|e| Error::new(ErrorKind::Other, e))?;
+        match timeout(WRITE_TIMEOUT, stream.write_all(&response)).await {
+            Ok(result) => result?,
+            Err(_) => return Err(Error::new(ErrorKind::TimedOut, "slow client")),
+        }
+        if !keep_alive {
+            return Ok(());
+        }
+    }
+}
+
+// reads until the buffer holds the request line and headers, and returns
+// their length, or none if the connection was closed between requests
+// waits for the next request head, until the connection has been idle for
+// `IDLE_TIMEOUT`, checking every `BUSY_IDLE_TIMEOUT` whether the server has
+// become busy. reading the head is cancel safe, as the buffer is kept.
+async fn next_head(
+    stream: &mut TcpStream,
+    buf: &mut Vec<u8>,
+    connections: &Semaphore,
+) -> Result<Option<usize>, Error> {
+    let start = Instant::now();
+    loop {
+        if let Ok(result) = timeout(BUSY_IDLE_TIMEOUT, read_head(stream, buf)).await {
+            return result;
+        }
+        let busy = connections.available_permits() < MAX_CONNECTIONS / 2;
+        if busy || start.elapsed() >= IDLE_TIMEOUT {
+            return Err(Error::new(ErrorKind::TimedOut, "idle"));
+        }
+    }
+}
+
+async fn read_head(stream: &mut TcpStream, buf: &mut Vec<u8>) -> Result<Option<usize>, Error> {
+    let mut chunk = [0; 1024];
+    loop {
+        if let Some(end) = buf.windows(4).position(|window| window == b"\r\n\r\n") {
+            return Ok(Some(end + 4));
+        }
+        if buf.len() > MAX_HEAD {
+            return Err(Error::new(ErrorKind::InvalidData, "request too large"));
+        }
+        let n = stream.read(&mut chunk).await?;
+        if n == 0 {
+            if buf.is_empty() {
+                return Ok(None);
+            }
+            return Err(Error::new(ErrorKind::UnexpectedEof, "incomplete request"));
+        }
+        buf.extend_from_slice(&chunk[..n]);
+    }
+}
+
+#[derive(Clone, Copy, Debug, PartialEq)]
+enum Encoding {
+    Zstd,
+    Gzip,
+}
+
+impl Encoding {
+    fn name(self) -> &'static str {
+        match self {
+            Self::Zstd => "zstd",
+            Self::Gzip => "gzip",
+        }
+    }
+
+    fn compress(self, body: &[u8]) -> Result<Vec<u8>, Error> {
+        match self {
+            Self::Zstd => zstd::stream::encode_all(body, 1),
+            Self::Gzip => {
+                let mut encoder = GzEncoder::new(Vec::new(), flate2::Compression::fast());
+                encoder.write_all(body)?;
+                encoder.finish()
+            }
+        }
+    }
+}
+
+#[derive(Debug, PartialEq)]
+struct Request<'a> {
+    method: &'a str,
+    path: &'a str,
+    keep_alive: bool,
+    encoding: Option<Encoding>,
+}
+
+impl<'a> Request<'a> {
+    fn parse(head: &'a [u8]) -> Option<Self> {
+        let head = std::str::from_utf8(head).ok()?;
+        let mut lines = head.split("\r\n");
+        let mut parts = lines.next()?.split(' ');
+        let method = parts.next()?;
+        let target = parts.next()?;
+        let version = parts.next()?;
+        let path = target.split('?').next()?;
+
+        let mut connection = None;
+        let mut encoding = None;
+        for line in lines {
+            let mut header = line.splitn(2, ':');
+            let name = header.next()?.trim();
+            let value = match header.next() {
+                Some(value) => value.trim(),
+                None => continue,
+            };
+            if name.eq_ignore_ascii_case("connection") {
+                connection = Some(value);
+            } else if name.eq_ignore_ascii_case("accept-encoding") {
+                encoding = accepted(value);
+            }
+        }
+
+        // connections are persistent by default from http/1.1. the body of
+        // a request other than a GET is not read, so its connection is closed.
+        let keep_alive = method == "GET"
+            && match connection {
+                Some(value) if value.eq_ignore_ascii_case("close") => false,
+                Some(value) if value.eq_ignore_ascii_case("keep-alive") => true,
+                _ => version == "HTTP/1.1",
+            };
+        Some(Self {
+            method,
+            path,
+            keep_alive,
+            encoding,
+        })
+    }
+}
+
+// the preferred encoding of those which the client accepts
+fn accepted(header: &str) -> Option<Encoding> {
+    let mut zstd = false;
+    let mut gzip = false;
+    for coding in header.split(',') {
+        let mut params = coding.split(';');
+        let name = params.next().unwrap_or("").trim();
+        let refused = params.any(|param| {
+            let param = param.trim();
+            param.starts_with("q=") && param[2..].parse::<f64>().map_or(false, |q| q <= 0.0)
+        });
+        if refused {
+            continue;
+        }
+        if name.eq_ignore_ascii_case("zstd") {
+            zstd = true;
+        } else if name.eq_ignore_ascii_case("gzip") {
+            gzip = true;
+        }
+    }
+    if zstd {
+        Some(Encoding::Zstd)
+    } else if gzip {
+        Some(Encoding::Gzip)
+    } else {
+        None
+    }
+}
+
+impl State {
+    fn respond(&self, request: &Request) -> Vec<u8> {
+        if request.method != "GET" {
+            debug!("unsupported request method: {}", request.method);
+            return response("404 Not Found", b"", None, request.keep_alive);
+        }
+        let body = {
+            let mut snapshot = self.snapshot.lock().unwrap();
+            let (snapshot, updated) = &mut *snapshot;
+            if updated.elapsed() >= Duration::from_millis(500) {
+                snapshot.refresh();
+                *updated = Instant::now();
+            }
+            match request.path {
+                "/" => {
+                    debug!("Serving GET on index");
+                    format!(
+                        "Welcome to {}\nVersion: {}\n",
+                        crate::config::NAME,
+                        crate::config::VERSION,
+                    )
+                }
+                "/metrics" => {
+                    debug!("Serving Prometheus compatible stats");
+                    snapshot.prometheus()
+                }
+                "/metrics.json" | "/vars.json" | "/admin/metrics.json" => {
+                    debug!("Serving machine readable stats");
+                    snapshot.json(false)
+                }
+                "/vars" => {
+                    debug!("Serving human readable stats");
+                    snapshot.human()
+                }
+                url => {
+                    debug!("GET on non-existent url: {}", url);
+                    debug!("Serving machine readable stats");
+                    snapshot.json(false)
                 }
             }
+        };
+        response(
+            "200 OK",
+            body.as_bytes(),
+            request.encoding,
+            request.keep_alive,
+        )
+    }
+}
+
+fn response(status: &str, body: &[u8], encoding: Option<Encoding>, keep_alive: bool) -> Vec<u8> {
+    let compressed = encoding
+        .filter(|_| body.len() >= MIN_COMPRESS)
+        .and_then(|encoding| match encoding.compress(body) {
+            Ok(compressed) => Some((encoding, compressed)),
+            Err(e) => {
+                debug!("failed to compress response: {}", e);
+                None
+            }
+        });
+    let body = compressed
+        .as_ref()
+        .map(|(_, compressed)| compressed.as_slice())
+        .unwrap_or(body);
+    let mut response = format!(
+        "HTTP/1.1 {}\r\nContent-Type: text/plain; charset=UTF-8\r\nContent-Length: {}\r\n",
+        status,
+        body.len()
+    );
+    if let Some((encoding, _)) = &compressed {
+        response += &format!("Content-Encoding: {}\r\n", encoding.name());
+    }
+    if encoding.is_some() {
+        response += "Vary: Accept-Encoding\r\n";
+    }
+    response += if keep_alive {
+        "Connection: keep-alive\r\n\r\n"
+    } else {
+        "Connection: close\r\n\r\n"
+    };
+    let mut response = response.into_bytes();
+    response.extend_from_slice(body);
+    response
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn parse() {
+        let request = Request::parse(
+            b"GET /metrics?x=1 HTTP/1.1\r\nHost: a\r\nAccept-Encoding: gzip, zstd;q=0\r\n\r\n",
+        )
+        .unwrap();
+        assert_eq!(
+            request,
+            Request {
+                method: "GET",
+                path: "/metrics",
+                keep_alive: true,
+                encoding: Some(Encoding::Gzip),
+            }
+        );
+        let request = Request::parse(b"GET / HTTP/1.0\r\n\r\n").unwrap();
+        assert!(!request.keep_alive);
+        assert_eq!(request.encoding, None);
+        let request = Request::parse(
+            b"GET / HTTP/1.1\r\nconnection: Close\r\naccept-encoding: gzip, zstd\r\n\r\n",
+        )
+        .unwrap();
+        assert!(!request.keep_alive);
+        assert_eq!(request.encoding, Some(Encoding::Zstd));
+        let request = Request::parse(b"POST / HTTP/1.1\r\nContent-Length: 1\r\n\r\n").unwrap();
+        assert!(!request.keep_alive);
+        assert_eq!(Request::parse(b"GET\r\n\r\n"), None);
+    }
+
+    #[test]
+    fn compressed() {
+        let body = "rezolus_sampler_duration 1\n".repeat(100);
+        for encoding in &[Encoding::Gzip, Encoding::Zstd] {
+            let response = response("200 OK", body.as_bytes(), Some(*encoding), true);
+            let split = response.windows(4).position(|w| w == b"\r\n\r\n").unwrap() + 4;
+            let head = std::str::from_utf8(&response[..split]).unwrap();
+            assert!(head.contains(&format!("Content-Encoding: {}\r\n", encoding.name())));
+            let compressed = &response[split..];
+            assert!(head.contains(&format!("Content-Length: {}\r\n", compressed.len())));
+            let decoded = match encoding {
+                Encoding::Gzip => {
+                    let mut decoded = String::new();
+                    std::io::Read::read_to_string(
+                        &mut flate2::read::GzDecoder::new(compressed),
+                        &mut decoded,
+                    )
+                    .unwrap();
+                    decoded.into_bytes()
+                }
+                Encoding::Zstd => zstd::stream::decode_all(compressed).unwrap(),
+            };
+            assert_eq!(decoded, body.as_bytes());
         }
-        std::thread::sleep(std::time::Duration::from_millis(1));
+        // short bodies are sent as they are
+        let response = response("200 OK", b"ok", Some(Encoding::Gzip), false);
+        assert!(response.ends_with(b"Connection: close\r\n\r\nok"));
     }
 }
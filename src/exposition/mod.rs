@@ -2,12 +2,13 @@
 // Licensed under the Apache License, Version 2.0
 // http://www.apache.org/licenses/LICENSE-2.0
 
-use std::collections::HashMap;
+use std::collections::HashSet;
 use std::sync::Arc;
-use std::time::Instant;
+use std::time::{Duration, Instant};
 
-use rustcommon_metrics::*;
+use crate::metrics::*;
 
+pub mod handoff;
 mod http;
 #[cfg(feature = "push_kafka")]
 mod kafka;
@@ -17,22 +18,101 @@ pub use self::http::Http;
 pub use self::kafka::KafkaProducer;
 
 pub struct MetricsSnapshot {
-    metrics: Arc<Metrics<AtomicU64, AtomicU32>>,
-    snapshot: HashMap<Metric<AtomicU64, AtomicU32>, u64>,
+    metrics: Arc<Metrics>,
+    snapshot: Vec<(Metric, u64)>,
     refreshed: Instant,
     count_label: Option<String>,
+    // percentiles from the instance this one took over from, each reported
+    // until the summaries here cover its window
+    carried: Vec<(String, Output, u64, Instant)>,
 }
 
 impl MetricsSnapshot {
-    pub fn new(metrics: Arc<Metrics<AtomicU64, AtomicU32>>, count_label: Option<&str>) -> Self {
+    pub fn new(metrics: Arc<Metrics>, count_label: Option<&str>) -> Self {
         Self {
             metrics,
-            snapshot: HashMap::new(),
+            snapshot: Vec::new(),
             refreshed: Instant::now(),
             count_label: count_label.map(std::string::ToString::to_string),
+            carried: Vec::new(),
         }
     }
 
+    /// Serializes the current percentiles for handoff to a new instance.
+    /// Percentiles over another window are written as `percentile@seconds`,
+    /// which instances that only carry over plain percentiles skip.
+    pub fn percentiles(&self) -> Vec<u8> {
+        let mut content = String::new();
+        for (metric, value) in &self.snapshot {
+            match metric.output() {
+                Output::Reading => {}
+                Output::Percentile(percentile) => {
+                    content += &format!("{} {} {}\n", metric.name(), percentile, value);
+                }
+                Output::WindowPercentile(percentile, window) => {
+                    content += &format!(
+                        "{} {}@{} {}\n",
+                        metric.name(),
+                        percentile,
+                        window.as_secs(),
+                        value
+                    );
+                }
+            }
+        }
+        content.into_bytes()
+    }
+
+    /// Reports the percentiles from a previous instance for any percentile
+    /// which has no value yet, until its window has elapsed
+    pub fn carry_over(&mut self, percentiles: &[u8], window: Duration) {
+        let now = Instant::now();
+        self.carried = String::from_utf8_lossy(percentiles)
+            .lines()
+            .filter_map(|line| {
+                let mut parts = line.split_whitespace();
+                let label = parts.next()?.to_string();
+                let mut percentile = parts.next()?.splitn(2, '@');
+                let value = parts.next()?.parse().ok()?;
+                let (output, until) = match (percentile.next()?.parse().ok()?, percentile.next()) {
+                    (percentile, None) => (Output::Percentile(percentile), now + window),
+                    (percentile, Some(seconds)) => {
+                        let window = Duration::from_secs(seconds.parse().ok()?);
+                        (Output::WindowPercentile(percentile, window), now + window)
+                    }
+                };
+                Some((label, output, value, until))
+            })
+            .collect();
+    }
+
+    fn entries(&self) -> Vec<(&str, Output, u64)> {
+        let mut entries: Vec<(&str, Output, u64)> = self
+            .snapshot
+            .iter()
+            .map(|(metric, value)| (metric.name(), metric.output(), *value))
+            .collect();
+        let carried: Vec<&(String, Output, u64, Instant)> = self
+            .carried
+            .iter()
+            .filter(|(_, _, _, until)| self.refreshed < *until)
+            .collect();
+        if !carried.is_empty() {
+            let current: HashSet<(&str, u64, u64)> = entries
+                .iter()
+                .filter_map(|(label, output, _)| key(label, *output))
+                .collect();
+            for (label, output, value, _) in carried {
+                if let Some(key) = key(label, *output) {
+                    if !current.contains(&key) {
+                        entries.push((label, *output, *value));
+                    }
+                }
+            }
+        }
+        entries
+    }
+
     pub fn refresh(&mut self) {
         self.snapshot = self.metrics.snapshot();
         self.refreshed = Instant::now();
@@ -40,9 +120,7 @@ impl MetricsSnapshot {
 
     pub fn prometheus(&self) -> String {
         let mut data = Vec::new();
-        for (metric, value) in &self.snapshot {
-            let label = metric.statistic().name();
-            let output = metric.output();
+        for (label, output, value) in self.entries() {
             match output {
                 Output::Reading => {
                     data.push(format!("# TYPE {} gauge\n{} {}", label, label, value));
@@ -53,6 +131,16 @@ impl MetricsSnapshot {
                         label, label, percentile, value
                     ));
                 }
+                Output::WindowPercentile(percentile, window) => {
+                    data.push(format!(
+                        "# TYPE {} gauge\n{}{{percentile=\"{:02}\",window=\"{}\"}} {}",
+                        label,
+                        label,
+                        percentile,
+                        window_label(window),
+                        value
+                    ));
+                }
             }
         }
         data.sort();
@@ -64,9 +152,7 @@ impl MetricsSnapshot {
 
     pub fn human(&self) -> String {
         let mut data = Vec::new();
-        for (metric, value) in &self.snapshot {
-            let label = metric.statistic().name();
-            let output = metric.output();
+        for (label, output, value) in self.entries() {
             match output {
                 Output::Reading => {
                     if let Some(ref count_label) = self.count_label {
@@ -78,6 +164,15 @@ impl MetricsSnapshot {
                 Output::Percentile(percentile) => {
                     data.push(format!("{}/histogram/p{:02}: {}", label, percentile, value));
                 }
+                Output::WindowPercentile(percentile, window) => {
+                    data.push(format!(
+                        "{}/histogram/{}/p{:02}: {}",
+                        label,
+                        window_label(window),
+                        percentile,
+                        value
+                    ));
+                }
             }
         }
         data.sort();
@@ -92,9 +187,7 @@ impl MetricsSnapshot {
             head += "\n  ";
         }
         let mut data = Vec::new();
-        for (metric, value) in &self.snapshot {
-            let label = metric.statistic().name();
-            let output = metric.output();
+        for (label, output, value) in self.entries() {
             match output {
                 Output::Reading => {
                     if let Some(ref count_label) = self.count_label {
@@ -109,6 +202,15 @@ impl MetricsSnapshot {
                         label, percentile, value
                     ));
                 }
+                Output::WindowPercentile(percentile, window) => {
+                    data.push(format!(
+                        "\"{}/histogram/{}/p{:02}\": {}",
+                        label,
+                        window_label(window),
+                        percentile,
+                        value
+                    ));
+                }
             }
         }
         data.sort();
@@ -126,3 +228,47 @@ impl MetricsSnapshot {
         content
     }
 }
+
+// identifies a percentile by its label, percentile and window, if any
+fn key(label: &str, output: Output) -> Option<(&str, u64, u64)> {
+    match output {
+        Output::Reading => None,
+        Output::Percentile(percentile) => Some((label, percentile.to_bits(), 0)),
+        Output::WindowPercentile(percentile, window) => {
+            Some((label, percentile.to_bits(), window.as_secs()))
+        }
+    }
+}
+
+// label for a window of percentiles, in the largest unit which it is a whole
+// number of
+fn window_label(window: Duration) -> String {
+    let seconds = window.as_secs();
+    if seconds % 3600 == 0 {
+        format!("{}h", seconds / 3600)
+    } else if seconds % 60 == 0 {
+        format!("{}m", seconds / 60)
+    } else {
+        format!("{}s", seconds)
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn carry_over() {
+        let mut snapshot = MetricsSnapshot::new(Arc::new(Metrics::new()), None);
+        snapshot.carry_over(
+            b"cpu/usage 50 7\ncpu/usage 99@300 8\ncpu/usage 99@5m 9\n",
+            Duration::from_secs(60),
+        );
+        snapshot.refresh();
+        let entries = snapshot.entries();
+        assert_eq!(entries.len(), 2);
+        assert_eq!(entries[0], ("cpu/usage", Output::Percentile(50.0), 7));
+        let window = Output::WindowPercentile(99.0, Duration::from_secs(300));
+        assert_eq!(entries[1], ("cpu/usage", window, 8));
+    }
+}
@@ -8,21 +8,25 @@ extern crate rustcommon_logger;
 #[macro_use]
 extern crate anyhow;
 
-use rustcommon_atomics::{Atomic, Ordering};
+use std::os::unix::net::UnixStream;
+use std::path::{Path, PathBuf};
 use std::sync::Arc;
+use std::time::Duration;
 
-use rustcommon_atomics::AtomicBool;
 use rustcommon_logger::Logger;
-use rustcommon_metrics::*;
 use tokio::runtime::Builder;
+use tokio::signal::unix::{signal, SignalKind};
 
 mod common;
+#[macro_use]
 mod config;
 mod exposition;
+mod metrics;
 mod samplers;
 
 use common::*;
 use config::Config;
+use metrics::*;
 use samplers::*;
 
 fn main() -> Result<(), Box<dyn std::error::Error>> {
@@ -44,21 +48,50 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
         env!("VERGEN_BUILD_TIMESTAMP"),
         env!("VERGEN_TARGET_TRIPLE")
     );
-    debug!("host cores: {}", hardware_threads().unwrap_or(1));
+    debug!(
+        "host cores: {}",
+        hardware_threads(config.general().sys_root()).unwrap_or(1)
+    );
 
-    let runnable = Arc::new(AtomicBool::new(true));
-    let r = runnable.clone();
+    // capturing and replaying run instead of the agent
+    if let Some((file, ticks)) = config.capture() {
+        let general = config.general();
+        let interval = Duration::from_millis(general.interval() as u64);
+        info!("capturing {} ticks to {}", ticks, file);
+        archive::capture(
+            general.proc_root(),
+            general.sys_root(),
+            interval,
+            ticks,
+            Path::new(file),
+        )?;
+        return Ok(());
+    }
+    if let Some(file) = config.replay() {
+        replay::run(config.clone(), Path::new(file))?;
+        return Ok(());
+    }
 
-    // initialize signal handler
-    debug!("initializing signal handler");
-    ctrlc::set_handler(move || {
-        r.store(false, Ordering::Relaxed);
-    })
-    .expect("Failed to set handler for SIGINT / SIGTERM");
+    // applied before any other thread is started, so that all of them are
+    // placed the same way
+    if let Err(e) = placement::apply(config.general()) {
+        if !config.fault_tolerant() {
+            fatal!("failed to apply cpu and cgroup placement: {}", e);
+        } else {
+            error!("failed to apply cpu and cgroup placement: {}", e);
+        }
+    }
 
     // initialize metrics
     debug!("initializing metrics");
-    let metrics = Arc::new(Metrics::<AtomicU64, AtomicU32>::new());
+    let general = config.general();
+    let metrics = Arc::new(Metrics::with_limits(Limits {
+        budget: general.registry_memory(),
+        series: general.dynamic_series(),
+        stale: general
+            .stale_windows()
+            .map(|windows| Duration::from_secs((windows * general.window()) as u64)),
+    }));
 
     // initialize async runtime
     debug!("initializing async runtime");
@@ -72,27 +105,32 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
             .unwrap(),
     );
 
+    // initialize signal handlers, SIGINT and SIGTERM stop Rezolus and SIGHUP
+    // reloads the config
+    debug!("initializing signal handlers");
+    let (mut interrupt, mut terminate) = {
+        let _guard = runtime.enter();
+        (
+            signal(SignalKind::interrupt()).expect("Failed to set handler for SIGINT"),
+            signal(SignalKind::terminate()).expect("Failed to set handler for SIGTERM"),
+        )
+    };
+
     // spawn samplers
     debug!("spawning samplers");
     let common = Common::new(config.clone(), metrics.clone(), runtime);
-    Cpu::spawn(common.clone());
-    Disk::spawn(common.clone());
-    Ext4::spawn(common.clone());
-    Http::spawn(common.clone());
-    Interrupt::spawn(common.clone());
-    Usercall::spawn(common.clone());
-    Memcache::spawn(common.clone());
-    Memory::spawn(common.clone());
-    PageCache::spawn(common.clone());
-    Network::spawn(common.clone());
-    Ntp::spawn(common.clone());
-    Nvidia::spawn(common.clone());
-    Rezolus::spawn(common.clone());
-    Scheduler::spawn(common.clone());
-    Softnet::spawn(common.clone());
-    Tcp::spawn(common.clone());
-    Udp::spawn(common.clone());
-    Xfs::spawn(common);
+    spawn_samplers(&common);
+    reload::listen(common.clone());
+
+    // with the shared module, bpf code is compiled once all samplers are
+    // initialized
+    if let Err(e) = common.bpf().finalize() {
+        if !config.fault_tolerant() {
+            fatal!("failed to initialize shared bpf module: {}", e);
+        } else {
+            error!("failed to initialize shared bpf module: {}", e);
+        }
+    }
 
     #[cfg(feature = "push_kafka")]
     {
@@ -107,16 +145,66 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
         }
     }
 
+    // take over the listener from a running instance, now that the samplers
+    // are running, so there is no gap in the exposition
+    let handoff_path = config.general().handoff_path().map(PathBuf::from);
+    let (listener, percentiles) = match exposition::handoff::acquire(handoff_path.as_deref()) {
+        Ok(Some((listener, percentiles))) => (Some(listener), Some(percentiles)),
+        Ok(None) => (None, None),
+        Err(e) => {
+            error!("failed to take over listener from running instance: {}", e);
+            (None, None)
+        }
+    };
+
     debug!("beginning stats exposition");
-    let mut http = exposition::Http::new(
+    let http = exposition::Http::new(
         config.listen().expect("no listen address"),
+        listener,
         metrics,
         config.general().reading_suffix(),
+        common.runtime(),
     );
+    if let Some(percentiles) = percentiles {
+        http.carry_over(
+            &percentiles,
+            Duration::from_secs(config.general().window() as u64),
+        );
+    }
 
-    while runnable.load(Ordering::Relaxed) {
-        http.run();
+    let handoff = handoff_path.and_then(|path| match exposition::handoff::Handoff::bind(&path) {
+        Ok(handoff) => Some(handoff),
+        Err(e) => {
+            error!("failed to listen for handoff on {:?}: {}", path, e);
+            None
+        }
+    });
+
+    // wait to be stopped, or for a new instance to take over
+    let stream = common.runtime().block_on(async {
+        tokio::select! {
+            _ = interrupt.recv() => None,
+            _ = terminate.recv() => None,
+            stream = handoff_requested(handoff.as_ref()) => Some(stream),
+        }
+    });
+    if let Some(stream) = stream {
+        info!("handing off listener to new instance");
+        if let Err(e) = http.handoff(stream) {
+            error!("failed to hand off listener: {}", e);
+        }
     }
 
     Ok(())
 }
+
+// the connection of a new instance which is taking over
+async fn handoff_requested(handoff: Option<&exposition::handoff::Handoff>) -> UnixStream {
+    if let Some(handoff) = handoff {
+        match handoff.accept().await {
+            Ok(stream) => return stream,
+            Err(e) => error!("failed to accept handoff: {}", e),
+        }
+    }
+    std::future::pending().await
+}
@@ -0,0 +1,265 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+use std::sync::atomic::{AtomicBool, AtomicPtr, AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
+
+use super::summary::{BucketMap, Summary, SummaryState};
+use super::{Output, Source};
+
+/// Storage for the readings and summary of one statistic
+pub struct Channel {
+    name: String,
+    source: Source,
+    // sampler which registered the statistic while sampling, if it did
+    owner: Option<&'static str>,
+    epoch: Instant,
+    reading: AtomicU64,
+    // time in nanoseconds since the epoch of the reading, used to convert
+    // counters to rates for the summary
+    time: AtomicU64,
+    recorded: AtomicBool,
+    // time in nanoseconds since the epoch that a dynamic statistic was last
+    // registered
+    seen: AtomicU64,
+    // set once when the summary is added and freed with the channel
+    summary: AtomicPtr<SummaryState>,
+    outputs: Mutex<Vec<Output>>,
+}
+
+impl Channel {
+    pub(crate) fn new(
+        name: &str,
+        source: Source,
+        owner: Option<&'static str>,
+        epoch: Instant,
+    ) -> Self {
+        Self {
+            name: name.to_string(),
+            source,
+            owner,
+            epoch,
+            reading: AtomicU64::new(0),
+            time: AtomicU64::new(0),
+            recorded: AtomicBool::new(false),
+            seen: AtomicU64::new(0),
+            summary: AtomicPtr::new(std::ptr::null_mut()),
+            outputs: Mutex::new(Vec::new()),
+        }
+    }
+
+    pub fn name(&self) -> &str {
+        &self.name
+    }
+
+    pub fn source(&self) -> Source {
+        self.source
+    }
+
+    pub(crate) fn owner(&self) -> Option<&'static str> {
+        self.owner
+    }
+
+    pub(crate) fn touch(&self, time: Instant) {
+        self.seen.store(self.nanos(time), Ordering::Relaxed);
+    }
+
+    /// Whether the statistic was last registered before the time
+    pub(crate) fn unseen_since(&self, time: Instant) -> bool {
+        self.seen.load(Ordering::Relaxed) < self.nanos(time)
+    }
+
+    /// Estimate of the bytes used by the channel
+    pub(crate) fn size(&self) -> usize {
+        std::mem::size_of::<Self>()
+            + self.name.len()
+            + self.outputs.lock().unwrap().capacity() * std::mem::size_of::<Output>()
+            + self.summary().map(|summary| summary.size()).unwrap_or(0)
+    }
+
+    /// Estimate of the bytes used by a channel with the name, number of
+    /// outputs and summary, without creating it
+    pub(crate) fn estimate(name: &str, outputs: usize, summary: Option<&Summary>) -> usize {
+        std::mem::size_of::<Self>()
+            + name.len()
+            + outputs * std::mem::size_of::<Output>()
+            + summary.map(|summary| summary.size()).unwrap_or(0)
+    }
+
+    pub(crate) fn add_output(&self, output: Output) {
+        let mut outputs = self.outputs.lock().unwrap();
+        if !outputs.contains(&output) {
+            outputs.push(output);
+        }
+    }
+
+    pub(crate) fn outputs(&self) -> Vec<Output> {
+        self.outputs.lock().unwrap().clone()
+    }
+
+    /// Adds the summary, unless the channel already has one, and returns the
+    /// bytes it added
+    pub(crate) fn add_summary(&self, summary: Summary) -> usize {
+        if !self.summary.load(Ordering::Acquire).is_null() {
+            return 0;
+        }
+        let state = Box::into_raw(Box::new(summary.build()));
+        if self
+            .summary
+            .compare_exchange(
+                std::ptr::null_mut(),
+                state,
+                Ordering::AcqRel,
+                Ordering::Acquire,
+            )
+            .is_err()
+        {
+            drop(unsafe { Box::from_raw(state) });
+            return 0;
+        }
+        self.summary().map(|summary| summary.size()).unwrap_or(0)
+    }
+
+    fn summary(&self) -> Option<&SummaryState> {
+        // the summary is never replaced once set, and lives as long as the
+        // channel
+        unsafe { self.summary.load(Ordering::Acquire).as_ref() }
+    }
+
+    fn nanos(&self, time: Instant) -> u64 {
+        time.saturating_duration_since(self.epoch).as_nanos() as u64
+    }
+
+    /// Records the value of a counter. The summary records the rate per
+    /// second since the previous reading.
+    pub fn record_counter(&self, time: Instant, value: u64) {
+        let time = self.nanos(time);
+        if let Some(summary) = self.summary() {
+            if self.recorded.load(Ordering::Acquire) {
+                let previous_time = self.time.load(Ordering::Relaxed);
+                let previous = self.reading.load(Ordering::Relaxed);
+                // a counter which went backwards was reset
+                if time > previous_time && value >= previous {
+                    let rate =
+                        (value - previous) as u128 * 1_000_000_000 / (time - previous_time) as u128;
+                    summary.record(time, rate as u64, 1);
+                }
+            }
+        }
+        self.set_reading(time, value);
+    }
+
+    pub fn record_gauge(&self, time: Instant, value: u64) {
+        let time = self.nanos(time);
+        if let Some(summary) = self.summary() {
+            summary.record(time, value, 1);
+        }
+        self.set_reading(time, value);
+    }
+
+    /// Records `count` occurrences of the value in the summary
+    pub fn record_bucket(&self, time: Instant, value: u64, count: u64) {
+        if let Some(summary) = self.summary() {
+            summary.record(self.nanos(time), value, count);
+        }
+    }
+
+    /// Maps the buckets of histograms which are recorded in bulk to the
+    /// buckets of the summary, if there is one
+    pub(crate) fn bucket_map(&self, values: Arc<[u64]>) -> Option<BucketMap> {
+        self.summary().map(|summary| summary.bucket_map(values))
+    }
+
+    pub(crate) fn record_histogram(&self, time: Instant, map: &BucketMap, counts: &[u64]) {
+        if let Some(summary) = self.summary() {
+            summary.record_histogram(self.nanos(time), map, counts);
+        }
+    }
+
+    fn set_reading(&self, time: u64, value: u64) {
+        self.reading.store(value, Ordering::Relaxed);
+        self.time.store(time, Ordering::Relaxed);
+        self.recorded.store(true, Ordering::Release);
+    }
+
+    /// Most recent value of a counter or gauge
+    pub fn reading(&self) -> Option<u64> {
+        if self.recorded.load(Ordering::Acquire) {
+            Some(self.reading.load(Ordering::Relaxed))
+        } else {
+            None
+        }
+    }
+
+    /// Each of the percentiles, between 0 and 100, over the window or the
+    /// span of the summary, in the same order and calculated together
+    pub fn percentiles(
+        &self,
+        now: Instant,
+        window: Option<Duration>,
+        percentiles: &[f64],
+    ) -> Vec<Option<u64>> {
+        match self.summary() {
+            Some(summary) if !percentiles.is_empty() => {
+                summary.percentiles(self.nanos(now), window, percentiles)
+            }
+            _ => vec![None; percentiles.len()],
+        }
+    }
+}
+
+impl Drop for Channel {
+    fn drop(&mut self) {
+        let summary = *self.summary.get_mut();
+        if !summary.is_null() {
+            drop(unsafe { Box::from_raw(summary) });
+        }
+    }
+}
+
+/// A statistic resolved to its channel, so that recording is a direct
+/// atomic update without looking up the statistic by name
+#[derive(Clone)]
+pub struct Handle {
+    channel: Arc<Channel>,
+    buckets: Option<Arc<BucketMap>>,
+}
+
+impl Handle {
+    pub(crate) fn new(channel: Arc<Channel>) -> Self {
+        Self {
+            channel,
+            buckets: None,
+        }
+    }
+
+    /// Prepares the handle to record histograms in bulk, where each bucket
+    /// of a histogram has the given value. The histogram buckets are mapped
+    /// to the buckets of the summary once, here, instead of on each record.
+    pub fn with_buckets(mut self, values: Arc<[u64]>) -> Self {
+        self.buckets = self.channel.bucket_map(values).map(Arc::new);
+        self
+    }
+
+    pub fn record_counter(&self, time: Instant, value: u64) {
+        self.channel.record_counter(time, value)
+    }
+
+    pub fn record_gauge(&self, time: Instant, value: u64) {
+        self.channel.record_gauge(time, value)
+    }
+
+    pub fn record_bucket(&self, time: Instant, value: u64, count: u64) {
+        self.channel.record_bucket(time, value, count)
+    }
+
+    /// Records the count of each bucket of a histogram, in the layout given
+    /// to `with_buckets`
+    pub fn record_histogram(&self, time: Instant, counts: &[u64]) {
+        if let Some(buckets) = &self.buckets {
+            self.channel.record_histogram(time, buckets, counts);
+        }
+    }
+}
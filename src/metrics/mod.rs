@@ -0,0 +1,565 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+//! Registry of the statistics recorded by the samplers.
+//!
+//! Each statistic has a channel which holds its most recent reading and an
+//! optional summary from which percentiles are calculated. Channels are kept
+//! in a dense array in the order they were registered, with an index from
+//! statistic name to position.
+//!
+//! Recording by statistic looks the channel up by name. Samplers which record
+//! many values per interval, such as the buckets of BPF histograms, resolve
+//! their statistics to a `Handle` when they are registered instead, so that
+//! each record is an atomic update of the channel without hashing or locking.
+//!
+//! Statistics which samplers discover while sampling, such as the stats of a
+//! service they poll, are registered as dynamic series subject to `Limits`:
+//! a cap on the series of each sampler, a budget on the estimated memory of
+//! the registry, and eviction of series which have not been seen recently.
+
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, RwLock};
+use std::time::{Duration, Instant};
+
+mod channel;
+mod sketch;
+mod summary;
+
+pub use channel::{Channel, Handle};
+pub use summary::Summary;
+
+/// How the values of a statistic are obtained
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub enum Source {
+    /// Monotonically increasing count, summarized as a rate per second
+    Counter,
+    /// Instantaneous value
+    Gauge,
+    /// Values with their number of occurrences, such as histogram buckets
+    Distribution,
+}
+
+/// A value which is exported for a statistic
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum Output {
+    /// Most recent value of a counter or gauge
+    Reading,
+    /// Percentile, between 0 and 100, of the summary over its span
+    Percentile(f64),
+    /// Percentile of the summary over another window, up to its history
+    WindowPercentile(f64, Duration),
+}
+
+pub trait Statistic: Send + Sync {
+    fn name(&self) -> &str;
+    fn source(&self) -> Source;
+}
+
+#[derive(Debug)]
+pub enum MetricsError {
+    NotRegistered,
+    /// A dynamic series was not registered because of the limits
+    Rejected,
+}
+
+impl std::fmt::Display for MetricsError {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            Self::NotRegistered => write!(f, "statistic is not registered"),
+            Self::Rejected => write!(f, "limit on dynamic series reached"),
+        }
+    }
+}
+
+impl std::error::Error for MetricsError {}
+
+/// One output of a statistic in a snapshot
+#[derive(Clone, Debug)]
+pub struct Metric {
+    name: String,
+    output: Output,
+}
+
+impl Metric {
+    pub fn name(&self) -> &str {
+        &self.name
+    }
+
+    pub fn output(&self) -> Output {
+        self.output
+    }
+}
+
+/// Bounds on the series which samplers register dynamically
+#[derive(Clone, Copy, Debug, Default)]
+pub struct Limits {
+    /// Estimated bytes used by all series, beyond which no more dynamic series
+    /// are registered
+    pub budget: Option<usize>,
+    /// Dynamic series of each sampler
+    pub series: Option<usize>,
+    /// Dynamic series which have not been seen for this long are evicted
+    pub stale: Option<Duration>,
+}
+
+#[derive(Default)]
+struct Registry {
+    index: HashMap<String, usize>,
+    channels: Vec<Arc<Channel>>,
+    // dynamic series of each sampler
+    dynamic: HashMap<&'static str, usize>,
+}
+
+pub struct Metrics {
+    epoch: Instant,
+    registry: RwLock<Registry>,
+    limits: Limits,
+    bytes: AtomicUsize,
+    evicted: AtomicU64,
+    rejected: AtomicU64,
+}
+
+impl Metrics {
+    pub fn new() -> Self {
+        Self::with_limits(Limits::default())
+    }
+
+    pub fn with_limits(limits: Limits) -> Self {
+        Self {
+            epoch: Instant::now(),
+            registry: RwLock::new(Registry::default()),
+            limits,
+            bytes: AtomicUsize::new(0),
+            evicted: AtomicU64::new(0),
+            rejected: AtomicU64::new(0),
+        }
+    }
+
+    /// Registers the statistic, if it is not registered yet, and returns a
+    /// handle to its channel
+    pub fn register(&self, statistic: &dyn Statistic) -> Handle {
+        if let Some(handle) = self.handle(statistic) {
+            return handle;
+        }
+        let mut registry = self.registry.write().unwrap();
+        if let Some(id) = registry.index.get(statistic.name()) {
+            return Handle::new(registry.channels[*id].clone());
+        }
+        let channel = Arc::new(Channel::new(
+            statistic.name(),
+            statistic.source(),
+            None,
+            self.epoch,
+        ));
+        self.bytes.fetch_add(channel.size(), Ordering::Relaxed);
+        let id = registry.channels.len();
+        registry.index.insert(statistic.name().to_string(), id);
+        registry.channels.push(channel.clone());
+        Handle::new(channel)
+    }
+
+    /// Registers a statistic which the sampler `owner` discovered while
+    /// sampling, along with its summary and outputs, and marks it as seen at
+    /// `time`. A new series is rejected if the sampler has as many dynamic
+    /// series as the limits allow, or if it would take the registry over its
+    /// memory budget.
+    pub fn register_dynamic(
+        &self,
+        owner: &'static str,
+        statistic: &dyn Statistic,
+        summary: Option<Summary>,
+        outputs: &[Output],
+        time: Instant,
+    ) -> Result<Handle, MetricsError> {
+        if let Some(channel) = self.channel(statistic) {
+            channel.touch(time);
+            return Ok(Handle::new(channel));
+        }
+        let mut registry = self.registry.write().unwrap();
+        if let Some(id) = registry.index.get(statistic.name()) {
+            let channel = registry.channels[*id].clone();
+            channel.touch(time);
+            return Ok(Handle::new(channel));
+        }
+        let series = registry.dynamic.get(owner).copied().unwrap_or(0);
+        if self.limits.series.map(|max| series >= max).unwrap_or(false) {
+            self.rejected.fetch_add(1, Ordering::Relaxed);
+            return Err(MetricsError::Rejected);
+        }
+        // the size is estimated before the channel is created, so that a
+        // series over the budget does not allocate its summary
+        if let Some(budget) = self.limits.budget {
+            let size = Channel::estimate(statistic.name(), outputs.len(), summary.as_ref());
+            if self.bytes.load(Ordering::Relaxed) + size > budget {
+                self.rejected.fetch_add(1, Ordering::Relaxed);
+                return Err(MetricsError::Rejected);
+            }
+        }
+        let channel = Channel::new(
+            statistic.name(),
+            statistic.source(),
+            Some(owner),
+            self.epoch,
+        );
+        for output in outputs {
+            channel.add_output(*output);
+        }
+        if let Some(summary) = summary {
+            channel.add_summary(summary);
+        }
+        channel.touch(time);
+        let channel = Arc::new(channel);
+        self.bytes.fetch_add(channel.size(), Ordering::Relaxed);
+        *registry.dynamic.entry(owner).or_insert(0) += 1;
+        let id = registry.channels.len();
+        registry.index.insert(statistic.name().to_string(), id);
+        registry.channels.push(channel.clone());
+        Ok(Handle::new(channel))
+    }
+
+    // removes the dynamic series which have not been seen since the time
+    fn evict(&self, since: Instant) {
+        let stale =
+            |channel: &Arc<Channel>| channel.owner().is_some() && channel.unseen_since(since);
+        if !self.registry.read().unwrap().channels.iter().any(stale) {
+            return;
+        }
+        let mut registry = self.registry.write().unwrap();
+        let Registry {
+            index,
+            channels,
+            dynamic,
+        } = &mut *registry;
+        channels.retain(|channel| {
+            if !stale(channel) {
+                return true;
+            }
+            if let Some(series) = channel.owner().and_then(|owner| dynamic.get_mut(owner)) {
+                *series -= 1;
+            }
+            self.bytes.fetch_sub(channel.size(), Ordering::Relaxed);
+            self.evicted.fetch_add(1, Ordering::Relaxed);
+            false
+        });
+        index.clear();
+        for (id, channel) in channels.iter().enumerate() {
+            index.insert(channel.name().to_string(), id);
+        }
+    }
+
+    /// Number of registered series
+    pub fn series(&self) -> usize {
+        self.registry.read().unwrap().channels.len()
+    }
+
+    /// Estimate of the bytes used by the registered series
+    pub fn bytes(&self) -> usize {
+        self.bytes.load(Ordering::Relaxed)
+    }
+
+    /// Dynamic series which were evicted for not being seen recently
+    pub fn evicted(&self) -> u64 {
+        self.evicted.load(Ordering::Relaxed)
+    }
+
+    /// Dynamic series which were not registered because of the limits
+    pub fn rejected(&self) -> u64 {
+        self.rejected.load(Ordering::Relaxed)
+    }
+
+    /// Returns a handle to the channel of a registered statistic
+    pub fn handle(&self, statistic: &dyn Statistic) -> Option<Handle> {
+        self.channel(statistic).map(Handle::new)
+    }
+
+    fn channel(&self, statistic: &dyn Statistic) -> Option<Arc<Channel>> {
+        let registry = self.registry.read().unwrap();
+        registry
+            .index
+            .get(statistic.name())
+            .map(|id| registry.channels[*id].clone())
+    }
+
+    /// Exports the output for the statistic, registering it if needed
+    pub fn add_output(&self, statistic: &dyn Statistic, output: Output) {
+        self.register(statistic);
+        if let Some(channel) = self.channel(statistic) {
+            channel.add_output(output);
+        }
+    }
+
+    /// Keeps a summary for the statistic, registering it if needed
+    pub fn add_summary(&self, statistic: &dyn Statistic, summary: Summary) {
+        self.register(statistic);
+        if let Some(channel) = self.channel(statistic) {
+            let size = channel.add_summary(summary);
+            self.bytes.fetch_add(size, Ordering::Relaxed);
+        }
+    }
+
+    pub fn record_counter(
+        &self,
+        statistic: &dyn Statistic,
+        time: Instant,
+        value: u64,
+    ) -> Result<(), MetricsError> {
+        let channel = self.channel(statistic).ok_or(MetricsError::NotRegistered)?;
+        channel.record_counter(time, value);
+        Ok(())
+    }
+
+    pub fn record_gauge(
+        &self,
+        statistic: &dyn Statistic,
+        time: Instant,
+        value: u64,
+    ) -> Result<(), MetricsError> {
+        let channel = self.channel(statistic).ok_or(MetricsError::NotRegistered)?;
+        channel.record_gauge(time, value);
+        Ok(())
+    }
+
+    pub fn record_bucket(
+        &self,
+        statistic: &dyn Statistic,
+        time: Instant,
+        value: u64,
+        count: u64,
+    ) -> Result<(), MetricsError> {
+        let channel = self.channel(statistic).ok_or(MetricsError::NotRegistered)?;
+        channel.record_bucket(time, value, count);
+        Ok(())
+    }
+
+    /// Current value of every output which has one, after evicting stale
+    /// dynamic series
+    pub fn snapshot(&self) -> Vec<(Metric, u64)> {
+        let now = Instant::now();
+        if let Some(since) = self.limits.stale.and_then(|stale| now.checked_sub(stale)) {
+            self.evict(since);
+        }
+        let channels = self.registry.read().unwrap().channels.clone();
+        let mut snapshot = Vec::new();
+        for channel in channels {
+            let outputs = channel.outputs();
+            let values = percentiles(&channel, now, &outputs);
+            for (output, value) in outputs.into_iter().zip(values) {
+                let value = match output {
+                    Output::Reading => channel.reading(),
+                    _ => value,
+                };
+                if let Some(value) = value {
+                    let metric = Metric {
+                        name: channel.name().to_string(),
+                        output,
+                    };
+                    snapshot.push((metric, value));
+                }
+            }
+        }
+        snapshot
+    }
+}
+
+// values of the percentile outputs of the channel, in the same order as the
+// outputs. All the percentiles over a window are found in a single pass.
+fn percentiles(channel: &Channel, now: Instant, outputs: &[Output]) -> Vec<Option<u64>> {
+    let mut values = vec![None; outputs.len()];
+    let mut windows: Vec<Option<Duration>> = Vec::new();
+    for output in outputs {
+        let window = match output {
+            Output::Reading => continue,
+            Output::Percentile(_) => None,
+            Output::WindowPercentile(_, window) => Some(*window),
+        };
+        if !windows.contains(&window) {
+            windows.push(window);
+        }
+    }
+    for window in windows {
+        let (positions, percentiles): (Vec<usize>, Vec<f64>) = outputs
+            .iter()
+            .enumerate()
+            .filter_map(|(position, output)| match output {
+                Output::Percentile(percentile) if window.is_none() => Some((position, *percentile)),
+                Output::WindowPercentile(percentile, w) if window == Some(*w) => {
+                    Some((position, *percentile))
+                }
+                _ => None,
+            })
+            .unzip();
+        for (position, value) in
+            positions
+                .into_iter()
+                .zip(channel.percentiles(now, window, &percentiles))
+        {
+            values[position] = value;
+        }
+    }
+    values
+}
+
+impl Default for Metrics {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    struct TestStatistic(&'static str, Source);
+
+    impl Statistic for TestStatistic {
+        fn name(&self) -> &str {
+            self.0
+        }
+
+        fn source(&self) -> Source {
+            self.1
+        }
+    }
+
+    #[test]
+    fn record() {
+        let metrics = Metrics::new();
+        let counter = TestStatistic("counter", Source::Counter);
+        assert!(metrics.record_counter(&counter, Instant::now(), 1).is_err());
+
+        metrics.add_output(&counter, Output::Reading);
+        metrics.add_output(&counter, Output::Percentile(50.0));
+        metrics.add_output(
+            &counter,
+            Output::WindowPercentile(50.0, Duration::from_secs(2)),
+        );
+        metrics.add_summary(&counter, Summary::stream(10, Duration::from_secs(10)));
+        let time = Instant::now();
+        // rates of 100, 200, 300 and 400 per second
+        for i in 0..5 {
+            let handle = metrics.register(&counter);
+            handle.record_counter(time + Duration::from_secs(i), i * (i + 1) / 2 * 100);
+        }
+        let snapshot = metrics.snapshot();
+        assert_eq!(snapshot.len(), 3);
+        for (metric, value) in snapshot {
+            assert_eq!(metric.name(), "counter");
+            match metric.output() {
+                Output::Reading => assert_eq!(value, 1_000),
+                Output::Percentile(_) => assert_eq!(value, 200),
+                Output::WindowPercentile(..) => assert_eq!(value, 300),
+            }
+        }
+    }
+
+    #[test]
+    fn dynamic() {
+        let metrics = Metrics::with_limits(Limits {
+            series: Some(2),
+            ..Default::default()
+        });
+        let time = Instant::now();
+        let statistics: Vec<TestStatistic> = ["a", "b", "c"]
+            .iter()
+            .map(|name| TestStatistic(name, Source::Gauge))
+            .collect();
+        let register = |statistic, time| {
+            metrics.register_dynamic("test", statistic, None, &[Output::Reading], time)
+        };
+        assert!(register(&statistics[0], time).is_ok());
+        assert!(register(&statistics[1], time).is_ok());
+        assert!(register(&statistics[2], time).is_err());
+        assert_eq!(metrics.rejected(), 1);
+        // registering again marks the series as seen
+        assert!(register(&statistics[1], time + Duration::from_secs(2)).is_ok());
+        let bytes = metrics.bytes();
+
+        metrics.evict(time + Duration::from_secs(1));
+        assert_eq!(metrics.evicted(), 1);
+        assert_eq!(metrics.series(), 1);
+        assert!(metrics.bytes() < bytes);
+        assert!(metrics.handle(&statistics[0]).is_none());
+        assert!(metrics.handle(&statistics[1]).is_some());
+        // which makes room for another
+        assert!(register(&statistics[2], time).is_ok());
+
+        let budget = Metrics::with_limits(Limits {
+            budget: Some(256),
+            ..Default::default()
+        });
+        let summary = Some(Summary::stream(60, Duration::from_secs(60)));
+        let result = budget.register_dynamic("test", &statistics[0], summary, &[], time);
+        assert!(result.is_err());
+    }
+
+    // compares recording histogram buckets by statistic and by handle, run
+    // with:
+    // cargo test --release -- --ignored --nocapture bench_record
+    #[test]
+    #[ignore]
+    fn bench_record() {
+        const RECORDS: u64 = 10_000_000;
+
+        let metrics = Metrics::new();
+        let statistics: Vec<TestStatistic> = [
+            "disk/read/latency",
+            "disk/write/latency",
+            "tcp/connect/latency",
+            "tcp/receive/size",
+        ]
+        .iter()
+        .map(|name| TestStatistic(name, Source::Distribution))
+        .collect();
+        for statistic in &statistics {
+            metrics.add_summary(
+                statistic,
+                Summary::heatmap(
+                    1_000_000_000,
+                    2,
+                    Duration::from_secs(60),
+                    Duration::from_secs(1),
+                ),
+            );
+        }
+        let time = Instant::now();
+
+        let start = Instant::now();
+        for i in 0..RECORDS {
+            let statistic = &statistics[(i % 4) as usize];
+            let _ = metrics.record_bucket(statistic, time, i % 1_000_000, 1);
+        }
+        let lookup = start.elapsed();
+
+        let handles: Vec<Handle> = statistics.iter().map(|s| metrics.register(s)).collect();
+        let start = Instant::now();
+        for i in 0..RECORDS {
+            handles[(i % 4) as usize].record_bucket(time, i % 1_000_000, 1);
+        }
+        let handle = start.elapsed();
+
+        // whole histograms in the layout of the BPF histograms, scaled from
+        // microseconds to nanoseconds
+        let kernel = summary::Buckets::new(1_000_000, 2);
+        let values: Arc<[u64]> = (0..460).map(|i| kernel.value(i) * 1_000).collect();
+        let handles: Vec<Handle> = handles
+            .into_iter()
+            .map(|handle| handle.with_buckets(values.clone()))
+            .collect();
+        let counts: Vec<u64> = (0..values.len() as u64).collect();
+        let start = Instant::now();
+        for i in 0..RECORDS / values.len() as u64 {
+            handles[(i % 4) as usize].record_histogram(time, &counts);
+        }
+        let histogram = start.elapsed();
+
+        println!(
+            "records/s by statistic: {:.0} by handle: {:.0} by histogram: {:.0}",
+            RECORDS as f64 / lookup.as_secs_f64(),
+            RECORDS as f64 / handle.as_secs_f64(),
+            RECORDS as f64 / histogram.as_secs_f64()
+        );
+    }
+}
@@ -0,0 +1,324 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+use std::sync::Mutex;
+use std::time::Duration;
+
+use super::summary::{slice_count, walk};
+
+/// Quantile sketch over a rolling window, with a bounded relative error for
+/// the values within the range its bins cover.
+///
+/// Values are counted in logarithmic bins, where bin `k` holds the values in
+/// `(γ^(k-1), γ^k]` with `γ = (1 + accuracy) / (1 - accuracy)`, so the
+/// estimate for a bin is within `accuracy` of every value in it. Each slice of
+/// the window keeps a fixed number of contiguous bins, which follow the
+/// largest value recorded, so they cover values down to about `max / γ^bins`.
+/// Values below that are counted in the lowest bin and estimated as its
+/// value, without any bound on the error. With `Sketch::bins(accuracy)` bins,
+/// about 1100 at 2%, every `u64` is in range and the bound holds for all
+/// percentiles. The memory used is set by the number of bins and slices,
+/// regardless of how often values are recorded.
+pub(crate) struct Sketch {
+    gamma: f64,
+    ln_gamma: f64,
+    resolution: u64,
+    // slices in the span
+    span: u64,
+    slices: Mutex<Box<[Bins]>>,
+}
+
+struct Bins {
+    // number of the resolution interval the counts belong to, starting from
+    // one so that zero marks an unused slice
+    sequence: u64,
+    // key of the first bin
+    offset: i32,
+    // number of values recorded, including zeros
+    total: u64,
+    zero: u64,
+    counts: Box<[u32]>,
+}
+
+impl Bins {
+    fn clear(&mut self, sequence: u64) {
+        self.sequence = sequence;
+        self.offset = 0;
+        self.total = 0;
+        self.zero = 0;
+        for count in self.counts.iter_mut() {
+            *count = 0;
+        }
+    }
+
+    fn add(&mut self, key: i32, count: u64) {
+        let len = self.counts.len() as i32;
+        if self.total == self.zero {
+            // first non-zero value, which leaves room on either side
+            self.offset = key - len / 2;
+        } else if key >= self.offset + len {
+            self.shift((key - len + 1 - self.offset) as usize);
+        } else if key < self.offset {
+            // the bins move down as far as the largest value leaves room for
+            let lowest = key.max(self.highest() - len + 1);
+            if lowest < self.offset {
+                self.unshift((self.offset - lowest) as usize);
+            }
+        }
+        self.total += count;
+        let index = (key - self.offset).max(0) as usize;
+        self.counts[index] = self.counts[index].saturating_add(count.min(u32::MAX as u64) as u32);
+    }
+
+    // moves the bins up by `by` keys, collapsing those which fall off the
+    // bottom into the lowest bin
+    fn shift(&mut self, by: usize) {
+        let len = self.counts.len();
+        let collapsed = self.counts[..=by.min(len - 1)]
+            .iter()
+            .fold(0_u32, |total, count| total.saturating_add(*count));
+        if by < len {
+            self.counts.copy_within(by.., 0);
+            for count in self.counts[len - by..].iter_mut() {
+                *count = 0;
+            }
+        } else {
+            for count in self.counts.iter_mut() {
+                *count = 0;
+            }
+        }
+        self.counts[0] = collapsed;
+        self.offset += by as i32;
+    }
+
+    // moves the bins down by `by` keys, which must be free at the top
+    fn unshift(&mut self, by: usize) {
+        let len = self.counts.len();
+        self.counts.copy_within(..len - by, by);
+        for count in self.counts[..by].iter_mut() {
+            *count = 0;
+        }
+        self.offset -= by as i32;
+    }
+
+    // key of the highest bin with a count
+    fn highest(&self) -> i32 {
+        let index = self
+            .counts
+            .iter()
+            .rposition(|count| *count > 0)
+            .unwrap_or(0);
+        self.offset + index as i32
+    }
+
+    fn count(&self, key: i32) -> u64 {
+        let index = key - self.offset;
+        if index >= 0 && (index as usize) < self.counts.len() {
+            self.counts[index as usize] as u64
+        } else {
+            0
+        }
+    }
+}
+
+impl Sketch {
+    pub fn new(
+        accuracy: f64,
+        bins: usize,
+        span: Duration,
+        history: Duration,
+        resolution: Duration,
+    ) -> Self {
+        let accuracy = accuracy.clamp(0.0001, 0.5);
+        let gamma = (1.0 + accuracy) / (1.0 - accuracy);
+        let resolution = (resolution.as_nanos() as u64).max(1);
+        let span = slice_count(span, resolution);
+        let slices = (0..slice_count(history, resolution).max(span))
+            .map(|_| Bins {
+                sequence: 0,
+                offset: 0,
+                total: 0,
+                zero: 0,
+                counts: vec![0; bins.max(1)].into_boxed_slice(),
+            })
+            .collect();
+        Self {
+            gamma,
+            ln_gamma: gamma.ln(),
+            resolution,
+            span,
+            slices: Mutex::new(slices),
+        }
+    }
+
+    /// Number of bins which cover every value at the accuracy, so that no
+    /// value is collapsed into the lowest bin
+    pub fn bins(accuracy: f64) -> usize {
+        let accuracy = accuracy.clamp(0.0001, 0.5);
+        let gamma = (1.0 + accuracy) / (1.0 - accuracy);
+        ((u64::MAX as f64).ln() / gamma.ln()).ceil() as usize + 1
+    }
+
+    /// The size of a sketch with the configuration, without allocating it
+    pub fn estimate(bins: usize, span: Duration, history: Duration, resolution: Duration) -> usize {
+        let resolution = (resolution.as_nanos() as u64).max(1);
+        let slices = slice_count(history, resolution).max(slice_count(span, resolution));
+        slices as usize * (std::mem::size_of::<Bins>() + bins.max(1) * 4)
+    }
+
+    pub fn size(&self) -> usize {
+        self.slices
+            .lock()
+            .unwrap()
+            .iter()
+            .map(|slice| std::mem::size_of::<Bins>() + slice.counts.len() * 4)
+            .sum()
+    }
+
+    fn key(&self, value: u64) -> i32 {
+        ((value as f64).ln() / self.ln_gamma).ceil() as i32
+    }
+
+    // estimate for the values in the bin, within the accuracy of all of them
+    fn value(&self, key: i32) -> u64 {
+        (2.0 * self.gamma.powi(key) / (self.gamma + 1.0)).round() as u64
+    }
+
+    pub fn record(&self, time: u64, value: u64, count: u64) {
+        let sequence = time / self.resolution + 1;
+        let mut slices = self.slices.lock().unwrap();
+        let len = slices.len() as u64;
+        let slice = &mut slices[(sequence % len) as usize];
+        if slice.sequence != sequence {
+            // the slot holds a newer slice than the time belongs to
+            if slice.sequence > sequence {
+                return;
+            }
+            slice.clear(sequence);
+        }
+        if value == 0 {
+            slice.total += count;
+            slice.zero += count;
+        } else {
+            slice.add(self.key(value), count);
+        }
+    }
+
+    pub fn percentiles(
+        &self,
+        now: u64,
+        window: Option<Duration>,
+        percentiles: &[f64],
+    ) -> Vec<Option<u64>> {
+        let slices = self.slices.lock().unwrap();
+        let window = window
+            .map(|window| slice_count(window, self.resolution))
+            .unwrap_or(self.span)
+            .min(slices.len() as u64);
+        let newest = now / self.resolution + 1;
+        let oldest = newest.saturating_sub(window - 1);
+        let live: Vec<&Bins> = slices
+            .iter()
+            .filter(|slice| slice.sequence != 0 && slice.sequence >= oldest)
+            .collect();
+        let total = live.iter().map(|slice| slice.total).sum();
+        let zero = live.iter().map(|slice| slice.zero).sum();
+        let used = live.iter().filter(|slice| slice.total > slice.zero);
+        let low = used.clone().map(|slice| slice.offset).min().unwrap_or(0);
+        let high = used
+            .map(|slice| slice.offset + slice.counts.len() as i32)
+            .max()
+            .unwrap_or(0);
+        let counts = (low..high).map(|key| {
+            let count = live.iter().map(|slice| slice.count(key)).sum();
+            (self.value(key), count)
+        });
+        walk(total, percentiles, std::iter::once((0, zero)).chain(counts))
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use crate::metrics::summary::{rank, Summary};
+
+    #[test]
+    fn accuracy() {
+        let window = Duration::from_secs(60);
+        let sketch = Summary::sketch(0.01, 512, window, Duration::from_secs(15)).build();
+        let mut values: Vec<u64> = (0..10_000_u64).map(|i| i * i % 1_000_003).collect();
+        for value in &values {
+            sketch.record(0, *value, 1);
+        }
+        values.sort_unstable();
+        for percentile in &[1.0, 10.0, 50.0, 90.0, 99.0, 99.9] {
+            let exact = values[rank(values.len() as u64, *percentile) as usize - 1] as f64;
+            let estimate = sketch.percentile(0, *percentile).unwrap() as f64;
+            assert!((estimate - exact).abs() <= exact * 0.01 + 1.0);
+        }
+    }
+
+    #[test]
+    fn full_range() {
+        let window = Duration::from_secs(60);
+        let bins = Sketch::bins(0.02);
+        assert!((1_100..1_120).contains(&bins));
+        let sketch = Summary::sketch(0.02, bins, window, window).build();
+        // the largest value first, so the bins have to move down for the
+        // others, which span a range of 100_000x
+        sketch.record(0, u64::MAX, 1);
+        let mut values: Vec<u64> = (1..=100_000_u64).rev().step_by(7).collect();
+        for value in &values {
+            sketch.record(0, *value, 1);
+        }
+        values.push(u64::MAX);
+        values.sort_unstable();
+        for percentile in &[0.001, 0.01, 0.1, 1.0, 10.0, 50.0, 90.0, 100.0] {
+            let exact = values[rank(values.len() as u64, *percentile) as usize - 1] as f64;
+            let estimate = sketch.percentile(0, *percentile).unwrap() as f64;
+            assert!(
+                (estimate - exact).abs() <= exact * 0.02 + 1.0,
+                "p{}: {} for {}",
+                percentile,
+                estimate,
+                exact
+            );
+        }
+    }
+
+    #[test]
+    fn collapsed() {
+        let sketch =
+            Summary::sketch(0.02, 8, Duration::from_secs(1), Duration::from_secs(1)).build();
+        sketch.record(0, 0, 1);
+        for value in &[1, 10, 100, 1_000] {
+            sketch.record(0, *value, 1);
+        }
+        // only the largest values keep their accuracy
+        assert_eq!(sketch.percentile(0, 20.0), Some(0));
+        let max = sketch.percentile(0, 100.0).unwrap();
+        assert!((980..=1_020).contains(&max));
+        assert!(sketch.percentile(0, 40.0).unwrap() < max);
+    }
+
+    #[test]
+    fn window() {
+        let second = 1_000_000_000;
+        let sketch =
+            Summary::sketch(0.02, 128, Duration::from_secs(3), Duration::from_secs(1)).build();
+        assert_eq!(sketch.percentile(0, 50.0), None);
+        sketch.record(0, 100, 10);
+        sketch.record(2 * second, 1_000, 10);
+        let p50 = sketch.percentile(2 * second, 50.0).unwrap();
+        assert!((98..=102).contains(&p50));
+        // the first slice has left the window
+        let p50 = sketch.percentile(3 * second, 50.0).unwrap();
+        assert!((980..=1_020).contains(&p50));
+        assert_eq!(sketch.percentile(5 * second, 50.0), None);
+        // a value for an expired slice is not recorded
+        sketch.record(5 * second, 10, 1);
+        sketch.record(second, 10, 1);
+        assert_eq!(sketch.percentile(5 * second, 100.0), Some(10));
+    }
+}
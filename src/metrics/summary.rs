@@ -0,0 +1,745 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::time::Duration;
+
+use super::sketch::Sketch;
+
+/// Describes the summary kept for a statistic, from which its percentiles
+/// are calculated.
+///
+/// Percentiles are calculated over the window `span` by default. A summary
+/// may also keep a longer `history`, so that percentiles over any window up to
+/// the history are calculated from the same storage.
+#[derive(Clone, Copy, Debug)]
+pub enum Summary {
+    /// Histogram of the values recorded over a rolling window. Values are
+    /// kept with `precision` significant decimal digits up to `max`, in slices
+    /// of `resolution` which expire once they are older than the history.
+    Heatmap {
+        max: u64,
+        precision: u32,
+        span: Duration,
+        history: Duration,
+        resolution: Duration,
+    },
+    /// The most recently recorded values, with `samples` of them expected
+    /// within the `span`
+    Stream {
+        samples: usize,
+        span: Duration,
+        history: Duration,
+    },
+    /// Values recorded over a rolling window, counted in a fixed number of
+    /// logarithmic `bins` so that percentiles within the range of the bins
+    /// have the relative `accuracy`, in slices of `resolution` which expire
+    /// once they are older than the history. Unlike a stream, the memory used
+    /// does not depend on how often values are recorded.
+    Sketch {
+        accuracy: f64,
+        bins: usize,
+        span: Duration,
+        history: Duration,
+        resolution: Duration,
+    },
+}
+
+impl Summary {
+    pub fn heatmap(max: u64, precision: u32, span: Duration, resolution: Duration) -> Self {
+        Self::Heatmap {
+            max,
+            precision,
+            span,
+            history: span,
+            resolution,
+        }
+    }
+
+    pub fn stream(samples: usize, span: Duration) -> Self {
+        Self::Stream {
+            samples,
+            span,
+            history: span,
+        }
+    }
+
+    pub fn sketch(accuracy: f64, bins: usize, span: Duration, resolution: Duration) -> Self {
+        Self::Sketch {
+            accuracy,
+            bins,
+            span,
+            history: span,
+            resolution,
+        }
+    }
+
+    /// Number of sketch bins which cover every value at the accuracy
+    pub fn sketch_bins(accuracy: f64) -> usize {
+        Sketch::bins(accuracy)
+    }
+
+    /// Keeps values for at least `history`, for percentiles over windows
+    /// longer than the span
+    pub fn with_history(mut self, history: Duration) -> Self {
+        match &mut self {
+            Self::Heatmap {
+                span,
+                history: kept,
+                ..
+            }
+            | Self::Stream {
+                span,
+                history: kept,
+                ..
+            }
+            | Self::Sketch {
+                span,
+                history: kept,
+                ..
+            } => *kept = history.max(*span),
+        }
+        self
+    }
+
+    /// Estimate of the bytes the summary uses once it is built, without
+    /// building it
+    pub(crate) fn size(&self) -> usize {
+        std::mem::size_of::<SummaryState>()
+            + match *self {
+                Self::Heatmap {
+                    max,
+                    precision,
+                    span,
+                    history,
+                    resolution,
+                } => Heatmap::estimate(max, precision, span, history, resolution),
+                Self::Stream {
+                    samples,
+                    span,
+                    history,
+                } => Stream::estimate(samples, span, history),
+                Self::Sketch {
+                    bins,
+                    span,
+                    history,
+                    resolution,
+                    ..
+                } => Sketch::estimate(bins, span, history, resolution),
+            }
+    }
+
+    pub(crate) fn build(&self) -> SummaryState {
+        match *self {
+            Self::Heatmap {
+                max,
+                precision,
+                span,
+                history,
+                resolution,
+            } => SummaryState::Heatmap(Heatmap::new(max, precision, span, history, resolution)),
+            Self::Stream {
+                samples,
+                span,
+                history,
+            } => SummaryState::Stream(Stream::new(samples, span, history)),
+            Self::Sketch {
+                accuracy,
+                bins,
+                span,
+                history,
+                resolution,
+            } => SummaryState::Sketch(Sketch::new(accuracy, bins, span, history, resolution)),
+        }
+    }
+}
+
+pub(crate) enum SummaryState {
+    Heatmap(Heatmap),
+    Stream(Stream),
+    Sketch(Sketch),
+}
+
+impl SummaryState {
+    /// Estimate of the bytes used by the summary
+    pub fn size(&self) -> usize {
+        std::mem::size_of::<Self>()
+            + match self {
+                Self::Heatmap(heatmap) => heatmap.size(),
+                Self::Stream(stream) => stream.values.len() * std::mem::size_of::<AtomicU64>(),
+                Self::Sketch(sketch) => sketch.size(),
+            }
+    }
+
+    /// Records `count` occurrences of the value at a time in nanoseconds
+    pub fn record(&self, time: u64, value: u64, count: u64) {
+        match self {
+            Self::Heatmap(heatmap) => heatmap.record(time, value, count),
+            Self::Stream(stream) => stream.record(value, count),
+            Self::Sketch(sketch) => sketch.record(time, value, count),
+        }
+    }
+
+    /// Maps the buckets of histograms which are recorded in bulk, where each
+    /// bucket has the given value, to the buckets of the summary
+    pub fn bucket_map(&self, values: Arc<[u64]>) -> BucketMap {
+        let indices: Option<Box<[u32]>> = match self {
+            Self::Heatmap(heatmap) => Some(
+                values
+                    .iter()
+                    .map(|value| heatmap.buckets.index(*value) as u32)
+                    .collect(),
+            ),
+            Self::Stream(_) | Self::Sketch(_) => None,
+        };
+        let identity = indices
+            .as_ref()
+            .map(|indices| {
+                indices
+                    .iter()
+                    .enumerate()
+                    .all(|(i, index)| i == *index as usize)
+            })
+            .unwrap_or(false);
+        BucketMap {
+            values,
+            indices,
+            identity,
+        }
+    }
+
+    /// Records the counts of a histogram, in the layout of the bucket map
+    pub fn record_histogram(&self, time: u64, map: &BucketMap, counts: &[u64]) {
+        match self {
+            Self::Heatmap(heatmap) => heatmap.record_histogram(time, map, counts),
+            Self::Stream(stream) => {
+                for (value, count) in map.values.iter().zip(counts) {
+                    if *count > 0 {
+                        stream.record(*value, *count);
+                    }
+                }
+            }
+            Self::Sketch(sketch) => {
+                for (value, count) in map.values.iter().zip(counts) {
+                    if *count > 0 {
+                        sketch.record(time, *value, *count);
+                    }
+                }
+            }
+        }
+    }
+
+    /// Returns the percentile, between 0 and 100, of the values as of `now`
+    #[cfg(test)]
+    pub fn percentile(&self, now: u64, percentile: f64) -> Option<u64> {
+        self.percentiles(now, None, &[percentile])[0]
+    }
+
+    /// Returns each of the percentiles of the values within the window, or
+    /// the span if none is given, as of `now`. The percentiles are in the same
+    /// order and are found in a single pass over the summary.
+    pub fn percentiles(
+        &self,
+        now: u64,
+        window: Option<Duration>,
+        percentiles: &[f64],
+    ) -> Vec<Option<u64>> {
+        match self {
+            Self::Heatmap(heatmap) => heatmap.percentiles(now, window, percentiles),
+            Self::Stream(stream) => stream.percentiles(window, percentiles),
+            Self::Sketch(sketch) => sketch.percentiles(now, window, percentiles),
+        }
+    }
+}
+
+/// The buckets of a histogram which is recorded in bulk, mapped to the
+/// buckets of a summary
+pub struct BucketMap {
+    values: Arc<[u64]>,
+    // heatmap bucket of each histogram bucket
+    indices: Option<Box<[u32]>>,
+    // whether each histogram bucket is the heatmap bucket at the same index
+    identity: bool,
+}
+
+// number of slices of `resolution` nanoseconds which cover the duration
+pub(crate) fn slice_count(duration: Duration, resolution: u64) -> u64 {
+    ((duration.as_nanos() as u64 + resolution - 1) / resolution).max(1)
+}
+
+// nearest rank of the percentile among `total` values, starting from 1
+pub(crate) fn rank(total: u64, percentile: f64) -> u64 {
+    ((percentile / 100.0 * total as f64).ceil() as u64).clamp(1, total)
+}
+
+/// Finds the value at the rank of each percentile in one walk over the counts
+/// of the values, which must be in ascending order of value
+pub(crate) fn walk(
+    total: u64,
+    percentiles: &[f64],
+    counts: impl Iterator<Item = (u64, u64)>,
+) -> Vec<Option<u64>> {
+    let mut values = vec![None; percentiles.len()];
+    if total == 0 {
+        return values;
+    }
+    let mut ranks: Vec<(u64, usize)> = percentiles
+        .iter()
+        .enumerate()
+        .map(|(i, percentile)| (rank(total, *percentile), i))
+        .collect();
+    ranks.sort_unstable();
+    let mut ranks = ranks.into_iter().peekable();
+    let mut seen = 0;
+    for (value, count) in counts {
+        seen += count;
+        while let Some(&(rank, i)) = ranks.peek() {
+            if rank > seen {
+                break;
+            }
+            values[i] = Some(value);
+            ranks.next();
+        }
+        if ranks.peek().is_none() {
+            break;
+        }
+    }
+    values
+}
+
+/// Log-linear bucketing of values, exact below `10^precision` and with
+/// `precision` significant digits above
+pub(crate) struct Buckets {
+    max: u64,
+    precision: u32,
+    exact: u64,
+    // buckets per power of ten above the exact range
+    step: u64,
+}
+
+impl Buckets {
+    pub fn new(max: u64, precision: u32) -> Self {
+        let precision = precision.clamp(1, 18);
+        let exact = 10_u64.pow(precision);
+        Self {
+            max,
+            precision,
+            exact,
+            step: exact - exact / 10,
+        }
+    }
+
+    pub fn len(&self) -> usize {
+        self.index(self.max) + 1
+    }
+
+    pub fn index(&self, value: u64) -> usize {
+        let value = value.min(self.max);
+        if value < self.exact {
+            return value as usize;
+        }
+        let power = log10(value);
+        let divisor = 10_u64.pow(power - self.precision + 1);
+        (self.exact + (power - self.precision) as u64 * self.step + value / divisor
+            - self.exact / 10) as usize
+    }
+
+    /// Largest value which falls in the bucket
+    pub fn value(&self, index: usize) -> u64 {
+        let index = index as u64;
+        if index < self.exact {
+            return index;
+        }
+        let offset = index - self.exact;
+        let power = (offset / self.step) as u32 + self.precision;
+        let divisor = 10_u64.pow(power - self.precision + 1);
+        let lower = (offset % self.step + self.exact / 10) * divisor;
+        lower.saturating_add(divisor - 1).min(self.max)
+    }
+}
+
+fn log10(mut value: u64) -> u32 {
+    let mut power = 0;
+    while value >= 10 {
+        value /= 10;
+        power += 1;
+    }
+    power
+}
+
+pub(crate) struct Heatmap {
+    buckets: Buckets,
+    resolution: u64,
+    // slices in the span
+    span: u64,
+    slices: Box<[Slice]>,
+}
+
+struct Slice {
+    // number of the resolution interval the counts belong to, starting from
+    // one so that zero marks an unused slice
+    sequence: AtomicU64,
+    counts: Box<[AtomicU64]>,
+}
+
+impl Heatmap {
+    pub fn new(
+        max: u64,
+        precision: u32,
+        span: Duration,
+        history: Duration,
+        resolution: Duration,
+    ) -> Self {
+        let buckets = Buckets::new(max, precision);
+        let resolution = (resolution.as_nanos() as u64).max(1);
+        let span = slice_count(span, resolution);
+        let slices = (0..slice_count(history, resolution).max(span))
+            .map(|_| Slice {
+                sequence: AtomicU64::new(0),
+                counts: (0..buckets.len()).map(|_| AtomicU64::new(0)).collect(),
+            })
+            .collect();
+        Self {
+            buckets,
+            resolution,
+            span,
+            slices,
+        }
+    }
+
+    fn size(&self) -> usize {
+        self.slices.len()
+            * (std::mem::size_of::<Slice>() + self.buckets.len() * std::mem::size_of::<AtomicU64>())
+    }
+
+    // the size of a heatmap with the configuration, without allocating it
+    fn estimate(
+        max: u64,
+        precision: u32,
+        span: Duration,
+        history: Duration,
+        resolution: Duration,
+    ) -> usize {
+        let resolution = (resolution.as_nanos() as u64).max(1);
+        let slices = slice_count(history, resolution).max(slice_count(span, resolution));
+        slices as usize
+            * (std::mem::size_of::<Slice>()
+                + Buckets::new(max, precision).len() * std::mem::size_of::<AtomicU64>())
+    }
+
+    // the slice for the time, cleared first if it is reused for a new slice
+    fn slice(&self, time: u64) -> Option<&Slice> {
+        let sequence = time / self.resolution + 1;
+        let slice = &self.slices[(sequence % self.slices.len() as u64) as usize];
+        let current = slice.sequence.load(Ordering::Acquire);
+        if current != sequence {
+            // the slot holds a newer slice than the time belongs to
+            if current > sequence {
+                return None;
+            }
+            // each statistic has a single writer, so nothing is recorded
+            // while the slice is cleared
+            if slice
+                .sequence
+                .compare_exchange(current, sequence, Ordering::AcqRel, Ordering::Acquire)
+                .is_ok()
+            {
+                for count in slice.counts.iter() {
+                    count.store(0, Ordering::Relaxed);
+                }
+            }
+        }
+        Some(slice)
+    }
+
+    pub fn record(&self, time: u64, value: u64, count: u64) {
+        if let Some(slice) = self.slice(time) {
+            slice.counts[self.buckets.index(value)].fetch_add(count, Ordering::Relaxed);
+        }
+    }
+
+    /// Adds the counts of a histogram whose buckets map to the buckets here
+    pub fn record_histogram(&self, time: u64, map: &BucketMap, counts: &[u64]) {
+        let slice = match self.slice(time) {
+            Some(slice) => slice,
+            None => return,
+        };
+        match &map.indices {
+            // the layouts match, so the counts are added bucket for bucket
+            Some(_) if map.identity => {
+                for (total, count) in slice.counts.iter().zip(counts) {
+                    if *count > 0 {
+                        total.fetch_add(*count, Ordering::Relaxed);
+                    }
+                }
+            }
+            Some(indices) => {
+                for (index, count) in indices.iter().zip(counts) {
+                    if *count > 0 {
+                        slice.counts[*index as usize].fetch_add(*count, Ordering::Relaxed);
+                    }
+                }
+            }
+            None => {
+                for (value, count) in map.values.iter().zip(counts) {
+                    if *count > 0 {
+                        slice.counts[self.buckets.index(*value)]
+                            .fetch_add(*count, Ordering::Relaxed);
+                    }
+                }
+            }
+        }
+    }
+
+    pub fn percentiles(
+        &self,
+        now: u64,
+        window: Option<Duration>,
+        percentiles: &[f64],
+    ) -> Vec<Option<u64>> {
+        let mut counts = vec![0; self.buckets.len()];
+        let window = window
+            .map(|window| slice_count(window, self.resolution))
+            .unwrap_or(self.span)
+            .min(self.slices.len() as u64);
+        let newest = now / self.resolution + 1;
+        let oldest = newest.saturating_sub(window - 1);
+        for slice in self.slices.iter() {
+            let sequence = slice.sequence.load(Ordering::Acquire);
+            if sequence == 0 || sequence < oldest {
+                continue;
+            }
+            for (total, count) in counts.iter_mut().zip(slice.counts.iter()) {
+                *total += count.load(Ordering::Relaxed);
+            }
+        }
+        let total = counts.iter().sum();
+        walk(
+            total,
+            percentiles,
+            counts
+                .iter()
+                .enumerate()
+                .map(|(index, count)| (self.buckets.value(index), *count)),
+        )
+    }
+}
+
+// number of samples expected within the window, given the number within the
+// span
+fn covering(samples: usize, span: Duration, window: Duration) -> usize {
+    if span.as_nanos() == 0 {
+        return samples;
+    }
+    (samples as f64 * window.as_secs_f64() / span.as_secs_f64()).ceil() as usize
+}
+
+pub(crate) struct Stream {
+    samples: usize,
+    span: Duration,
+    values: Box<[AtomicU64]>,
+    written: AtomicUsize,
+}
+
+impl Stream {
+    pub fn new(samples: usize, span: Duration, history: Duration) -> Self {
+        let samples = samples.max(1);
+        Self {
+            samples,
+            span,
+            values: (0..covering(samples, span, history).max(samples))
+                .map(|_| AtomicU64::new(0))
+                .collect(),
+            written: AtomicUsize::new(0),
+        }
+    }
+
+    // the size of a stream with the configuration, without allocating it
+    fn estimate(samples: usize, span: Duration, history: Duration) -> usize {
+        let samples = samples.max(1);
+        covering(samples, span, history).max(samples) * std::mem::size_of::<AtomicU64>()
+    }
+
+    pub fn record(&self, value: u64, count: u64) {
+        for _ in 0..count.min(self.values.len() as u64) {
+            let index = self.written.fetch_add(1, Ordering::Relaxed) % self.values.len();
+            self.values[index].store(value, Ordering::Relaxed);
+        }
+    }
+
+    pub fn percentiles(&self, window: Option<Duration>, percentiles: &[f64]) -> Vec<Option<u64>> {
+        let window = window
+            .map(|window| covering(self.samples, self.span, window))
+            .unwrap_or(self.samples)
+            .max(1);
+        let written = self.written.load(Ordering::Relaxed);
+        let len = written.min(self.values.len()).min(window);
+        if len == 0 {
+            return vec![None; percentiles.len()];
+        }
+        // the most recent values, which end just before the next to be written
+        let end = written % self.values.len();
+        let mut values: Vec<u64> = (0..len)
+            .map(|i| {
+                let index = (end + self.values.len() - 1 - i) % self.values.len();
+                self.values[index].load(Ordering::Relaxed)
+            })
+            .collect();
+        values.sort_unstable();
+        percentiles
+            .iter()
+            .map(|percentile| Some(values[rank(len as u64, *percentile) as usize - 1]))
+            .collect()
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn buckets() {
+        let buckets = Buckets::new(1_000_000_000, 2);
+        assert_eq!(buckets.index(99), 99);
+        assert_eq!(buckets.index(150), 105);
+        assert_eq!(buckets.value(105), 159);
+        assert_eq!(buckets.value(buckets.index(123_456)), 129_999);
+        assert_eq!(buckets.index(u64::MAX), buckets.len() - 1);
+        for value in &[0, 7, 100, 999, 1_000, 54_321, 999_999_999] {
+            let index = buckets.index(*value);
+            assert!(buckets.value(index) >= *value);
+            assert!(index == 0 || buckets.value(index - 1) < *value);
+        }
+    }
+
+    #[test]
+    fn heatmap_window() {
+        let second = 1_000_000_000;
+        let heatmap =
+            Summary::heatmap(1_000_000, 2, Duration::from_secs(3), Duration::from_secs(1)).build();
+        for value in 1..=100 {
+            heatmap.record(0, value, 1);
+        }
+        assert_eq!(heatmap.percentile(0, 50.0), Some(50));
+        assert_eq!(heatmap.percentile(0, 99.0), Some(99));
+        heatmap.record(2 * second, 1_000, 100);
+        assert_eq!(heatmap.percentile(2 * second, 50.0), Some(109));
+        assert_eq!(heatmap.percentile(2 * second, 90.0), Some(1_099));
+        // the first slice has left the window
+        assert_eq!(heatmap.percentile(3 * second, 1.0), Some(1_099));
+        assert_eq!(heatmap.percentile(5 * second, 50.0), None);
+    }
+
+    #[test]
+    fn histogram() {
+        let window = Duration::from_secs(60);
+        let second = Duration::from_secs(1);
+        // the layout of the BPF histograms, which is the heatmap layout
+        let kernel = Buckets::new(1_000_000, 2);
+        let counts: Vec<u64> = (0..460).map(|i| i % 7).collect();
+        for scale in &[1, 1_000] {
+            let values: Arc<[u64]> = (0..460).map(|i| kernel.value(i) * scale).collect();
+            let bulk = Summary::heatmap(1_000_000_000, 2, window, second).build();
+            let single = Summary::heatmap(1_000_000_000, 2, window, second).build();
+            let map = bulk.bucket_map(values.clone());
+            assert_eq!(map.identity, *scale == 1);
+            bulk.record_histogram(0, &map, &counts);
+            for (value, count) in values.iter().zip(&counts) {
+                single.record(0, *value, *count);
+            }
+            for percentile in &[1.0, 50.0, 99.0, 99.9] {
+                assert_eq!(
+                    bulk.percentile(0, *percentile),
+                    single.percentile(0, *percentile)
+                );
+            }
+        }
+    }
+
+    #[test]
+    fn size() {
+        let span = Duration::from_secs(60);
+        let second = Duration::from_secs(1);
+        for summary in &[
+            Summary::heatmap(1_000_000_000, 2, span, second),
+            Summary::stream(60, span).with_history(span * 5),
+            Summary::sketch(0.01, 128, span, second),
+        ] {
+            assert_eq!(summary.size(), summary.build().size());
+        }
+    }
+
+    #[test]
+    fn stream() {
+        let stream = Summary::stream(4, Duration::from_secs(4)).build();
+        assert_eq!(stream.percentile(0, 50.0), None);
+        for value in &[10, 20, 30, 40, 50] {
+            stream.record(0, *value, 1);
+        }
+        assert_eq!(stream.percentile(0, 1.0), Some(20));
+        assert_eq!(stream.percentile(0, 50.0), Some(30));
+        assert_eq!(stream.percentile(0, 100.0), Some(50));
+    }
+
+    #[test]
+    fn windows() {
+        let second = Duration::from_secs(1);
+        let minute = Duration::from_secs(60);
+        let nanos = 1_000_000_000;
+        let summaries = [
+            Summary::heatmap(1_000_000, 2, minute, second),
+            Summary::stream(60, minute),
+            Summary::sketch(0.02, 128, minute, second),
+        ];
+        for summary in &summaries {
+            let summary = summary.with_history(minute * 5).build();
+            // one value each second for five minutes, 10 in the first four
+            // minutes and 20 in the last
+            for time in 0..300 {
+                let value = if time < 240 { 10 } else { 20 };
+                summary.record(time * nanos, value, 1);
+            }
+            let now = 299 * nanos;
+            assert_eq!(summary.percentiles(now, None, &[1.0]), vec![Some(20)]);
+            let long = summary.percentiles(now, Some(minute * 5), &[50.0, 90.0]);
+            assert_eq!(long, vec![Some(10), Some(20)]);
+            // a window longer than the history is limited to the history
+            assert_eq!(
+                summary.percentiles(now, Some(minute * 10), &[50.0]),
+                vec![Some(10)]
+            );
+            assert_eq!(
+                summary.percentiles(now, Some(second * 10), &[1.0]),
+                vec![Some(20)]
+            );
+        }
+    }
+
+    #[test]
+    fn percentiles() {
+        let window = Duration::from_secs(60);
+        let second = Duration::from_secs(1);
+        let summaries = [
+            Summary::heatmap(1_000_000, 2, window, second),
+            Summary::stream(1_000, window),
+            Summary::sketch(0.02, 128, window, second),
+        ];
+        let percentiles = [99.9, 1.0, 50.0, 99.0, 10.0, 50.0, 100.0];
+        for summary in &summaries {
+            let summary = summary.build();
+            assert_eq!(summary.percentiles(0, None, &percentiles), vec![None; 7]);
+            for value in 0..1_000 {
+                summary.record(0, value * 37 % 1_000, 1);
+            }
+            // the same as calculating each percentile on its own
+            let expected: Vec<Option<u64>> = percentiles
+                .iter()
+                .map(|percentile| summary.percentile(0, *percentile))
+                .collect();
+            assert!(expected.iter().all(|value| value.is_some()));
+            assert_eq!(summary.percentiles(0, None, &percentiles), expected);
+        }
+    }
+}
@@ -2,20 +2,25 @@
 // Licensed under the Apache License, Version 2.0
 // http://www.apache.org/licenses/LICENSE-2.0
 
+use rustcommon_atomics::{AtomicBool, AtomicUsize};
 use serde_derive::Deserialize;
 use strum::IntoEnumIterator;
 
-use crate::config::SamplerConfig;
+use crate::config::{SamplerConfig, SummaryKind};
 
 use super::stat::*;
 
 #[derive(Debug, Deserialize)]
 #[serde(deny_unknown_fields)]
 pub struct CpuConfig {
+    #[serde(default = "crate::config::disabled")]
+    enabled: AtomicBool,
+    #[serde(default = "crate::config::unset_interval")]
+    interval: AtomicUsize,
     #[serde(default)]
-    enabled: bool,
+    priority: u8,
     #[serde(default)]
-    interval: Option<usize>,
+    summary: SummaryKind,
     #[serde(default = "crate::common::default_percentiles")]
     percentiles: Vec<f64>,
     #[serde(default)]
@@ -27,8 +32,10 @@ pub struct CpuConfig {
 impl Default for CpuConfig {
     fn default() -> Self {
         Self {
-            enabled: Default::default(),
-            interval: Default::default(),
+            enabled: crate::config::disabled(),
+            interval: crate::config::unset_interval(),
+            priority: Default::default(),
+            summary: Default::default(),
             percentiles: crate::common::default_percentiles(),
             perf_events: Default::default(),
             statistics: default_statistics(),
@@ -42,12 +49,14 @@ fn default_statistics() -> Vec<CpuStatistic> {
 
 impl SamplerConfig for CpuConfig {
     type Statistic = CpuStatistic;
-    fn enabled(&self) -> bool {
-        self.enabled
+    reloadable!();
+
+    fn priority(&self) -> u8 {
+        self.priority
     }
 
-    fn interval(&self) -> Option<usize> {
-        self.interval
+    fn summary(&self) -> SummaryKind {
+        self.summary
     }
 
     fn percentiles(&self) -> &[f64] {
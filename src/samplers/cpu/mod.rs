@@ -3,7 +3,6 @@
 // http://www.apache.org/licenses/LICENSE-2.0
 
 use std::collections::{HashMap, HashSet};
-use std::io::SeekFrom;
 use std::str::FromStr;
 use std::sync::{Arc, Mutex};
 use std::time::*;
@@ -14,10 +13,9 @@ use bcc::perf_event::{Event, SoftwareEvent};
 #[cfg(feature = "bpf")]
 use bcc::{PerfEvent, PerfEventArray};
 use regex::Regex;
-use tokio::fs::File;
-use tokio::io::{AsyncBufReadExt, AsyncReadExt, AsyncSeekExt, BufReader};
 
 use crate::common::bpf::BPF;
+use crate::common::procfs::{self, BatchReader, ProcFile};
 use crate::common::*;
 use crate::config::SamplerConfig;
 use crate::samplers::Common;
@@ -34,11 +32,13 @@ pub struct Cpu {
     common: Common,
     cpus: HashSet<String>,
     cstates: HashMap<String, String>,
-    cstate_files: HashMap<String, HashMap<String, File>>,
+    cstate_files: BatchReader,
+    // statistic for each file in `cstate_files`
+    cstate_stats: Vec<CpuStatistic>,
     perf: Option<Arc<Mutex<BPF>>>,
     tick_duration: u64,
-    proc_cpuinfo: Option<File>,
-    proc_stat: Option<File>,
+    proc_cpuinfo: Option<ProcFile>,
+    proc_stat: Option<ProcFile>,
     statistics: Vec<CpuStatistic>,
 }
 
@@ -51,6 +51,7 @@ pub fn nanos_per_tick() -> u64 {
 #[async_trait]
 impl Sampler for Cpu {
     type Statistic = CpuStatistic;
+    const NAME: &'static str = "cpu";
 
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let statistics = common.config().samplers().cpu().statistics();
@@ -59,7 +60,8 @@ impl Sampler for Cpu {
             common,
             cpus: HashSet::new(),
             cstates: HashMap::new(),
-            cstate_files: HashMap::new(),
+            cstate_files: BatchReader::new(),
+            cstate_stats: Vec::new(),
             perf: None,
             tick_duration: nanos_per_tick(),
             proc_cpuinfo: None,
@@ -94,12 +96,8 @@ impl Sampler for Cpu {
 
     fn spawn(common: Common) {
         if common.config().samplers().cpu().enabled() {
-            if let Ok(mut cpu) = Cpu::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = cpu.sample().await;
-                    }
-                });
+            if let Ok(cpu) = Cpu::new(common.clone()) {
+                common.runtime().spawn(cpu.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize cpu sampler");
             } else {
@@ -121,10 +119,6 @@ impl Sampler for Cpu {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
@@ -139,13 +133,13 @@ impl Sampler for Cpu {
             self.map_result(r)?;
         }
 
-        let r = self.sample_cpuinfo().await;
+        let r = self.sample_cpuinfo();
         self.map_result(r)?;
 
-        let r = self.sample_cpu_usage().await;
+        let r = self.sample_cpu_usage();
         self.map_result(r)?;
 
-        let r = self.sample_cstates().await;
+        let r = self.sample_cstates();
         self.map_result(r)?;
 
         Ok(())
@@ -155,7 +149,7 @@ impl Sampler for Cpu {
 impl Cpu {
     #[cfg(feature = "bpf")]
     fn initialize_bpf_perf(&mut self) -> Result<(), std::io::Error> {
-        let cpus = crate::common::hardware_threads().unwrap();
+        let cpus = crate::common::hardware_threads(self.general_config().sys_root()).unwrap();
         let interval = self.interval() as u64;
         let frequency = if interval > 1000 {
             1
@@ -165,11 +159,19 @@ impl Cpu {
             1000 / interval
         };
 
-        let code = format!(
-            "{}\n{}",
-            format!("#define NUM_CPU {}", cpus),
-            include_str!("perf.c").to_string()
-        );
+        // no counters are enabled, so there is nothing to attach
+        if !self.statistics.iter().any(|s| s.table().is_some()) {
+            return Ok(());
+        }
+
+        let mut code = format!("#define NUM_CPU {}\n", cpus);
+        for table in self.statistics.iter().filter_map(|s| s.table()) {
+            code.push_str(&format!(
+                "#define {}\n",
+                crate::common::bpf::enable_define(table)
+            ));
+        }
+        code.push_str(include_str!("perf.c"));
         if let Ok(mut bpf) = bcc::BPF::new(&code) {
             for statistic in &self.statistics {
                 if let Some(table) = statistic.table() {
@@ -212,24 +214,19 @@ impl Cpu {
         Ok(())
     }
 
-    async fn sample_cpu_usage(&mut self) -> Result<(), std::io::Error> {
+    fn sample_cpu_usage(&mut self) -> Result<(), std::io::Error> {
         if self.proc_stat.is_none() {
-            let file = File::open("/proc/stat").await?;
+            let file = ProcFile::open(self.proc_path("stat"))?;
             self.proc_stat = Some(file);
         }
 
         if let Some(file) = &mut self.proc_stat {
-            file.seek(SeekFrom::Start(0)).await?;
-
-            let mut reader = BufReader::new(file);
             let mut result = HashMap::new();
-            let mut buf = String::new();
-            while reader.read_line(&mut buf).await? > 0 {
-                result.extend(parse_proc_stat(&buf));
-                buf.clear();
+            for line in file.lines()? {
+                result.extend(parse_proc_stat(line));
             }
 
-            let time = Instant::now();
+            let time = self.common().timestamp();
             for stat in self.sampler_config().statistics() {
                 if let Some(value) = result.get(&stat) {
                     let _ = self
@@ -242,25 +239,21 @@ impl Cpu {
         Ok(())
     }
 
-    async fn sample_cpuinfo(&mut self) -> Result<(), std::io::Error> {
+    fn sample_cpuinfo(&mut self) -> Result<(), std::io::Error> {
         if self.proc_cpuinfo.is_none() {
-            let file = File::open("/proc/cpuinfo").await?;
+            let file = ProcFile::open(self.proc_path("cpuinfo"))?;
             self.proc_cpuinfo = Some(file);
         }
 
         if let Some(file) = &mut self.proc_cpuinfo {
-            file.seek(SeekFrom::Start(0)).await?;
-            let mut reader = BufReader::new(file);
-            let mut buf = String::new();
             let mut result = Vec::new();
-            while reader.read_line(&mut buf).await? > 0 {
-                if let Some(freq) = parse_frequency(&buf) {
+            for line in file.lines()? {
+                if let Some(freq) = parse_frequency(line) {
                     result.push(freq.ceil() as u64);
                 }
-                buf.clear();
             }
 
-            let time = Instant::now();
+            let time = self.common().timestamp();
             for frequency in result {
                 let _ = self
                     .metrics()
@@ -275,7 +268,7 @@ impl Cpu {
     fn sample_bpf_perf_counters(&self) -> Result<(), std::io::Error> {
         if let Some(ref bpf) = self.perf {
             let bpf = bpf.lock().unwrap();
-            let time = Instant::now();
+            let time = self.common().timestamp();
             for stat in self.statistics.iter().filter(|s| s.table().is_some()) {
                 if let Ok(table) = &(*bpf).inner.table(stat.table().unwrap()) {
                     let map = crate::common::bpf::perf_table_to_map(table);
@@ -290,14 +283,14 @@ impl Cpu {
         Ok(())
     }
 
-    async fn sample_cstates(&mut self) -> Result<(), std::io::Error> {
+    fn sample_cstates(&mut self) -> Result<(), std::io::Error> {
         let mut result = HashMap::<CpuStatistic, u64>::new();
 
         // populate the cpu cache if empty
         if self.cpus.is_empty() {
             let cpu_regex = Regex::new(r"^cpu\d+$").unwrap();
-            let mut cpu_dir = tokio::fs::read_dir("/sys/devices/system/cpu").await?;
-            while let Some(cpu_entry) = cpu_dir.next_entry().await? {
+            for cpu_entry in std::fs::read_dir(self.sys_path("devices/system/cpu"))? {
+                let cpu_entry = cpu_entry?;
                 if let Ok(cpu_name) = cpu_entry.file_name().into_string() {
                     if cpu_regex.is_match(&cpu_name) {
                         self.cpus.insert(cpu_name.to_string());
@@ -311,19 +304,17 @@ impl Cpu {
             let state_regex = Regex::new(r"^state\d+$").unwrap();
             for cpu in &self.cpus {
                 // iterate through all cpuidle states
-                let cpuidle_dir = format!("/sys/devices/system/cpu/{}/cpuidle", cpu);
-                let mut cpuidle_dir = tokio::fs::read_dir(cpuidle_dir).await?;
-                while let Some(cpuidle_entry) = cpuidle_dir.next_entry().await? {
+                let cpuidle_dir = self.sys_path(&format!("devices/system/cpu/{}/cpuidle", cpu));
+                for cpuidle_entry in std::fs::read_dir(cpuidle_dir)? {
+                    let cpuidle_entry = cpuidle_entry?;
                     if let Ok(cpuidle_name) = cpuidle_entry.file_name().into_string() {
                         if state_regex.is_match(&cpuidle_name) {
                             // get the name of the state
-                            let name_file = format!(
-                                "/sys/devices/system/cpu/{}/cpuidle/{}/name",
+                            let name_file = self.sys_path(&format!(
+                                "devices/system/cpu/{}/cpuidle/{}/name",
                                 cpu, cpuidle_name
-                            );
-                            let mut name_file = File::open(name_file).await?;
-                            let mut name_content = Vec::new();
-                            name_file.read_to_end(&mut name_content).await?;
+                            ));
+                            let name_content = std::fs::read(name_file)?;
                             if let Ok(name_string) = std::str::from_utf8(&name_content) {
                                 if let Some(Ok(state)) =
                                     name_string.split_whitespace().next().map(|v| v.parse())
@@ -337,46 +328,41 @@ impl Cpu {
             }
         }
 
-        for cpu in &self.cpus {
-            if !self.cstate_files.contains_key(cpu) {
-                self.cstate_files.insert(cpu.to_string(), HashMap::new());
-            }
-            if let Some(cpuidle_files) = self.cstate_files.get_mut(cpu) {
+        // open the time file of each state once, all of them are then read
+        // in a single batch each interval
+        if self.cstate_stats.is_empty() {
+            for cpu in &self.cpus {
                 for (cpuidle_name, state) in &self.cstates {
-                    if !cpuidle_files.contains_key(cpuidle_name) {
-                        let time_file = format!(
-                            "/sys/devices/system/cpu/{}/cpuidle/{}/time",
-                            cpu, cpuidle_name
-                        );
-                        let file = File::open(time_file).await?;
-                        cpuidle_files.insert(cpuidle_name.to_string(), file);
-                    }
-                    if let Some(file) = cpuidle_files.get_mut(cpuidle_name) {
-                        file.seek(SeekFrom::Start(0)).await?;
-                        let mut reader = BufReader::new(file);
-                        if let Ok(time) = reader.read_u64().await {
-                            if let Some(state) = state.split('-').next() {
-                                let metric = match CState::from_str(&state) {
-                                    Ok(CState::C0) => CpuStatistic::CstateC0Time,
-                                    Ok(CState::C1) => CpuStatistic::CstateC1Time,
-                                    Ok(CState::C1E) => CpuStatistic::CstateC1ETime,
-                                    Ok(CState::C2) => CpuStatistic::CstateC2Time,
-                                    Ok(CState::C3) => CpuStatistic::CstateC3Time,
-                                    Ok(CState::C6) => CpuStatistic::CstateC6Time,
-                                    Ok(CState::C7) => CpuStatistic::CstateC7Time,
-                                    Ok(CState::C8) => CpuStatistic::CstateC8Time,
-                                    _ => continue,
-                                };
-                                let counter = result.entry(metric).or_insert(0);
-                                *counter += time * MICROSECOND;
-                            }
-                        }
-                    }
+                    let metric = match state.split('-').next().map(CState::from_str) {
+                        Some(Ok(CState::C0)) => CpuStatistic::CstateC0Time,
+                        Some(Ok(CState::C1)) => CpuStatistic::CstateC1Time,
+                        Some(Ok(CState::C1E)) => CpuStatistic::CstateC1ETime,
+                        Some(Ok(CState::C2)) => CpuStatistic::CstateC2Time,
+                        Some(Ok(CState::C3)) => CpuStatistic::CstateC3Time,
+                        Some(Ok(CState::C6)) => CpuStatistic::CstateC6Time,
+                        Some(Ok(CState::C7)) => CpuStatistic::CstateC7Time,
+                        Some(Ok(CState::C8)) => CpuStatistic::CstateC8Time,
+                        _ => continue,
+                    };
+                    let time_file = self.sys_path(&format!(
+                        "devices/system/cpu/{}/cpuidle/{}/time",
+                        cpu, cpuidle_name
+                    ));
+                    self.cstate_files.add(time_file)?;
+                    self.cstate_stats.push(metric);
                 }
             }
         }
 
-        let time = Instant::now();
+        self.cstate_files.read();
+        for (index, metric) in self.cstate_stats.iter().enumerate() {
+            if let Some(time) = self.cstate_files.get_u64(index) {
+                let counter = result.entry(*metric).or_insert(0);
+                *counter += time * MICROSECOND;
+            }
+        }
+
+        let time = self.common().timestamp();
         for stat in &self.statistics {
             if let Some(value) = result.get(stat) {
                 let _ = self.metrics().record_counter(stat, time, *value);
@@ -387,41 +373,65 @@ impl Cpu {
     }
 }
 
-fn parse_proc_stat(line: &str) -> HashMap<CpuStatistic, u64> {
+fn parse_proc_stat(line: &[u8]) -> HashMap<CpuStatistic, u64> {
     let mut result = HashMap::new();
-    for (id, part) in line.split_whitespace().enumerate() {
+    for (id, part) in procfs::fields(line).enumerate() {
         match id {
             0 => {
-                if part != "cpu" {
+                if part != b"cpu" {
                     return result;
                 }
             }
             1 => {
-                result.insert(CpuStatistic::UsageUser, part.parse().unwrap_or(0));
+                result.insert(
+                    CpuStatistic::UsageUser,
+                    procfs::parse_u64(part).unwrap_or(0),
+                );
             }
             2 => {
-                result.insert(CpuStatistic::UsageNice, part.parse().unwrap_or(0));
+                result.insert(
+                    CpuStatistic::UsageNice,
+                    procfs::parse_u64(part).unwrap_or(0),
+                );
             }
             3 => {
-                result.insert(CpuStatistic::UsageSystem, part.parse().unwrap_or(0));
+                result.insert(
+                    CpuStatistic::UsageSystem,
+                    procfs::parse_u64(part).unwrap_or(0),
+                );
             }
             4 => {
-                result.insert(CpuStatistic::UsageIdle, part.parse().unwrap_or(0));
+                result.insert(
+                    CpuStatistic::UsageIdle,
+                    procfs::parse_u64(part).unwrap_or(0),
+                );
             }
             6 => {
-                result.insert(CpuStatistic::UsageIrq, part.parse().unwrap_or(0));
+                result.insert(CpuStatistic::UsageIrq, procfs::parse_u64(part).unwrap_or(0));
             }
             7 => {
-                result.insert(CpuStatistic::UsageSoftirq, part.parse().unwrap_or(0));
+                result.insert(
+                    CpuStatistic::UsageSoftirq,
+                    procfs::parse_u64(part).unwrap_or(0),
+                );
             }
             8 => {
-                result.insert(CpuStatistic::UsageSteal, part.parse().unwrap_or(0));
+                result.insert(
+                    CpuStatistic::UsageSteal,
+                    procfs::parse_u64(part).unwrap_or(0),
+                );
             }
             9 => {
-                result.insert(CpuStatistic::UsageGuest, part.parse().unwrap_or(0));
+                result.insert(
+                    CpuStatistic::UsageGuest,
+                    procfs::parse_u64(part).unwrap_or(0),
+                );
             }
             10 => {
-                result.insert(CpuStatistic::UsageGuestNice, part.parse().unwrap_or(0));
+                result.insert(
+                    CpuStatistic::UsageGuestNice,
+                    procfs::parse_u64(part).unwrap_or(0),
+                );
             }
             _ => {}
         }
@@ -429,10 +439,12 @@ fn parse_proc_stat(line: &str) -> HashMap<CpuStatistic, u64> {
     result
 }
 
-fn parse_frequency(line: &str) -> Option<f64> {
-    let mut split = line.split_whitespace();
-    if split.next() == Some("cpu") && split.next() == Some("MHz") {
-        split.last().map(|v| v.parse().unwrap_or(0.0) * 1_000_000.0)
+fn parse_frequency(line: &[u8]) -> Option<f64> {
+    let mut split = procfs::fields(line);
+    if split.next() == Some(b"cpu") && split.next() == Some(b"MHz") {
+        split
+            .last()
+            .map(|v| procfs::as_str(v).parse().unwrap_or(0.0) * 1_000_000.0)
     } else {
         None
     }
@@ -444,7 +456,7 @@ mod test {
 
     #[test]
     fn test_parse_proc_stat() {
-        let result = parse_proc_stat("cpu  131586 0 53564 8246483 35015 350665 4288 5632 0 0");
+        let result = parse_proc_stat(b"cpu  131586 0 53564 8246483 35015 350665 4288 5632 0 0");
         assert_eq!(result.len(), 9);
         assert_eq!(result.get(&CpuStatistic::UsageUser), Some(&131586));
         assert_eq!(result.get(&CpuStatistic::UsageNice), Some(&0));
@@ -453,7 +465,7 @@ mod test {
 
     #[test]
     fn test_parse_frequency() {
-        let result = parse_frequency("cpu MHz         : 1979.685");
+        let result = parse_frequency(b"cpu MHz         : 1979.685");
         assert_eq!(result, Some(1_979_685_000.0));
     }
 }
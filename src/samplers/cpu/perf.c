@@ -5,90 +5,144 @@
 #include <linux/ptrace.h>
 #include <uapi/linux/bpf_perf_event.h>
 
-// Arrays which hold the perf counters
-BPF_PERF_ARRAY(branch_instructions_array, NUM_CPU);
-BPF_PERF_ARRAY(branch_misses_array, NUM_CPU);
-BPF_PERF_ARRAY(cache_misses_array, NUM_CPU);
-BPF_PERF_ARRAY(cache_references_array, NUM_CPU);
-BPF_PERF_ARRAY(cycles_array, NUM_CPU);
-BPF_PERF_ARRAY(dtlb_load_miss_array, NUM_CPU);
-BPF_PERF_ARRAY(dtlb_load_access_array, NUM_CPU);
-BPF_PERF_ARRAY(dtlb_store_miss_array, NUM_CPU);
-BPF_PERF_ARRAY(dtlb_store_access_array, NUM_CPU);
-BPF_PERF_ARRAY(instructions_array, NUM_CPU);
-BPF_PERF_ARRAY(reference_cycles_array, NUM_CPU);
+// Each counter is only compiled in when its ENABLE_<TABLE> is defined, so
+// the arrays are only created and read for the enabled statistics.
 
-// Tables which are read in user space
+#ifdef ENABLE_BRANCH_INSTRUCTIONS
+BPF_PERF_ARRAY(branch_instructions_array, NUM_CPU);
 BPF_ARRAY(branch_instructions, u64, NUM_CPU);
+#endif
+
+#ifdef ENABLE_BRANCH_MISSES
+BPF_PERF_ARRAY(branch_misses_array, NUM_CPU);
 BPF_ARRAY(branch_misses, u64, NUM_CPU);
+#endif
+
+#ifdef ENABLE_CACHE_MISSES
+BPF_PERF_ARRAY(cache_misses_array, NUM_CPU);
 BPF_ARRAY(cache_misses, u64, NUM_CPU);
+#endif
+
+#ifdef ENABLE_CACHE_REFERENCES
+BPF_PERF_ARRAY(cache_references_array, NUM_CPU);
 BPF_ARRAY(cache_references, u64, NUM_CPU);
+#endif
+
+#ifdef ENABLE_CYCLES
+BPF_PERF_ARRAY(cycles_array, NUM_CPU);
 BPF_ARRAY(cycles, u64, NUM_CPU);
+#endif
+
+#ifdef ENABLE_DTLB_LOAD_ACCESS
+BPF_PERF_ARRAY(dtlb_load_access_array, NUM_CPU);
 BPF_ARRAY(dtlb_load_access, u64, NUM_CPU);
+#endif
+
+#ifdef ENABLE_DTLB_LOAD_MISS
+BPF_PERF_ARRAY(dtlb_load_miss_array, NUM_CPU);
 BPF_ARRAY(dtlb_load_miss, u64, NUM_CPU);
+#endif
+
+#ifdef ENABLE_DTLB_STORE_ACCESS
+BPF_PERF_ARRAY(dtlb_store_access_array, NUM_CPU);
 BPF_ARRAY(dtlb_store_access, u64, NUM_CPU);
+#endif
+
+#ifdef ENABLE_DTLB_STORE_MISS
+BPF_PERF_ARRAY(dtlb_store_miss_array, NUM_CPU);
 BPF_ARRAY(dtlb_store_miss, u64, NUM_CPU);
+#endif
+
+#ifdef ENABLE_INSTRUCTIONS
+BPF_PERF_ARRAY(instructions_array, NUM_CPU);
 BPF_ARRAY(instructions, u64, NUM_CPU);
+#endif
+
+#ifdef ENABLE_REFERENCE_CYCLES
+BPF_PERF_ARRAY(reference_cycles_array, NUM_CPU);
 BPF_ARRAY(reference_cycles, u64, NUM_CPU);
+#endif
 
 int do_count(struct bpf_perf_event_data *ctx) {
     u32 cpu = bpf_get_smp_processor_id();
     u64 count = 0;
 
+#ifdef ENABLE_BRANCH_INSTRUCTIONS
     count = branch_instructions_array.perf_read(CUR_CPU_IDENTIFIER);
     if ((s64)count < -256 || (s64)count > 0) {
         branch_instructions.update(&cpu, &count);
     }
+#endif
 
+#ifdef ENABLE_BRANCH_MISSES
     count = branch_misses_array.perf_read(CUR_CPU_IDENTIFIER);
     if ((s64)count < -256 || (s64)count > 0) {
         branch_misses.update(&cpu, &count);
     }
+#endif
 
+#ifdef ENABLE_CACHE_MISSES
     count = cache_misses_array.perf_read(CUR_CPU_IDENTIFIER);
     if ((s64)count < -256 || (s64)count > 0) {
         cache_misses.update(&cpu, &count);
     }
+#endif
 
+#ifdef ENABLE_CACHE_REFERENCES
     count = cache_references_array.perf_read(CUR_CPU_IDENTIFIER);
     if ((s64)count < -256 || (s64)count > 0) {
         cache_references.update(&cpu, &count);
     }
+#endif
 
+#ifdef ENABLE_CYCLES
     count = cycles_array.perf_read(CUR_CPU_IDENTIFIER);
     if ((s64)count < -256 || (s64)count > 0) {
         cycles.update(&cpu, &count);
     }
+#endif
 
+#ifdef ENABLE_DTLB_LOAD_ACCESS
     count = dtlb_load_access_array.perf_read(CUR_CPU_IDENTIFIER);
     if ((s64)count < -256 || (s64)count > 0) {
         dtlb_load_access.update(&cpu, &count);
     }
+#endif
 
+#ifdef ENABLE_DTLB_LOAD_MISS
     count = dtlb_load_miss_array.perf_read(CUR_CPU_IDENTIFIER);
     if ((s64)count < -256 || (s64)count > 0) {
         dtlb_load_miss.update(&cpu, &count);
     }
+#endif
 
+#ifdef ENABLE_DTLB_STORE_ACCESS
     count = dtlb_store_access_array.perf_read(CUR_CPU_IDENTIFIER);
     if ((s64)count < -256 || (s64)count > 0) {
         dtlb_store_access.update(&cpu, &count);
-    }    
+    }
+#endif
 
+#ifdef ENABLE_DTLB_STORE_MISS
     count = dtlb_store_miss_array.perf_read(CUR_CPU_IDENTIFIER);
     if ((s64)count < -256 || (s64)count > 0) {
         dtlb_store_miss.update(&cpu, &count);
     }
+#endif
 
+#ifdef ENABLE_INSTRUCTIONS
     count = instructions_array.perf_read(CUR_CPU_IDENTIFIER);
     if ((s64)count < -256 || (s64)count > 0) {
         instructions.update(&cpu, &count);
     }
+#endif
 
+#ifdef ENABLE_REFERENCE_CYCLES
     count = reference_cycles_array.perf_read(CUR_CPU_IDENTIFIER);
     if ((s64)count < -256 || (s64)count > 0) {
         reference_cycles.update(&cpu, &count);
     }
+#endif
 
     return 0;
 }
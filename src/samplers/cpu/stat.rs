@@ -8,11 +8,12 @@ use core::str::FromStr;
 #[cfg(feature = "bpf")]
 use bcc::perf_event::*;
 
-use rustcommon_metrics::*;
 use serde_derive::{Deserialize, Serialize};
 use strum::ParseError;
 use strum_macros::{EnumIter, EnumString, IntoStaticStr};
 
+use crate::metrics::*;
+
 #[derive(
     Clone,
     Copy,
@@ -96,7 +97,7 @@ impl TryFrom<&str> for CpuStatistic {
     }
 }
 
-impl Statistic<AtomicU64, AtomicU32> for CpuStatistic {
+impl Statistic for CpuStatistic {
     fn name(&self) -> &str {
         (*self).into()
     }
@@ -5,26 +5,26 @@
 #include <uapi/linux/ptrace.h>
 #include <linux/blkdev.h>
 
-struct val_t {
+struct NS(val_t) {
     char name[TASK_COMM_LEN];
 };
 
 // hashes to track request details
-BPF_HASH(queue_start, struct request *);
-BPF_HASH(request_start, struct request *);
-BPF_HASH(commbyreq, struct request *, struct val_t);
+BPF_HASH(NS(queue_start), struct request *);
+BPF_HASH(NS(request_start), struct request *);
+BPF_HASH(NS(commbyreq), struct request *, struct NS(val_t));
 
 // value_to_index2() gives us from 0-460 as the index
-BPF_HISTOGRAM(io_size_read, int, 461);
-BPF_HISTOGRAM(latency_read, int, 461);
-BPF_HISTOGRAM(device_latency_read, int, 461);
-BPF_HISTOGRAM(queue_latency_read, int, 461);
-BPF_HISTOGRAM(io_size_write, int, 461);
-BPF_HISTOGRAM(latency_write, int, 461);
-BPF_HISTOGRAM(device_latency_write, int, 461);
-BPF_HISTOGRAM(queue_latency_write, int, 461);
+BPF_HISTOGRAM(NS(io_size_read), int, 461);
+BPF_HISTOGRAM(NS(latency_read), int, 461);
+BPF_HISTOGRAM(NS(device_latency_read), int, 461);
+BPF_HISTOGRAM(NS(queue_latency_read), int, 461);
+BPF_HISTOGRAM(NS(io_size_write), int, 461);
+BPF_HISTOGRAM(NS(latency_write), int, 461);
+BPF_HISTOGRAM(NS(device_latency_write), int, 461);
+BPF_HISTOGRAM(NS(queue_latency_write), int, 461);
 // histogram indexing
-static unsigned int value_to_index2(unsigned int value) {
+static unsigned int NS(value_to_index2)(unsigned int value) {
     unsigned int index = 460;
     if (value < 100) {
         // 0-99 => [0..100)
@@ -57,18 +57,18 @@ static unsigned int value_to_index2(unsigned int value) {
     return index;
 }
 
-int trace_pid_start(struct pt_regs *ctx, struct request *req)
+int NS(trace_pid_start)(struct pt_regs *ctx, struct request *req)
 {
-    struct val_t val = {};
+    struct NS(val_t) val = {};
     if (bpf_get_current_comm(&val.name, sizeof(val.name)) == 0) {
         u64 ts = bpf_ktime_get_ns();
-        queue_start.update(&req, &ts);
-        commbyreq.update(&req, &val);
+        NS(queue_start).update(&req, &ts);
+        NS(commbyreq).update(&req, &val);
     }
     return 0;
 }
 
-int trace_req_start(struct pt_regs *ctx, struct request *req)
+int NS(trace_req_start)(struct pt_regs *ctx, struct request *req)
 {
     u64 now = bpf_ktime_get_ns();
 
@@ -82,20 +82,20 @@ int trace_req_start(struct pt_regs *ctx, struct request *req)
     #endif
 
     u64 *enqueued;
-    enqueued = queue_start.lookup(&req);
+    enqueued = NS(queue_start).lookup(&req);
     if (enqueued != 0) {
-        unsigned int index = value_to_index2((now - *enqueued) / 1000);
+        unsigned int index = NS(value_to_index2)((now - *enqueued) / 1000);
         if (rwflag == 1) {
-            queue_latency_write.increment(index);
+            NS(queue_latency_write).increment(index);
         } else {
-            queue_latency_read.increment(index);
+            NS(queue_latency_read).increment(index);
         }
     }
-    request_start.update(&req, &now);
+    NS(request_start).update(&req, &now);
     return 0;
 }
 
-int do_count(struct pt_regs *ctx, struct request *req)
+int NS(do_count)(struct pt_regs *ctx, struct request *req)
 {
     u64 now = bpf_ktime_get_ns();
 
@@ -109,18 +109,18 @@ int do_count(struct pt_regs *ctx, struct request *req)
     #endif
 
     // Size
-    struct val_t *valp;
-    valp = commbyreq.lookup(&req);
+    struct NS(val_t) *valp;
+    valp = NS(commbyreq).lookup(&req);
     if (valp == 0) {
        return 0;
     }
     u64 delta = req->__data_len / 1024;
-    unsigned int index = value_to_index2(delta);
+    unsigned int index = NS(value_to_index2)(delta);
     if (req->__data_len > 0) {
         if (rwflag == 1) {
-            io_size_write.increment(index);
+            NS(io_size_write).increment(index);
         } else {
-            io_size_read.increment(index);
+            NS(io_size_read).increment(index);
         }
     }
 
@@ -128,24 +128,24 @@ int do_count(struct pt_regs *ctx, struct request *req)
     u64 *enqueued, *requested;
 
     // total latency including queued time
-    enqueued = queue_start.lookup(&req);
+    enqueued = NS(queue_start).lookup(&req);
     if (enqueued != 0) {
-        unsigned int index = value_to_index2((now - *enqueued) / 1000);
+        unsigned int index = NS(value_to_index2)((now - *enqueued) / 1000);
         if (rwflag == 1) {
-            latency_write.increment(index);
+            NS(latency_write).increment(index);
         } else {
-            latency_read.increment(index);
+            NS(latency_read).increment(index);
         }
     }
 
     // request latency not including queued time
-    requested = request_start.lookup(&req);
+    requested = NS(request_start).lookup(&req);
     if (requested != 0) {
-        unsigned int index = value_to_index2((now - *requested) / 1000);
+        unsigned int index = NS(value_to_index2)((now - *requested) / 1000);
         if (rwflag == 1) {
-            device_latency_write.increment(index);
+            NS(device_latency_write).increment(index);
         } else {
-            device_latency_read.increment(index);
+            NS(device_latency_read).increment(index);
         }
     }
 
@@ -2,10 +2,11 @@
 // Licensed under the Apache License, Version 2.0
 // http://www.apache.org/licenses/LICENSE-2.0
 
+use rustcommon_atomics::{AtomicBool, AtomicUsize};
 use serde_derive::Deserialize;
 use strum::IntoEnumIterator;
 
-use crate::config::SamplerConfig;
+use crate::config::{SamplerConfig, SummaryKind};
 
 use super::stat::*;
 
@@ -14,10 +15,14 @@ use super::stat::*;
 pub struct DiskConfig {
     #[serde(default)]
     bpf: bool,
+    #[serde(default = "crate::config::disabled")]
+    enabled: AtomicBool,
+    #[serde(default = "crate::config::unset_interval")]
+    interval: AtomicUsize,
     #[serde(default)]
-    enabled: bool,
+    priority: u8,
     #[serde(default)]
-    interval: Option<usize>,
+    summary: SummaryKind,
     #[serde(default = "crate::common::default_percentiles")]
     percentiles: Vec<f64>,
     #[serde(default = "default_statistics")]
@@ -28,8 +33,10 @@ impl Default for DiskConfig {
     fn default() -> Self {
         Self {
             bpf: Default::default(),
-            enabled: Default::default(),
-            interval: Default::default(),
+            enabled: crate::config::disabled(),
+            interval: crate::config::unset_interval(),
+            priority: Default::default(),
+            summary: Default::default(),
             percentiles: crate::common::default_percentiles(),
             statistics: default_statistics(),
         }
@@ -47,12 +54,14 @@ impl SamplerConfig for DiskConfig {
         self.bpf
     }
 
-    fn enabled(&self) -> bool {
-        self.enabled
+    reloadable!();
+
+    fn priority(&self) -> u8 {
+        self.priority
     }
 
-    fn interval(&self) -> Option<usize> {
-        self.interval
+    fn summary(&self) -> SummaryKind {
+        self.summary
     }
 
     fn percentiles(&self) -> &[f64] {
@@ -3,17 +3,16 @@
 // http://www.apache.org/licenses/LICENSE-2.0
 
 use std::collections::HashMap;
-use std::io::SeekFrom;
 use std::sync::{Arc, Mutex};
 use std::time::*;
 
 use async_trait::async_trait;
 use regex::Regex;
-use tokio::fs::File;
-use tokio::io::{AsyncBufReadExt, AsyncSeekExt, BufReader};
 
 use crate::common::bpf::*;
+use crate::common::procfs::{self, ProcFile};
 use crate::config::SamplerConfig;
+use crate::metrics::Handle;
 use crate::samplers::Common;
 use crate::Sampler;
 
@@ -25,17 +24,19 @@ pub use stat::*;
 
 #[allow(dead_code)]
 pub struct Disk {
-    bpf: Option<Arc<Mutex<BPF>>>,
+    bpf: Option<BpfHandle>,
     bpf_last: Arc<Mutex<Instant>>,
     common: Common,
-    proc_diskstats: Option<File>,
+    proc_diskstats: Option<ProcFile>,
     disk_regex: Option<Regex>,
+    handles: Vec<Handle>,
     statistics: Vec<DiskStatistic>,
 }
 
 #[async_trait]
 impl Sampler for Disk {
     type Statistic = DiskStatistic;
+    const NAME: &'static str = "disk";
 
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let fault_tolerant = common.config.general().fault_tolerant();
@@ -48,6 +49,7 @@ impl Sampler for Disk {
             common,
             proc_diskstats: None,
             disk_regex: None,
+            handles: Vec::new(),
             statistics,
         };
 
@@ -60,6 +62,11 @@ impl Sampler for Disk {
 
         if sampler.sampler_config().enabled() {
             sampler.register();
+            #[cfg(feature = "bpf")]
+            {
+                sampler.handles =
+                    sampler.resolve_histograms(&sampler.statistics, crate::MICROSECOND);
+            }
         }
 
         Ok(sampler)
@@ -67,12 +74,8 @@ impl Sampler for Disk {
 
     fn spawn(common: Common) {
         if common.config().samplers().disk().enabled() {
-            if let Ok(mut sampler) = Self::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = sampler.sample().await;
-                    }
-                });
+            if let Ok(sampler) = Self::new(common.clone()) {
+                common.runtime().spawn(sampler.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize disk sampler");
             } else {
@@ -94,17 +97,13 @@ impl Sampler for Disk {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
 
         debug!("sampling");
 
-        let r = self.sample_diskstats().await;
+        let r = self.sample_diskstats();
         self.map_result(r)?;
         #[cfg(feature = "bpf")]
         self.map_result(self.sample_bpf())?;
@@ -134,47 +133,25 @@ impl Disk {
                 debug!("initializing bpf");
                 // load the code and compile
                 let code = include_str!("bpf.c");
-                let mut bpf = bcc::BPF::new(code)?;
                 // load + attach kprobes!
-                bcc::Kprobe::new()
-                    .handler("trace_pid_start")
-                    .function("blk_account_io_start")
-                    .attach(&mut bpf)?;
-                if let Ok(results) = bpf.get_kprobe_functions("blk_start_request") {
-                    if !results.is_empty() {
-                        bcc::Kprobe::new()
-                            .handler("trace_req_start")
-                            .function("blk_start_request")
-                            .attach(&mut bpf)?;
-                    }
-                }
-                bcc::Kprobe::new()
-                    .handler("trace_req_start")
-                    .function("blk_mq_start_request")
-                    .attach(&mut bpf)?;
-                if let Ok(results) = bpf.get_kprobe_functions("blk_account_io_completion") {
-                    if !results.is_empty() {
-                        bcc::Kprobe::new()
-                            .handler("do_count")
-                            .function("blk_account_io_completion")
-                            .attach(&mut bpf)?;
-                    } else {
-                        bcc::Kprobe::new()
-                            .handler("do_count")
-                            .function("blk_account_io_done")
-                            .attach(&mut bpf)?;
-                    }
-                }
-                self.bpf = Some(Arc::new(Mutex::new(BPF { inner: bpf })));
+                let program = BpfProgram::new("disk", code)
+                    .kprobe("trace_pid_start", "blk_account_io_start")
+                    .kprobe_optional("trace_req_start", "blk_start_request")
+                    .kprobe("trace_req_start", "blk_mq_start_request")
+                    .kprobe_first(
+                        "do_count",
+                        &["blk_account_io_completion", "blk_account_io_done"],
+                    );
+                self.bpf = Some(self.common.bpf().load(program)?);
             }
         }
 
         Ok(())
     }
 
-    async fn sample_diskstats(&mut self) -> Result<(), std::io::Error> {
+    fn sample_diskstats(&mut self) -> Result<(), std::io::Error> {
         if self.proc_diskstats.is_none() {
-            let file = File::open("/proc/diskstats").await?;
+            let file = ProcFile::open(self.proc_path("diskstats"))?;
             self.proc_diskstats = Some(file);
         }
 
@@ -185,15 +162,12 @@ impl Disk {
         }
 
         if let Some(file) = &mut self.proc_diskstats {
-            file.seek(SeekFrom::Start(0)).await?;
             if let Some(re) = &mut self.disk_regex {
-                let mut reader = BufReader::new(file);
-                let mut line = String::new();
                 let mut result = HashMap::<DiskStatistic, u64>::new();
-                while reader.read_line(&mut line).await? > 0 {
-                    let parts: Vec<&str> = line.split_whitespace().collect();
-                    if re.is_match(parts.get(2).unwrap_or(&"unknown")) {
-                        for (id, part) in parts.iter().enumerate() {
+                for line in file.lines()? {
+                    let device = procfs::fields(line).nth(2).map(procfs::as_str);
+                    if re.is_match(device.unwrap_or("unknown")) {
+                        for (id, part) in procfs::fields(line).enumerate() {
                             if let Some(statistic) = match id {
                                 3 => Some(DiskStatistic::OperationsRead),
                                 5 => Some(DiskStatistic::BandwidthRead),
@@ -205,13 +179,12 @@ impl Disk {
                             } {
                                 result.entry(statistic).or_insert(0);
                                 let current = result.get_mut(&statistic).unwrap();
-                                *current += part.parse().unwrap_or(0);
+                                *current += procfs::parse_u64(part).unwrap_or(0);
                             }
                         }
                     }
-                    line.clear();
                 }
-                let time = Instant::now();
+                let time = self.common().timestamp();
                 for stat in &self.statistics {
                     if let Some(value) = result.get(stat) {
                         let value = match stat {
@@ -235,21 +208,18 @@ impl Disk {
         if self.bpf_last.lock().unwrap().elapsed()
             >= Duration::new(self.general_config().window().try_into().unwrap(), 0)
         {
-            let time = Instant::now();
+            let time = self.common().timestamp();
             if let Some(ref bpf) = self.bpf {
-                let bpf = bpf.lock().unwrap();
-                for statistic in self.statistics.iter().filter(|s| s.bpf_table().is_some()) {
-                    if let Ok(mut table) = (*bpf).inner.table(statistic.bpf_table().unwrap()) {
-                        for (&value, &count) in &map_from_table(&mut table) {
-                            if count > 0 {
-                                let _ = self.metrics().record_bucket(
-                                    statistic,
-                                    time,
-                                    value * crate::MICROSECOND,
-                                    count,
-                                );
-                            }
-                        }
+                for (statistic, handle) in self
+                    .statistics
+                    .iter()
+                    .zip(&self.handles)
+                    .filter(|(s, _)| s.bpf_table().is_some())
+                {
+                    if let Some(counts) =
+                        bpf.with_table(statistic.bpf_table().unwrap(), histogram_from_table)
+                    {
+                        handle.record_histogram(time, &counts);
                     }
                 }
             }
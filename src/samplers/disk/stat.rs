@@ -5,11 +5,12 @@
 use core::convert::TryFrom;
 use core::str::FromStr;
 
-use rustcommon_metrics::*;
 use serde_derive::{Deserialize, Serialize};
 use strum::ParseError;
 use strum_macros::{EnumIter, EnumString, IntoStaticStr};
 
+use crate::metrics::*;
+
 #[derive(
     Clone,
     Copy,
@@ -71,7 +72,7 @@ impl DiskStatistic {
     }
 }
 
-impl Statistic<AtomicU64, AtomicU32> for DiskStatistic {
+impl Statistic for DiskStatistic {
     fn name(&self) -> &str {
         (*self).into()
     }
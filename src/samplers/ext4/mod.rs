@@ -9,6 +9,7 @@ use async_trait::async_trait;
 
 use crate::common::bpf::*;
 use crate::config::SamplerConfig;
+use crate::metrics::Handle;
 use crate::samplers::Common;
 use crate::Sampler;
 
@@ -20,15 +21,17 @@ pub use stat::*;
 
 #[allow(dead_code)]
 pub struct Ext4 {
-    bpf: Option<Arc<Mutex<BPF>>>,
+    bpf: Option<BpfHandle>,
     bpf_last: Arc<Mutex<Instant>>,
     common: Common,
+    handles: Vec<Handle>,
     statistics: Vec<Ext4Statistic>,
 }
 
 #[async_trait]
 impl Sampler for Ext4 {
     type Statistic = Ext4Statistic;
+    const NAME: &'static str = "ext4";
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let fault_tolerant = common.config.general().fault_tolerant();
         let statistics = common.config().samplers().ext4().statistics();
@@ -38,6 +41,7 @@ impl Sampler for Ext4 {
             bpf: None,
             bpf_last: Arc::new(Mutex::new(Instant::now())),
             common,
+            handles: Vec::new(),
             statistics,
         };
 
@@ -50,6 +54,11 @@ impl Sampler for Ext4 {
 
         if sampler.sampler_config().enabled() {
             sampler.register();
+            #[cfg(feature = "bpf")]
+            {
+                sampler.handles =
+                    sampler.resolve_histograms(&sampler.statistics, crate::MICROSECOND);
+            }
         }
 
         Ok(sampler)
@@ -57,12 +66,8 @@ impl Sampler for Ext4 {
 
     fn spawn(common: Common) {
         if common.config().samplers().ext4().enabled() {
-            if let Ok(mut sampler) = Self::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = sampler.sample().await;
-                    }
-                });
+            if let Ok(sampler) = Self::new(common.clone()) {
+                common.runtime().spawn(sampler.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize ext4 sampler");
             } else {
@@ -84,10 +89,6 @@ impl Sampler for Ext4 {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
@@ -126,43 +127,31 @@ impl Ext4 {
                 let addr = "0x".to_string()
                     + &crate::common::bpf::symbol_lookup("ext4_file_operations").unwrap();
                 let code = code.replace("EXT4_FILE_OPERATIONS", &addr);
-                let mut bpf = bcc::BPF::new(&code)?;
-
-                // load + attach kprobes!
-                bcc::Kprobe::new()
-                    .handler("trace_read_entry")
-                    .function("generic_file_read_iter")
-                    .attach(&mut bpf)?;
-                bcc::Kprobe::new()
-                    .handler("trace_entry")
-                    .function("ext4_file_write_iter")
-                    .attach(&mut bpf)?;
-                bcc::Kprobe::new()
-                    .handler("trace_entry")
-                    .function("ext4_file_open")
-                    .attach(&mut bpf)?;
-                bcc::Kprobe::new()
-                    .handler("trace_entry")
-                    .function("ext4_sync_file")
-                    .attach(&mut bpf)?;
-                bcc::Kretprobe::new()
-                    .handler("trace_read_return")
-                    .function("generic_file_read_iter")
-                    .attach(&mut bpf)?;
-                bcc::Kretprobe::new()
-                    .handler("trace_write_return")
-                    .function("ext4_file_write_iter")
-                    .attach(&mut bpf)?;
-                bcc::Kretprobe::new()
-                    .handler("trace_open_return")
-                    .function("ext4_file_open")
-                    .attach(&mut bpf)?;
-                bcc::Kretprobe::new()
-                    .handler("trace_fsync_return")
-                    .function("ext4_sync_file")
-                    .attach(&mut bpf)?;
-
-                self.bpf = Some(Arc::new(Mutex::new(BPF { inner: bpf })));
+                // only attach the probes for enabled statistics
+                let mut program = BpfProgram::new("ext4", &code);
+                for statistic in &self.statistics {
+                    let table = statistic.bpf_table().unwrap();
+                    program = match statistic {
+                        Ext4Statistic::ReadLatency => program
+                            .enable(table)
+                            .kprobe("trace_read_entry", "generic_file_read_iter")
+                            .kretprobe("trace_read_return", "generic_file_read_iter"),
+                        Ext4Statistic::WriteLatency => program
+                            .enable(table)
+                            .kprobe("trace_entry", "ext4_file_write_iter")
+                            .kretprobe("trace_write_return", "ext4_file_write_iter"),
+                        Ext4Statistic::OpenLatency => program
+                            .enable(table)
+                            .kprobe("trace_entry", "ext4_file_open")
+                            .kretprobe("trace_open_return", "ext4_file_open"),
+                        Ext4Statistic::FsyncLatency => program
+                            .enable(table)
+                            .kprobe("trace_entry", "ext4_sync_file")
+                            .kretprobe("trace_fsync_return", "ext4_sync_file"),
+                    };
+                }
+
+                self.bpf = Some(self.common.bpf().load(program)?);
             }
         }
 
@@ -175,20 +164,17 @@ impl Ext4 {
             >= Duration::new(self.general_config().window() as u64, 0)
         {
             if let Some(ref bpf) = self.bpf {
-                let bpf = bpf.lock().unwrap();
-                let time = Instant::now();
-                for statistic in self.statistics.iter().filter(|s| s.bpf_table().is_some()) {
-                    if let Ok(mut table) = (*bpf).inner.table(statistic.bpf_table().unwrap()) {
-                        for (&value, &count) in &map_from_table(&mut table) {
-                            if count > 0 {
-                                let _ = self.metrics().record_bucket(
-                                    statistic,
-                                    time,
-                                    value * crate::MICROSECOND,
-                                    count,
-                                );
-                            }
-                        }
+                let time = self.common().timestamp();
+                for (statistic, handle) in self
+                    .statistics
+                    .iter()
+                    .zip(&self.handles)
+                    .filter(|(s, _)| s.bpf_table().is_some())
+                {
+                    if let Some(counts) =
+                        bpf.with_table(statistic.bpf_table().unwrap(), histogram_from_table)
+                    {
+                        handle.record_histogram(time, &counts);
                     }
                 }
             }
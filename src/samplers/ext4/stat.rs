@@ -5,11 +5,12 @@
 use core::convert::TryFrom;
 use core::str::FromStr;
 
-use rustcommon_metrics::*;
 use serde_derive::{Deserialize, Serialize};
 use strum::ParseError;
 use strum_macros::{EnumIter, EnumString, IntoStaticStr};
 
+use crate::metrics::*;
+
 #[derive(
     Clone,
     Copy,
@@ -47,7 +48,7 @@ impl Ext4Statistic {
     }
 }
 
-impl Statistic<AtomicU64, AtomicU32> for Ext4Statistic {
+impl Statistic for Ext4Statistic {
     fn name(&self) -> &str {
         (*self).into()
     }
@@ -2,9 +2,10 @@
 // Licensed under the Apache License, Version 2.0
 // http://www.apache.org/licenses/LICENSE-2.0
 
+use rustcommon_atomics::{AtomicBool, AtomicUsize};
 use serde_derive::Deserialize;
 
-use crate::config::SamplerConfig;
+use crate::config::{SamplerConfig, SummaryKind};
 
 use super::stat::*;
 
@@ -12,11 +13,15 @@ use super::stat::*;
 #[serde(deny_unknown_fields)]
 pub struct HttpConfig {
     counters: Vec<String>,
-    #[serde(default)]
-    enabled: bool,
+    #[serde(default = "crate::config::disabled")]
+    enabled: AtomicBool,
     gauges: Vec<String>,
+    #[serde(default = "crate::config::unset_interval")]
+    interval: AtomicUsize,
+    #[serde(default)]
+    priority: u8,
     #[serde(default)]
-    interval: Option<usize>,
+    summary: SummaryKind,
     #[serde(default)]
     passthrough: bool,
     #[serde(default = "crate::common::default_percentiles")]
@@ -28,9 +33,11 @@ impl Default for HttpConfig {
     fn default() -> Self {
         Self {
             counters: Vec::new(),
-            enabled: Default::default(),
+            enabled: crate::config::disabled(),
             gauges: Vec::new(),
-            interval: Default::default(),
+            interval: crate::config::unset_interval(),
+            priority: Default::default(),
+            summary: Default::default(),
             passthrough: Default::default(),
             percentiles: crate::common::default_percentiles(),
             url: None,
@@ -66,12 +73,14 @@ impl HttpConfig {
 impl SamplerConfig for HttpConfig {
     type Statistic = HttpStatistic;
 
-    fn enabled(&self) -> bool {
-        self.enabled
+    reloadable!();
+
+    fn priority(&self) -> u8 {
+        self.priority
     }
 
-    fn interval(&self) -> Option<usize> {
-        self.interval
+    fn summary(&self) -> SummaryKind {
+        self.summary
     }
 
     fn percentiles(&self) -> &[f64] {
@@ -3,12 +3,11 @@
 // http://www.apache.org/licenses/LICENSE-2.0
 
 use std::io::{Error, ErrorKind};
-use std::time::*;
 
 use async_trait::async_trait;
-use rustcommon_metrics::*;
 
 use crate::config::*;
+use crate::metrics::*;
 use crate::samplers::Common;
 use crate::Sampler;
 
@@ -19,7 +18,7 @@ pub use config::*;
 pub use stat::*;
 
 pub struct Http {
-    client: reqwest::blocking::Client,
+    client: reqwest::Client,
     common: Common,
     passthrough: bool,
     url: Option<String>,
@@ -28,6 +27,7 @@ pub struct Http {
 #[async_trait]
 impl Sampler for Http {
     type Statistic = HttpStatistic;
+    const NAME: &'static str = "http";
 
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let url = common.config.samplers().http().url();
@@ -35,7 +35,7 @@ impl Sampler for Http {
         if url.is_none() && common.config.samplers().http().enabled() {
             return Err(format_err!("no http url configured"));
         }
-        let client = reqwest::blocking::Client::new();
+        let client = reqwest::Client::new();
         let ret = Self {
             client,
             common,
@@ -47,12 +47,8 @@ impl Sampler for Http {
 
     fn spawn(common: Common) {
         if common.config().samplers().http().enabled() {
-            if let Ok(mut sampler) = Self::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = sampler.sample().await;
-                    }
-                });
+            if let Ok(sampler) = Self::new(common.clone()) {
+                common.runtime().spawn(sampler.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize http sampler");
             } else {
@@ -74,10 +70,6 @@ impl Sampler for Http {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
@@ -89,9 +81,9 @@ impl Sampler for Http {
             ));
         }
 
-        let time = Instant::now();
-        if let Ok(response) = self.client.get(self.url.as_ref().unwrap()).send() {
-            if let Ok(body) = response.text() {
+        let time = self.common().timestamp();
+        if let Ok(response) = self.client.get(self.url.as_ref().unwrap()).send().await {
+            if let Ok(body) = response.text().await {
                 if let Ok(json) = json::parse(&body) {
                     let mut statistics = std::collections::HashMap::new();
                     for counter in self.common.config().samplers().http().counters() {
@@ -109,45 +101,21 @@ impl Sampler for Http {
                     for (key, value) in json.entries() {
                         if let Some(value) = value.as_u64() {
                             if let Some(statistic) = statistics.get(key) {
-                                self.common().metrics().register(statistic);
-                                self.common()
-                                    .metrics()
-                                    .add_summary(statistic, Summary::stream(self.samples()));
-                                if self.passthrough {
-                                    self.common()
-                                        .metrics()
-                                        .add_output(statistic, Output::Reading);
-                                }
-                                for percentile in self.sampler_config().percentiles() {
-                                    self.common()
-                                        .metrics()
-                                        .add_output(statistic, Output::Percentile(*percentile));
-                                }
-                                match statistic.source() {
-                                    Source::Counter => {
-                                        let _ = self
-                                            .common()
-                                            .metrics()
-                                            .record_counter(statistic, time, value);
-                                    }
-                                    Source::Gauge => {
-                                        let _ = self
-                                            .common()
-                                            .metrics()
-                                            .record_gauge(statistic, time, value);
+                                if let Some(handle) =
+                                    self.register_dynamic(statistic, self.passthrough, true)
+                                {
+                                    match statistic.source() {
+                                        Source::Counter => handle.record_counter(time, value),
+                                        Source::Gauge => handle.record_gauge(time, value),
+                                        _ => unimplemented!(),
                                     }
-                                    _ => unimplemented!(),
                                 }
                             } else if self.passthrough {
                                 let statistic = HttpStatistic::new(key.to_string(), Source::Gauge);
-                                self.common().metrics().register(&statistic);
-                                self.common()
-                                    .metrics()
-                                    .add_output(&statistic, Output::Reading);
-                                let _ = self
-                                    .common()
-                                    .metrics()
-                                    .record_gauge(&statistic, time, value);
+                                if let Some(handle) = self.register_dynamic(&statistic, true, false)
+                                {
+                                    handle.record_gauge(time, value);
+                                }
                             }
                         }
                     }
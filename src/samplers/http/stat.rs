@@ -2,8 +2,8 @@
 // Licensed under the Apache License, Version 2.0
 // http://www.apache.org/licenses/LICENSE-2.0
 
+use crate::metrics::*;
 use crate::Statistic;
-use rustcommon_metrics::*;
 
 // #[derive(Eq, PartialEq, Hash)]
 pub struct HttpStatistic {
@@ -17,7 +17,7 @@ impl HttpStatistic {
     }
 }
 
-impl Statistic<AtomicU64, AtomicU32> for HttpStatistic {
+impl Statistic for HttpStatistic {
     fn name(&self) -> &str {
         &self.name
     }
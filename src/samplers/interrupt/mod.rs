@@ -5,14 +5,13 @@
 use std::collections::HashMap;
 use std::sync::{Arc, Mutex};
 use std::time::*;
-use tokio::io::SeekFrom;
 
 use async_trait::async_trait;
-use tokio::fs::File;
-use tokio::io::{AsyncBufReadExt, AsyncSeekExt, BufReader};
 
 use crate::common::bpf::*;
+use crate::common::procfs::{self, ProcFile};
 use crate::config::SamplerConfig;
+use crate::metrics::Handle;
 use crate::samplers::Common;
 use crate::Sampler;
 
@@ -24,16 +23,18 @@ pub use stat::*;
 
 #[allow(dead_code)]
 pub struct Interrupt {
-    bpf: Option<Arc<Mutex<BPF>>>,
+    bpf: Option<BpfHandle>,
     bpf_last: Arc<Mutex<Instant>>,
     common: Common,
-    proc_interrupts: Option<File>,
+    proc_interrupts: Option<ProcFile>,
+    handles: Vec<Handle>,
     statistics: Vec<InterruptStatistic>,
 }
 
 #[async_trait]
 impl Sampler for Interrupt {
     type Statistic = InterruptStatistic;
+    const NAME: &'static str = "interrupt";
 
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let fault_tolerant = common.config.general().fault_tolerant();
@@ -45,6 +46,7 @@ impl Sampler for Interrupt {
             bpf_last: Arc::new(Mutex::new(Instant::now())),
             common,
             proc_interrupts: None,
+            handles: Vec::new(),
             statistics,
         };
 
@@ -57,6 +59,11 @@ impl Sampler for Interrupt {
 
         if sampler.sampler_config().enabled() {
             sampler.register();
+            #[cfg(feature = "bpf")]
+            {
+                sampler.handles =
+                    sampler.resolve_histograms(&sampler.statistics, crate::MICROSECOND);
+            }
         }
 
         Ok(sampler)
@@ -64,12 +71,8 @@ impl Sampler for Interrupt {
 
     fn spawn(common: Common) {
         if common.config().samplers().interrupt().enabled() {
-            if let Ok(mut interrupt) = Interrupt::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = interrupt.sample().await;
-                    }
-                });
+            if let Ok(interrupt) = Interrupt::new(common.clone()) {
+                common.runtime().spawn(interrupt.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize interrupt sampler");
             } else {
@@ -91,17 +94,13 @@ impl Sampler for Interrupt {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
 
         debug!("sampling");
 
-        self.sample_interrupt().await?;
+        self.sample_interrupt()?;
 
         #[cfg(feature = "bpf")]
         self.map_result(self.sample_bpf())?;
@@ -130,37 +129,22 @@ impl Interrupt {
                 debug!("initializing bpf");
 
                 let code = include_str!("bpf.c");
-                let mut bpf = bcc::BPF::new(code)?;
-
-                bcc::Kprobe::new()
-                    .handler("hardirq_entry")
-                    .function("handle_irq_event_percpu")
-                    .attach(&mut bpf)?;
-                bcc::Kretprobe::new()
-                    .handler("hardirq_exit")
-                    .function("handle_irq_event_percpu")
-                    .attach(&mut bpf)?;
-                bcc::Tracepoint::new()
-                    .handler("softirq_entry")
-                    .subsystem("irq")
-                    .tracepoint("softirq_entry")
-                    .attach(&mut bpf)?;
-                bcc::Tracepoint::new()
-                    .handler("softirq_exit")
-                    .subsystem("irq")
-                    .tracepoint("softirq_exit")
-                    .attach(&mut bpf)?;
-
-                self.bpf = Some(Arc::new(Mutex::new(BPF { inner: bpf })))
+                let program = BpfProgram::new("interrupt", code)
+                    .kprobe("hardirq_entry", "handle_irq_event_percpu")
+                    .kretprobe("hardirq_exit", "handle_irq_event_percpu")
+                    .tracepoint("softirq_entry", "irq", "softirq_entry")
+                    .tracepoint("softirq_exit", "irq", "softirq_exit");
+
+                self.bpf = Some(self.common.bpf().load(program)?);
             }
         }
 
         Ok(())
     }
 
-    async fn sample_interrupt(&mut self) -> Result<(), std::io::Error> {
+    fn sample_interrupt(&mut self) -> Result<(), std::io::Error> {
         if self.proc_interrupts.is_none() {
-            let file = File::open("/proc/interrupts").await?;
+            let file = ProcFile::open(self.proc_path("interrupts"))?;
             self.proc_interrupts = Some(file);
         }
 
@@ -168,18 +152,12 @@ impl Interrupt {
         let mut cores: Option<usize> = None;
 
         if let Some(file) = &mut self.proc_interrupts {
-            file.seek(SeekFrom::Start(0)).await?;
-            let mut reader = BufReader::new(file);
-            let mut line = String::new();
+            // reused across lines to avoid allocating for each one
+            let mut parts: Vec<&str> = Vec::new();
 
-            loop {
-                line.clear();
-
-                if reader.read_line(&mut line).await? == 0 {
-                    break;
-                }
-
-                let parts: Vec<&str> = line.split_whitespace().collect();
+            for line in file.lines()? {
+                parts.clear();
+                parts.extend(procfs::fields(line).map(procfs::as_str));
                 if cores.is_none() {
                     cores = Some(parts.len());
                     continue;
@@ -293,7 +271,7 @@ impl Interrupt {
             }
         }
 
-        let time = Instant::now();
+        let time = self.common().timestamp();
         for stat in &self.statistics {
             if let Some(value) = result.get(stat) {
                 let _ = self.metrics().record_counter(stat, time, *value);
@@ -309,20 +287,17 @@ impl Interrupt {
             >= Duration::new(self.general_config().window() as u64, 0)
         {
             if let Some(ref bpf) = self.bpf {
-                let bpf = bpf.lock().unwrap();
-                let time = Instant::now();
-                for statistic in self.statistics.iter().filter(|s| s.bpf_table().is_some()) {
-                    if let Ok(mut table) = (*bpf).inner.table(statistic.bpf_table().unwrap()) {
-                        for (&value, &count) in &map_from_table(&mut table) {
-                            if count > 0 {
-                                let _ = self.metrics().record_bucket(
-                                    statistic,
-                                    time,
-                                    value * crate::MICROSECOND,
-                                    count,
-                                );
-                            }
-                        }
+                let time = self.common().timestamp();
+                for (statistic, handle) in self
+                    .statistics
+                    .iter()
+                    .zip(&self.handles)
+                    .filter(|(s, _)| s.bpf_table().is_some())
+                {
+                    if let Some(counts) =
+                        bpf.with_table(statistic.bpf_table().unwrap(), histogram_from_table)
+                    {
+                        handle.record_histogram(time, &counts);
                     }
                 }
             }
@@ -2,19 +2,24 @@
 // Licensed under the Apache License, Version 2.0
 // http://www.apache.org/licenses/LICENSE-2.0
 
+use rustcommon_atomics::{AtomicBool, AtomicUsize};
 use serde_derive::Deserialize;
 
-use crate::config::SamplerConfig;
+use crate::config::{SamplerConfig, SummaryKind};
 
 use super::stat::*;
 
 #[derive(Debug, Deserialize)]
 #[serde(deny_unknown_fields)]
 pub struct MemcacheConfig {
+    #[serde(default = "crate::config::disabled")]
+    enabled: AtomicBool,
+    #[serde(default = "crate::config::unset_interval")]
+    interval: AtomicUsize,
     #[serde(default)]
-    enabled: bool,
+    priority: u8,
     #[serde(default)]
-    interval: Option<usize>,
+    summary: SummaryKind,
     #[serde(default = "crate::common::default_percentiles")]
     percentiles: Vec<f64>,
     endpoint: Option<String>,
@@ -23,8 +28,10 @@ pub struct MemcacheConfig {
 impl Default for MemcacheConfig {
     fn default() -> Self {
         Self {
-            enabled: Default::default(),
-            interval: Default::default(),
+            enabled: crate::config::disabled(),
+            interval: crate::config::unset_interval(),
+            priority: Default::default(),
+            summary: Default::default(),
             percentiles: crate::common::default_percentiles(),
             endpoint: None,
         }
@@ -40,12 +47,14 @@ impl MemcacheConfig {
 impl SamplerConfig for MemcacheConfig {
     type Statistic = MemcacheStatistic;
 
-    fn enabled(&self) -> bool {
-        self.enabled
+    reloadable!();
+
+    fn priority(&self) -> u8 {
+        self.priority
     }
 
-    fn interval(&self) -> Option<usize> {
-        self.interval
+    fn summary(&self) -> SummaryKind {
+        self.summary
     }
 
     fn percentiles(&self) -> &[f64] {
@@ -2,14 +2,15 @@
 // Licensed under the Apache License, Version 2.0
 // http://www.apache.org/licenses/LICENSE-2.0
 
-use std::io::{Read, Write};
-use std::net::{SocketAddr, TcpStream, ToSocketAddrs};
+use std::io::{Error, ErrorKind};
+use std::net::{SocketAddr, ToSocketAddrs};
 
 use async_trait::async_trait;
-use rustcommon_metrics::*;
-use std::time::*;
+use tokio::io::{AsyncReadExt, AsyncWriteExt};
+use tokio::net::TcpStream;
 
 use crate::config::*;
+use crate::metrics::*;
 use crate::samplers::Common;
 use crate::Sampler;
 
@@ -21,19 +22,24 @@ pub use stat::*;
 
 pub struct Memcache {
     address: SocketAddr,
+    buffer: Vec<u8>,
     common: Common,
+    in_flight: bool,
     stream: Option<TcpStream>,
 }
 
 #[async_trait]
 impl Sampler for Memcache {
     type Statistic = MemcacheStatistic;
+    const NAME: &'static str = "memcache";
 
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         if !common.config.samplers().memcache().enabled() {
             return Ok(Self {
                 address: "localhost:11211".to_socket_addrs().unwrap().next().unwrap(),
+                buffer: Vec::new(),
                 common,
+                in_flight: false,
                 stream: None,
             });
         }
@@ -49,7 +55,9 @@ impl Sampler for Memcache {
         });
         let sampler = Self {
             address,
+            buffer: Vec::new(),
             common,
+            in_flight: false,
             stream: None,
         };
         if sampler.sampler_config().enabled() {
@@ -60,12 +68,8 @@ impl Sampler for Memcache {
 
     fn spawn(common: Common) {
         if common.config().samplers().memcache().enabled() {
-            if let Ok(mut sampler) = Self::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = sampler.sample().await;
-                    }
-                });
+            if let Ok(sampler) = Self::new(common.clone()) {
+                common.runtime().spawn(sampler.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize memcache sampler");
             } else {
@@ -87,97 +91,90 @@ impl Sampler for Memcache {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
 
-        if let Some(ref mut stream) = self.stream {
-            if stream.write_all(b"stats\r\n").is_ok() {
-                loop {
-                    let mut buffer = [0_u8; 65536];
-                    if let Ok(length) = stream.peek(&mut buffer) {
-                        if length == 0 {
-                            error!("zero length read. disconnect");
-                            self.stream = None;
-                            return Ok(());
-                        }
-                        let stats = std::str::from_utf8(&buffer).unwrap().to_string();
-                        let lines: Vec<&str> = stats.split("\r\n").collect();
-                        if lines.len() >= 2 && lines[lines.len() - 2] == "END" {
-                            break;
-                        }
-                    }
+        // a sample cancelled by its timeout may have left part of a response
+        // on the connection
+        if self.in_flight {
+            self.stream = None;
+            self.in_flight = false;
+        }
+
+        if self.stream.is_none() {
+            match TcpStream::connect(self.address).await {
+                Ok(stream) => self.stream = Some(stream),
+                Err(_) => {
+                    error!("error connecting to memcache");
+                    return Ok(());
                 }
-                let mut buffer = [0_u8; 65536];
-                let _ = stream.read(&mut buffer);
-                let time = Instant::now();
-                let stats = std::str::from_utf8(&buffer).unwrap().to_string();
-                let lines: Vec<&str> = stats.split("\r\n").collect();
-                for line in lines {
-                    let parts: Vec<&str> = line.split_whitespace().collect();
-                    if let Some(name) = parts.get(1) {
-                        if let Some(value) = parts.get(2) {
-                            match *name {
-                                "data_read" | "data_written" | "cmd_total" | "conn_total"
-                                | "conn_yield" | "hotkey_bw" | "hotkey_qps" => {
-                                    if let Ok(value) =
-                                        value.parse::<f64>().map(|v| v.floor() as u64)
-                                    {
-                                        let statistic = MemcacheStatistic::new((*name).to_string());
-                                        // these select metrics get histogram summaries and
-                                        // percentile output
-                                        self.common().metrics().register(&statistic);
-                                        self.common().metrics().add_summary(
-                                            &statistic,
-                                            Summary::stream(self.samples()),
-                                        );
-                                        self.common()
-                                            .metrics()
-                                            .add_output(&statistic, Output::Reading);
-                                        let _ = self
-                                            .common()
-                                            .metrics()
-                                            .record_counter(&statistic, time, value);
-                                        for percentile in self.sampler_config().percentiles() {
-                                            self.common().metrics().add_output(
-                                                &statistic,
-                                                Output::Percentile(*percentile),
-                                            );
-                                        }
-                                    }
+            }
+        }
+
+        self.in_flight = true;
+        let r = self.request().await;
+        self.in_flight = false;
+        if let Err(e) = r {
+            error!("error reading stats from memcache: {}", e);
+            self.stream = None;
+            return Ok(());
+        }
+
+        let time = self.common().timestamp();
+        let stats = String::from_utf8_lossy(&self.buffer);
+        for line in stats.split("\r\n") {
+            let parts: Vec<&str> = line.split_whitespace().collect();
+            if let Some(name) = parts.get(1) {
+                if let Some(value) = parts.get(2) {
+                    match *name {
+                        "data_read" | "data_written" | "cmd_total" | "conn_total"
+                        | "conn_yield" | "hotkey_bw" | "hotkey_qps" => {
+                            if let Ok(value) = value.parse::<f64>().map(|v| v.floor() as u64) {
+                                let statistic = MemcacheStatistic::new((*name).to_string());
+                                // these select metrics get histogram summaries and
+                                // percentile output
+                                if let Some(handle) = self.register_dynamic(&statistic, true, true)
+                                {
+                                    handle.record_counter(time, value);
                                 }
-                                _ => {
-                                    if let Ok(value) =
-                                        value.parse::<f64>().map(|v| v.floor() as u64)
-                                    {
-                                        let statistic = MemcacheStatistic::new((*name).to_string());
-                                        self.common().metrics().register(&statistic);
-                                        self.common()
-                                            .metrics()
-                                            .add_output(&statistic, Output::Reading);
-                                        // gauge type is used to pass-through raw metrics
-                                        let _ = self
-                                            .common()
-                                            .metrics()
-                                            .record_gauge(&statistic, time, value);
-                                    }
+                            }
+                        }
+                        _ => {
+                            if let Ok(value) = value.parse::<f64>().map(|v| v.floor() as u64) {
+                                let statistic = MemcacheStatistic::new((*name).to_string());
+                                // gauge type is used to pass-through raw metrics
+                                if let Some(handle) = self.register_dynamic(&statistic, true, false)
+                                {
+                                    handle.record_gauge(time, value);
                                 }
                             }
                         }
                     }
                 }
             }
-        } else if let Ok(stream) = TcpStream::connect(self.address) {
-            let _ = stream.set_nonblocking(true);
-            self.stream = Some(stream);
-        } else {
-            error!("error connecting to memcache");
         }
 
         Ok(())
     }
 }
+
+impl Memcache {
+    // sends the stats command and reads the response into the buffer
+    async fn request(&mut self) -> Result<(), Error> {
+        let stream = self
+            .stream
+            .as_mut()
+            .ok_or_else(|| Error::new(ErrorKind::NotConnected, "not connected"))?;
+        stream.write_all(b"stats\r\n").await?;
+        self.buffer.clear();
+        loop {
+            if stream.read_buf(&mut self.buffer).await? == 0 {
+                return Err(Error::new(ErrorKind::UnexpectedEof, "disconnected"));
+            }
+            if self.buffer.ends_with(b"END\r\n") {
+                return Ok(());
+            }
+        }
+    }
+}
@@ -2,10 +2,9 @@
 // Licensed under the Apache License, Version 2.0
 // http://www.apache.org/licenses/LICENSE-2.0
 
+use crate::metrics::*;
 use crate::Statistic;
 
-use rustcommon_metrics::*;
-
 #[derive(Debug, Eq, PartialEq, Hash)]
 pub struct MemcacheStatistic {
     inner: String,
@@ -17,7 +16,7 @@ impl MemcacheStatistic {
     }
 }
 
-impl Statistic<AtomicU64, AtomicU32> for MemcacheStatistic {
+impl Statistic for MemcacheStatistic {
     fn name(&self) -> &str {
         &self.inner
     }
@@ -3,16 +3,20 @@
 // http://www.apache.org/licenses/LICENSE-2.0
 
 use std::convert::TryInto;
+use std::path::PathBuf;
 use std::sync::Arc;
-use std::time::Duration;
+use std::time::{Duration, Instant};
 
 use async_trait::async_trait;
-use rustcommon_metrics::*;
 use tokio::runtime::Runtime;
-use tokio::time::{interval, Interval};
+use tokio::time::timeout;
 
+use crate::common::bpf::BpfLoader;
+use crate::common::clock::{Clock, Ticker};
+use crate::common::peak::{PeakDetector, PeakStatistic};
 use crate::config::General as GeneralConfig;
-use crate::config::{Config, SamplerConfig};
+use crate::config::{Config, SamplerConfig, SummaryKind};
+use crate::metrics::*;
 use crate::HardwareInfo;
 
 pub mod cpu;
@@ -26,6 +30,8 @@ pub mod network;
 pub mod ntp;
 pub mod nvidia;
 pub mod page_cache;
+pub mod reload;
+pub mod replay;
 pub mod rezolus;
 pub mod scheduler;
 pub mod softnet;
@@ -55,7 +61,10 @@ pub use xfs::Xfs;
 
 #[async_trait]
 pub trait Sampler: Sized + Send {
-    type Statistic: Statistic<AtomicU64, AtomicU32>;
+    type Statistic: Statistic;
+
+    /// Name of the sampler, used in its self-instrumentation
+    const NAME: &'static str;
 
     /// Create a new instance of the sampler
     fn new(common: Common) -> Result<Self, anyhow::Error>;
@@ -66,24 +75,51 @@ pub trait Sampler: Sized + Send {
 
     fn spawn(common: Common);
 
-    /// Run the sampler and write new observations to the metrics library and
-    /// wait until next sample interval
+    /// Run the sampler and write new observations to the metrics library
     async fn sample(&mut self) -> Result<(), std::io::Error>;
 
+    /// Sample on each tick of the interval. A sample which has not completed
+    /// by the next tick is cancelled at its next await point and counted as
+    /// skipped, so a sampler waiting on a slow endpoint cannot hold up the
+    /// other samplers.
+    async fn run(mut self) {
+        loop {
+            let ticker = self.delay();
+            ticker.tick().await;
+            let deadline = ticker.interval();
+            if timeout(deadline, self.sample()).await.is_err() {
+                debug!("{} sample timed out", Self::NAME);
+                self.delay().skip();
+            }
+        }
+    }
+
     fn interval(&self) -> usize {
         self.sampler_config()
             .interval()
             .unwrap_or_else(|| self.general_config().interval())
     }
 
-    /// Wait until the next time to sample
-    fn delay(&mut self) -> &mut Option<Interval> {
-        if self.common_mut().interval().is_none() {
-            let millis = self.interval() as u64;
-            self.common_mut()
-                .set_interval(Some(interval(Duration::from_millis(millis))));
+    /// Ticker for the sampler's interval. Ticks are aligned across all
+    /// samplers by the shared clock. The ticker is replaced when a reload
+    /// changes the interval.
+    fn delay(&mut self) -> &mut Ticker {
+        let interval = Duration::from_millis(self.interval() as u64);
+        let current = self
+            .common_mut()
+            .ticker()
+            .as_ref()
+            .map(|ticker| ticker.base_interval());
+        if current != Some(interval) {
+            let ticker = self.common().clock().ticker(
+                self.common().runtime(),
+                Self::NAME,
+                interval,
+                self.sampler_config().priority(),
+            );
+            self.common_mut().set_ticker(Some(ticker));
         }
-        self.common_mut().interval()
+        self.common_mut().ticker().as_mut().unwrap()
     }
 
     /// Access the specific sampler config
@@ -98,6 +134,17 @@ pub trait Sampler: Sized + Send {
         self.common().config().general()
     }
 
+    /// Path of a procfs file, such as `net/dev`, under the configured root
+    fn proc_path(&self, path: &str) -> PathBuf {
+        self.general_config().proc_root().join(path)
+    }
+
+    /// Path of a sysfs file, such as `devices/system/cpu`, under the
+    /// configured root
+    fn sys_path(&self, path: &str) -> PathBuf {
+        self.general_config().sys_root().join(path)
+    }
+
     /// Register all the statistics
     fn register(&self) {
         for statistic in self.sampler_config().statistics() {
@@ -107,33 +154,168 @@ pub trait Sampler: Sized + Send {
             let percentiles = self.sampler_config().percentiles();
             if !percentiles.is_empty() {
                 if statistic.source() == Source::Distribution {
-                    self.common().metrics().add_summary(
-                        &statistic,
-                        Summary::heatmap(
-                            1_000_000_000,
-                            2,
-                            Duration::new(
-                                self.common()
-                                    .config()
-                                    .general()
-                                    .window()
-                                    .try_into()
-                                    .unwrap(),
-                                0,
-                            ),
-                            Duration::new(1, 0),
-                        ),
-                    );
+                    self.common()
+                        .metrics()
+                        .add_summary(&statistic, self.heatmap());
                 } else {
                     self.common()
                         .metrics()
-                        .add_summary(&statistic, Summary::stream(self.samples()));
+                        .add_summary(&statistic, self.summary());
                 }
             }
-            for percentile in percentiles {
-                self.common()
-                    .metrics()
-                    .add_output(&statistic, Output::Percentile(*percentile));
+            self.add_percentiles(&statistic);
+        }
+    }
+
+    /// Resolves the statistics to handles, in the same order, so that values
+    /// can be recorded without looking up the statistic each time
+    fn resolve(&self, statistics: &[Self::Statistic]) -> Vec<Handle> {
+        statistics
+            .iter()
+            .map(|statistic| self.metrics().register(statistic))
+            .collect()
+    }
+
+    /// Resolves the statistics to handles which also record BPF histograms
+    /// in bulk, where each unit of a histogram's values in the kernel is worth
+    /// `scale` of the statistic
+    #[cfg(feature = "bpf")]
+    fn resolve_histograms(&self, statistics: &[Self::Statistic], scale: u64) -> Vec<Handle> {
+        let values = crate::common::bpf::histogram_values(scale);
+        self.resolve(statistics)
+            .into_iter()
+            .map(|handle| handle.with_buckets(values.clone()))
+            .collect()
+    }
+
+    /// Period over which the percentiles are calculated
+    fn window(&self) -> Duration {
+        Duration::new(self.general_config().window().try_into().unwrap(), 0)
+    }
+
+    /// Additional periods over which the percentiles are calculated
+    fn windows(&self) -> Vec<Duration> {
+        let window = self.window();
+        self.general_config()
+            .windows()
+            .iter()
+            .map(|seconds| Duration::new(*seconds as u64, 0))
+            .filter(|w| *w != window && w.as_secs() > 0)
+            .collect()
+    }
+
+    /// Longest period over which percentiles are calculated, which the
+    /// summaries keep values for. All the windows share the same storage.
+    fn history(&self) -> Duration {
+        self.windows()
+            .into_iter()
+            .fold(self.window(), std::cmp::max)
+    }
+
+    /// Summary for the percentiles of a distribution. Slices are a second,
+    /// unless that would take more slices than the window has seconds (or 60,
+    /// if more), so additional windows cost resolution rather than memory.
+    fn heatmap(&self) -> Summary {
+        let history = self.history();
+        let slices = std::cmp::max(self.window().as_secs() as u32, 60);
+        let resolution = std::cmp::max(history / slices, Duration::new(1, 0));
+        Summary::heatmap(1_000_000_000, 2, self.window(), resolution).with_history(history)
+    }
+
+    /// Summary for the percentiles of a counter or gauge, as configured for
+    /// the sampler. A sketch keeps a few slices of the window so that it rolls
+    /// forward in steps, each with enough bins for every value at 2%.
+    fn summary(&self) -> Summary {
+        let window = self.window();
+        let history = self.history();
+        match self.sampler_config().summary() {
+            SummaryKind::Stream => Summary::stream(self.samples(), window).with_history(history),
+            SummaryKind::Sketch => {
+                let resolution = std::cmp::max(window / 4, history / 60);
+                Summary::sketch(0.02, Summary::sketch_bins(0.02), window, resolution)
+                    .with_history(history)
+            }
+        }
+    }
+
+    /// Exports the configured percentiles of the statistic over the window
+    /// and each of the additional windows
+    fn add_percentiles(&self, statistic: &dyn Statistic) {
+        for output in self.percentile_outputs() {
+            self.metrics().add_output(statistic, output);
+        }
+    }
+
+    fn percentile_outputs(&self) -> Vec<Output> {
+        let windows = self.windows();
+        let mut outputs = Vec::new();
+        for percentile in self.sampler_config().percentiles() {
+            outputs.push(Output::Percentile(*percentile));
+            for window in &windows {
+                outputs.push(Output::WindowPercentile(*percentile, *window));
+            }
+        }
+        outputs
+    }
+
+    /// Registers a statistic discovered while sampling, exporting its reading
+    /// if `reading` is set and keeping a summary with the configured
+    /// percentiles if `summarize` is set. Returns `None` if the limits on
+    /// dynamic series do not allow another.
+    fn register_dynamic(
+        &self,
+        statistic: &dyn Statistic,
+        reading: bool,
+        summarize: bool,
+    ) -> Option<Handle> {
+        let mut outputs = Vec::new();
+        if reading {
+            outputs.push(Output::Reading);
+        }
+        let summary = if summarize {
+            outputs.extend(self.percentile_outputs());
+            Some(self.summary())
+        } else {
+            None
+        };
+        let time = self.common().timestamp();
+        match self
+            .metrics()
+            .register_dynamic(Self::NAME, statistic, summary, &outputs, time)
+        {
+            Ok(handle) => Some(handle),
+            Err(e) => {
+                debug!("{} not registering {}: {}", Self::NAME, statistic.name(), e);
+                None
+            }
+        }
+    }
+
+    /// Exports the peak rate of each of the counters, and the time of the
+    /// peak, returning a pair of handles for each in the same order
+    fn register_peaks(&self, statistics: &[Self::Statistic]) -> Vec<(Handle, Handle)> {
+        statistics
+            .iter()
+            .map(|statistic| {
+                let rate = PeakStatistic::rate(statistic);
+                let time = PeakStatistic::time(statistic);
+                self.metrics().add_output(&rate, Output::Reading);
+                self.metrics().add_output(&time, Output::Reading);
+                (
+                    self.metrics().register(&rate),
+                    self.metrics().register(&time),
+                )
+            })
+            .collect()
+    }
+
+    /// Records the peaks found by the detector within the window
+    fn record_peaks(&self, detector: &PeakDetector, handles: &[(Handle, Handle)]) {
+        let time = self.common().timestamp();
+        for (peak, (rate, peak_time)) in detector.peaks(Instant::now()).iter().zip(handles) {
+            if let Some(peak) = peak {
+                rate.record_gauge(time, peak.rate);
+                peak_time.record_gauge(time, peak.time);
             }
         }
     }
@@ -142,7 +324,7 @@ pub trait Sampler: Sized + Send {
         ((1000.0 / self.interval() as f64) * self.general_config().window() as f64).ceil() as usize
     }
 
-    fn metrics(&self) -> &Metrics<AtomicU64, AtomicU32> {
+    fn metrics(&self) -> &Metrics {
         self.common().metrics()
     }
 
@@ -164,36 +346,71 @@ pub trait Sampler: Sized + Send {
     }
 }
 
+/// Each sampler by name, with the function which starts it if enabled
+pub(crate) const SAMPLERS: &[(&str, fn(Common))] = &[
+    (Cpu::NAME, Cpu::spawn),
+    (Disk::NAME, Disk::spawn),
+    (Ext4::NAME, Ext4::spawn),
+    (Http::NAME, Http::spawn),
+    (Interrupt::NAME, Interrupt::spawn),
+    (Usercall::NAME, Usercall::spawn),
+    (Memcache::NAME, Memcache::spawn),
+    (Memory::NAME, Memory::spawn),
+    (PageCache::NAME, PageCache::spawn),
+    (Network::NAME, Network::spawn),
+    (Ntp::NAME, Ntp::spawn),
+    (Nvidia::NAME, Nvidia::spawn),
+    (Rezolus::NAME, Rezolus::spawn),
+    (Scheduler::NAME, Scheduler::spawn),
+    (Softnet::NAME, Softnet::spawn),
+    (Tcp::NAME, Tcp::spawn),
+    (Udp::NAME, Udp::spawn),
+    (Xfs::NAME, Xfs::spawn),
+];
+
+/// Starts each of the enabled samplers
+pub fn spawn_samplers(common: &Common) {
+    for (_, spawn) in SAMPLERS {
+        spawn(common.clone());
+    }
+}
+
 pub struct Common {
+    bpf: Arc<BpfLoader>,
     config: Arc<Config>,
     runtime: Arc<Runtime>,
+    clock: Arc<Clock>,
     hardware_info: Arc<HardwareInfo>,
-    interval: Option<Interval>,
-    metrics: Arc<Metrics<AtomicU64, AtomicU32>>,
+    ticker: Option<Ticker>,
+    metrics: Arc<Metrics>,
 }
 
 impl Clone for Common {
     fn clone(&self) -> Self {
         Self {
+            bpf: self.bpf.clone(),
             config: self.config.clone(),
             runtime: self.runtime.clone(),
+            clock: self.clock.clone(),
             hardware_info: self.hardware_info.clone(),
-            interval: None,
+            ticker: None,
             metrics: self.metrics.clone(),
         }
     }
 }
 
 impl Common {
-    pub fn new(
-        config: Arc<Config>,
-        metrics: Arc<Metrics<AtomicU64, AtomicU32>>,
-        runtime: Arc<Runtime>,
-    ) -> Self {
+    pub fn new(config: Arc<Config>, metrics: Arc<Metrics>, runtime: Arc<Runtime>) -> Self {
+        let hardware_info = Arc::new(HardwareInfo::new(config.general().sys_root()));
         Self {
+            bpf: Arc::new(BpfLoader::new(
+                config.general().bpf_shared_module(),
+                config.general().bpf_pin_path(),
+            )),
+            clock: Arc::new(Clock::new()),
             config,
-            hardware_info: Arc::new(HardwareInfo::new()),
-            interval: None,
+            hardware_info,
+            ticker: None,
             metrics,
             runtime,
         }
@@ -203,6 +420,14 @@ impl Common {
         &self.runtime
     }
 
+    pub fn bpf(&self) -> &BpfLoader {
+        &self.bpf
+    }
+
+    pub fn clock(&self) -> &Clock {
+        &self.clock
+    }
+
     pub fn config(&self) -> &Config {
         &self.config
     }
@@ -211,15 +436,24 @@ impl Common {
         &self.hardware_info
     }
 
-    pub fn interval(&mut self) -> &mut Option<Interval> {
-        &mut self.interval
+    pub fn ticker(&mut self) -> &mut Option<Ticker> {
+        &mut self.ticker
+    }
+
+    pub fn set_ticker(&mut self, ticker: Option<Ticker>) {
+        self.ticker = ticker
     }
 
-    pub fn set_interval(&mut self, interval: Option<Interval>) {
-        self.interval = interval
+    /// Timestamp for readings taken on the current tick, which is the same
+    /// for all samplers on that tick
+    pub fn timestamp(&self) -> Instant {
+        self.ticker
+            .as_ref()
+            .and_then(|ticker| ticker.time())
+            .unwrap_or_else(Instant::now)
     }
 
-    pub fn metrics(&self) -> &Metrics<AtomicU64, AtomicU32> {
+    pub fn metrics(&self) -> &Metrics {
         &self.metrics
     }
 }
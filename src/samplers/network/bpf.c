@@ -4,11 +4,11 @@
 
 #include <uapi/linux/ptrace.h>
 
-BPF_HISTOGRAM(rx_size, int, 461);
-BPF_HISTOGRAM(tx_size, int, 461);
+BPF_HISTOGRAM(NS(rx_size), int, 461);
+BPF_HISTOGRAM(NS(tx_size), int, 461);
 
 // histogram indexing
-static unsigned int value_to_index2(unsigned int value) {
+static unsigned int NS(value_to_index2)(unsigned int value) {
     unsigned int index = 460;
     if (value < 100) {
         // 0-99 => [0..100)
@@ -41,16 +41,16 @@ static unsigned int value_to_index2(unsigned int value) {
     return index;
 }
 
-int trace_transmit(struct tracepoint__net__net_dev_queue *args)
+int NS(trace_transmit)(struct tracepoint__net__net_dev_queue *args)
 {
-    u64 index = value_to_index2(args->len);
-    tx_size.increment(index);
+    u64 index = NS(value_to_index2)(args->len);
+    NS(tx_size).increment(index);
     return 0;
 }
 
-int trace_receive(struct tracepoint__net__netif_rx *args)
+int NS(trace_receive)(struct tracepoint__net__netif_rx *args)
 {
-    u64 index = value_to_index2(args->len);
-    rx_size.increment(index);
+    u64 index = NS(value_to_index2)(args->len);
+    NS(rx_size).increment(index);
     return 0;
 }
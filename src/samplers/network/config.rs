@@ -2,10 +2,11 @@
 // Licensed under the Apache License, Version 2.0
 // http://www.apache.org/licenses/LICENSE-2.0
 
+use rustcommon_atomics::{AtomicBool, AtomicUsize};
 use serde_derive::Deserialize;
 use strum::IntoEnumIterator;
 
-use crate::config::SamplerConfig;
+use crate::config::{SamplerConfig, SummaryKind};
 
 use super::stat::*;
 
@@ -14,10 +15,18 @@ use super::stat::*;
 pub struct NetworkConfig {
     #[serde(default)]
     bpf: bool,
+    #[serde(default = "crate::config::disabled")]
+    enabled: AtomicBool,
+    #[serde(default = "crate::config::unset_interval")]
+    interval: AtomicUsize,
     #[serde(default)]
-    enabled: bool,
+    peaks: Vec<NetworkStatistic>,
+    #[serde(default = "default_peak_interval")]
+    peak_interval: usize,
     #[serde(default)]
-    interval: Option<usize>,
+    priority: u8,
+    #[serde(default)]
+    summary: SummaryKind,
     #[serde(default = "crate::common::default_percentiles")]
     percentiles: Vec<f64>,
     #[serde(default = "default_statistics")]
@@ -28,8 +37,12 @@ impl Default for NetworkConfig {
     fn default() -> Self {
         Self {
             bpf: Default::default(),
-            enabled: Default::default(),
-            interval: Default::default(),
+            enabled: crate::config::disabled(),
+            interval: crate::config::unset_interval(),
+            peaks: Vec::new(),
+            peak_interval: default_peak_interval(),
+            priority: Default::default(),
+            summary: Default::default(),
             percentiles: crate::common::default_percentiles(),
             statistics: default_statistics(),
         }
@@ -40,6 +53,30 @@ fn default_statistics() -> Vec<NetworkStatistic> {
     NetworkStatistic::iter().collect()
 }
 
+fn default_peak_interval() -> usize {
+    10
+}
+
+impl NetworkConfig {
+    /// Counters which are read at the peak interval to export their peak
+    /// rate within the window. Only counters from /proc/net/dev are
+    /// supported.
+    pub fn peaks(&self) -> Vec<NetworkStatistic> {
+        let mut peaks = Vec::new();
+        for statistic in &self.peaks {
+            if statistic.field_number().is_some() && !peaks.contains(statistic) {
+                peaks.push(*statistic);
+            }
+        }
+        peaks
+    }
+
+    /// Interval in milliseconds at which the peak counters are read
+    pub fn peak_interval(&self) -> usize {
+        self.peak_interval
+    }
+}
+
 impl SamplerConfig for NetworkConfig {
     type Statistic = NetworkStatistic;
 
@@ -47,12 +84,14 @@ impl SamplerConfig for NetworkConfig {
         self.bpf
     }
 
-    fn enabled(&self) -> bool {
-        self.enabled
+    reloadable!();
+
+    fn priority(&self) -> u8 {
+        self.priority
     }
 
-    fn interval(&self) -> Option<usize> {
-        self.interval
+    fn summary(&self) -> SummaryKind {
+        self.summary
     }
 
     fn percentiles(&self) -> &[f64] {
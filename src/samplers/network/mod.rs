@@ -5,14 +5,14 @@
 use std::collections::HashMap;
 use std::sync::{Arc, Mutex};
 use std::time::*;
-use tokio::io::SeekFrom;
 
 use async_trait::async_trait;
-use tokio::fs::File;
-use tokio::io::{AsyncBufReadExt, AsyncSeekExt, BufReader};
 
 use crate::common::bpf::*;
+use crate::common::peak::PeakDetector;
+use crate::common::procfs::{self, ProcFile};
 use crate::config::SamplerConfig;
+use crate::metrics::Handle;
 use crate::samplers::Common;
 use crate::Sampler;
 
@@ -24,16 +24,20 @@ pub use stat::*;
 
 #[allow(dead_code)]
 pub struct Network {
-    bpf: Option<Arc<Mutex<BPF>>>,
+    bpf: Option<BpfHandle>,
     bpf_last: Arc<Mutex<Instant>>,
     common: Common,
-    proc_net_dev: Option<File>,
+    proc_net_dev: Option<ProcFile>,
+    handles: Vec<Handle>,
+    peak: Option<Arc<PeakDetector>>,
+    peak_handles: Vec<(Handle, Handle)>,
     statistics: Vec<NetworkStatistic>,
 }
 
 #[async_trait]
 impl Sampler for Network {
     type Statistic = NetworkStatistic;
+    const NAME: &'static str = "network";
 
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let fault_tolerant = common.config.general().fault_tolerant();
@@ -45,6 +49,9 @@ impl Sampler for Network {
             bpf_last: Arc::new(Mutex::new(Instant::now())),
             common,
             proc_net_dev: None,
+            handles: Vec::new(),
+            peak: None,
+            peak_handles: Vec::new(),
             statistics,
         };
 
@@ -57,6 +64,16 @@ impl Sampler for Network {
 
         if sampler.sampler_config().enabled() {
             sampler.register();
+            #[cfg(feature = "bpf")]
+            {
+                sampler.handles = sampler.resolve_histograms(&sampler.statistics, 1);
+            }
+            if let Err(e) = sampler.initialize_peaks() {
+                error!("failed to initialize peak detector: {}", e);
+                if !fault_tolerant {
+                    return Err(e.into());
+                }
+            }
         }
 
         Ok(sampler)
@@ -64,12 +81,8 @@ impl Sampler for Network {
 
     fn spawn(common: Common) {
         if common.config().samplers().network().enabled() {
-            if let Ok(mut sampler) = Self::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = sampler.sample().await;
-                    }
-                });
+            if let Ok(sampler) = Self::new(common.clone()) {
+                common.runtime().spawn(sampler.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize network sampler");
             } else {
@@ -91,19 +104,19 @@ impl Sampler for Network {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
 
         debug!("sampling");
 
-        let result = self.sample_proc_net_dev().await;
+        let result = self.sample_proc_net_dev();
         self.map_result(result)?;
 
+        if let Some(detector) = &self.peak {
+            self.record_peaks(detector, &self.peak_handles);
+        }
+
         #[cfg(feature = "bpf")]
         self.map_result(self.sample_bpf())?;
 
@@ -132,61 +145,72 @@ impl Network {
                 debug!("initializing bpf");
                 // load the code and compile
                 let code = include_str!("bpf.c");
-                let mut bpf = bcc::BPF::new(code)?;
-
-                bcc::Tracepoint::new()
-                    .handler("trace_transmit")
-                    .subsystem("net")
-                    .tracepoint("net_dev_queue")
-                    .attach(&mut bpf)?;
-                bcc::Tracepoint::new()
-                    .handler("trace_receive")
-                    .subsystem("net")
-                    .tracepoint("netif_rx")
-                    .attach(&mut bpf)?;
-
-                self.bpf = Some(Arc::new(Mutex::new(BPF { inner: bpf })));
+                let program = BpfProgram::new("network", code)
+                    .tracepoint("trace_transmit", "net", "net_dev_queue")
+                    .tracepoint("trace_receive", "net", "netif_rx");
+
+                self.bpf = Some(self.common.bpf().load(program)?);
             }
         }
 
         Ok(())
     }
 
-    async fn sample_proc_net_dev(&mut self) -> Result<(), std::io::Error> {
+    // reads the counters chosen for peak detection at the peak interval from
+    // a file of its own, so that sampling is not held up by the detector
+    fn initialize_peaks(&mut self) -> Result<(), std::io::Error> {
+        let config = self.common.config().samplers().network();
+        let peaks = config.peaks();
+        if peaks.is_empty() {
+            return Ok(());
+        }
+        let fields: Vec<usize> = peaks.iter().filter_map(|s| s.field_number()).collect();
+        let mut file = ProcFile::open(self.proc_path("net/dev"))?;
+        let detector = Arc::new(PeakDetector::new(peaks.len(), self.window()));
+        detector.spawn(
+            self.common.runtime(),
+            Duration::from_millis(config.peak_interval() as u64),
+            move |values| sum_fields(&mut file, &fields, values),
+        );
+        self.peak_handles = self.register_peaks(&peaks);
+        self.peak = Some(detector);
+        Ok(())
+    }
+
+    fn sample_proc_net_dev(&mut self) -> Result<(), std::io::Error> {
         // sample /proc/net/dev
         if self.proc_net_dev.is_none() {
-            let file = File::open("/proc/net/dev").await?;
+            let file = ProcFile::open(self.proc_path("net/dev"))?;
             self.proc_net_dev = Some(file);
         }
 
         let mut result = HashMap::new();
 
         if let Some(file) = &mut self.proc_net_dev {
-            file.seek(SeekFrom::Start(0)).await?;
-            let mut reader = BufReader::new(file);
-            let mut line = String::new();
-
-            while reader.read_line(&mut line).await? > 0 {
-                let parts: Vec<&str> = line.split_whitespace().collect();
-                if !parts.is_empty() && parts[1].parse::<u64>().is_ok() {
+            for line in file.lines()? {
+                // skip the header lines
+                if procfs::fields(line)
+                    .nth(1)
+                    .and_then(procfs::parse_u64)
+                    .is_some()
+                {
                     for statistic in &self.statistics {
                         if let Some(field) = statistic.field_number() {
                             if !result.contains_key(statistic) {
                                 result.insert(statistic, 0);
                             }
                             let current = result.get_mut(statistic).unwrap();
-                            *current += parts
-                                .get(field)
-                                .map(|v| v.parse().unwrap_or(0))
+                            *current += procfs::fields(line)
+                                .nth(field)
+                                .map(|v| procfs::parse_u64(v).unwrap_or(0))
                                 .unwrap_or(0);
                         }
                     }
                 }
-                line.clear();
             }
         }
 
-        let time = Instant::now();
+        let time = self.common().timestamp();
         for statistic in &self.statistics {
             if let Some(value) = result.get(statistic) {
                 let _ = self.metrics().record_counter(statistic, time, *value);
@@ -200,16 +224,18 @@ impl Network {
         if self.bpf_last.lock().unwrap().elapsed()
             >= Duration::new(self.general_config().window() as u64, 0)
         {
-            let time = Instant::now();
+            let time = self.common().timestamp();
             if let Some(ref bpf) = self.bpf {
-                let bpf = bpf.lock().unwrap();
-                for statistic in self.statistics.iter().filter(|s| s.bpf_table().is_some()) {
-                    if let Ok(mut table) = (*bpf).inner.table(statistic.bpf_table().unwrap()) {
-                        for (&value, &count) in &map_from_table(&mut table) {
-                            if count > 0 {
-                                let _ = self.metrics().record_bucket(statistic, time, value, count);
-                            }
-                        }
+                for (statistic, handle) in self
+                    .statistics
+                    .iter()
+                    .zip(&self.handles)
+                    .filter(|(s, _)| s.bpf_table().is_some())
+                {
+                    if let Some(counts) =
+                        bpf.with_table(statistic.bpf_table().unwrap(), histogram_from_table)
+                    {
+                        handle.record_histogram(time, &counts);
                     }
                 }
             }
@@ -218,3 +244,31 @@ impl Network {
         Ok(())
     }
 }
+
+// sums each of the fields over the interfaces in /proc/net/dev
+fn sum_fields(
+    file: &mut ProcFile,
+    fields: &[usize],
+    totals: &mut [u64],
+) -> Result<(), std::io::Error> {
+    for total in totals.iter_mut() {
+        *total = 0;
+    }
+    for line in file.lines()? {
+        // skip the header lines
+        if procfs::fields(line)
+            .nth(1)
+            .and_then(procfs::parse_u64)
+            .is_none()
+        {
+            continue;
+        }
+        for (field, total) in fields.iter().zip(totals.iter_mut()) {
+            *total += procfs::fields(line)
+                .nth(*field)
+                .and_then(procfs::parse_u64)
+                .unwrap_or(0);
+        }
+    }
+    Ok(())
+}
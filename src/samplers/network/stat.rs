@@ -5,11 +5,12 @@
 use core::convert::TryFrom;
 use core::str::FromStr;
 
-use rustcommon_metrics::*;
 use serde_derive::{Deserialize, Serialize};
 use strum::ParseError;
 use strum_macros::{EnumIter, EnumString, IntoStaticStr};
 
+use crate::metrics::*;
+
 #[derive(
     Clone,
     Copy,
@@ -95,7 +96,7 @@ impl NetworkStatistic {
     }
 }
 
-impl Statistic<AtomicU64, AtomicU32> for NetworkStatistic {
+impl Statistic for NetworkStatistic {
     fn name(&self) -> &str {
         (*self).into()
     }
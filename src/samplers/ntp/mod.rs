@@ -26,6 +26,7 @@ pub struct Ntp {
 #[async_trait]
 impl Sampler for Ntp {
     type Statistic = NtpStatistic;
+    const NAME: &'static str = "ntp";
 
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let statistics = common.config().samplers().ntp().statistics();
@@ -43,12 +44,8 @@ impl Sampler for Ntp {
         debug!("spawning");
         if common.config().samplers().ntp().enabled() {
             debug!("sampler is enabled");
-            if let Ok(mut ntp) = Ntp::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = ntp.sample().await;
-                    }
-                });
+            if let Ok(ntp) = Ntp::new(common.clone()) {
+                common.runtime().spawn(ntp.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize ntp sampler");
             } else {
@@ -70,10 +67,6 @@ impl Sampler for Ntp {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
@@ -91,7 +84,7 @@ impl Ntp {
     #[cfg(not(target_env = "musl"))]
     async fn sample_ntp_adjtime(&mut self) -> Result<(), std::io::Error> {
         let mut timeval = default_ntptimeval();
-        let time = Instant::now();
+        let time = self.common().timestamp();
         let status = unsafe { libc::ntp_gettime(&mut timeval) };
         if status == 0 {
             let _ = self.metrics().record_gauge(
@@ -5,11 +5,12 @@
 use core::convert::TryFrom;
 use core::str::FromStr;
 
-use rustcommon_metrics::*;
 use serde_derive::{Deserialize, Serialize};
 use strum::ParseError;
 use strum_macros::{EnumIter, EnumString, IntoStaticStr};
 
+use crate::metrics::*;
+
 #[derive(
     Clone,
     Copy,
@@ -39,7 +40,7 @@ impl TryFrom<&str> for NtpStatistic {
     }
 }
 
-impl Statistic<AtomicU64, AtomicU32> for NtpStatistic {
+impl Statistic for NtpStatistic {
     fn name(&self) -> &str {
         (*self).into()
     }
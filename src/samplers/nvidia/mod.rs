@@ -29,6 +29,7 @@ pub struct Nvidia {
 #[async_trait]
 impl Sampler for Nvidia {
     type Statistic = NvidiaStatistic;
+    const NAME: &'static str = "nvidia";
 
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let statistics = common.config().samplers().nvidia().statistics();
@@ -55,12 +56,8 @@ impl Sampler for Nvidia {
         debug!("spawning");
         if common.config().samplers().nvidia().enabled() {
             debug!("sampler is enabled");
-            if let Ok(mut sampler) = Nvidia::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = sampler.sample().await;
-                    }
-                });
+            if let Ok(sampler) = Nvidia::new(common.clone()) {
+                common.runtime().spawn(sampler.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize nvidia sampler");
             } else {
@@ -82,10 +79,6 @@ impl Sampler for Nvidia {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
@@ -101,7 +94,7 @@ impl Sampler for Nvidia {
 
 impl Nvidia {
     async fn sample_nvml(&mut self) -> Result<(), std::io::Error> {
-        let time = Instant::now();
+        let time = self.common().timestamp();
         let devices = self.nvml.device_count().unwrap_or(0);
         let statistics = &self.common.config().samplers().nvidia().statistics;
         for id in 0..devices {
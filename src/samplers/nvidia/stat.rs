@@ -5,11 +5,12 @@
 use core::convert::TryFrom;
 use core::str::FromStr;
 
-use rustcommon_metrics::*;
 use serde_derive::{Deserialize, Serialize};
 use strum::ParseError;
 use strum_macros::{EnumIter, EnumString, IntoStaticStr};
 
+use crate::metrics::*;
+
 #[derive(
     Clone,
     Copy,
@@ -108,7 +109,7 @@ pub enum NvidiaStatistic {
     ProcessesCompute(u32),
 }
 
-impl Statistic<AtomicU64, AtomicU32> for NvidiaStatistic {
+impl Statistic for NvidiaStatistic {
     // TODO(bmartin): this should be cleaned up once we have scoped metrics
     fn name(&self) -> &str {
         match self {
@@ -1,38 +1,38 @@
 #include <uapi/linux/ptrace.h>
 
-BPF_ARRAY(page_accessed, u64, 1);
-BPF_ARRAY(buffer_dirty, u64, 1);
-BPF_ARRAY(add_to_page_cache_lru, u64, 1);
-BPF_ARRAY(page_dirtied, u64, 1);
+BPF_ARRAY(NS(page_accessed), u64, 1);
+BPF_ARRAY(NS(buffer_dirty), u64, 1);
+BPF_ARRAY(NS(add_to_page_cache_lru), u64, 1);
+BPF_ARRAY(NS(page_dirtied), u64, 1);
 
-int trace_mark_page_accessed(struct pt_regs *ctx)
+int NS(trace_mark_page_accessed)(struct pt_regs *ctx)
 {
     int zero = 0;
-    u64 *count = page_accessed.lookup(&zero);
+    u64 *count = NS(page_accessed).lookup(&zero);
     if (count) lock_xadd(count, 1);
     return 0;
 }
 
-int trace_mark_buffer_dirty(struct pt_regs *ctx)
+int NS(trace_mark_buffer_dirty)(struct pt_regs *ctx)
 {
     int zero = 0;
-    u64 *count = buffer_dirty.lookup(&zero);
+    u64 *count = NS(buffer_dirty).lookup(&zero);
     if (count) lock_xadd(count, 1);
     return 0;
 }
 
-int trace_add_to_page_cache_lru(struct pt_regs *ctx)
+int NS(trace_add_to_page_cache_lru)(struct pt_regs *ctx)
 {
     int zero = 0;
-    u64 *count = add_to_page_cache_lru.lookup(&zero);
+    u64 *count = NS(add_to_page_cache_lru).lookup(&zero);
     if (count) lock_xadd(count, 1);
     return 0;
 }
 
-int trace_account_page_dirtied(struct pt_regs *ctx)
+int NS(trace_account_page_dirtied)(struct pt_regs *ctx)
 {
     int zero = 0;
-    u64 *count = page_dirtied.lookup(&zero);
+    u64 *count = NS(page_dirtied).lookup(&zero);
     if (count) lock_xadd(count, 1);
     return 0;
 }
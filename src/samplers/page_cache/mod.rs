@@ -3,7 +3,6 @@
 // http://www.apache.org/licenses/LICENSE-2.0
 
 use std::collections::HashMap;
-use std::sync::{Arc, Mutex};
 
 use async_trait::async_trait;
 
@@ -20,7 +19,7 @@ pub use stat::*;
 
 #[allow(dead_code)]
 pub struct PageCache {
-    bpf: Option<Arc<Mutex<BPF>>>,
+    bpf: Option<BpfHandle>,
     common: Common,
     statistics: Vec<PageCacheStatistic>,
     counters: HashMap<PageCacheStatistic, u64>,
@@ -29,6 +28,7 @@ pub struct PageCache {
 #[async_trait]
 impl Sampler for PageCache {
     type Statistic = PageCacheStatistic;
+    const NAME: &'static str = "page_cache";
 
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let fault_tolerant = common.config.general().fault_tolerant();
@@ -58,12 +58,8 @@ impl Sampler for PageCache {
 
     fn spawn(common: Common) {
         if common.config().samplers().page_cache().enabled() {
-            if let Ok(mut interrupt) = PageCache::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = interrupt.sample().await;
-                    }
-                });
+            if let Ok(interrupt) = PageCache::new(common.clone()) {
+                common.runtime().spawn(interrupt.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize page_cache sampler");
             } else {
@@ -85,10 +81,6 @@ impl Sampler for PageCache {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
@@ -125,26 +117,13 @@ impl PageCache {
                 debug!("initializing bpf");
 
                 let code = include_str!("bpf.c");
-                let mut bpf = bcc::BPF::new(code)?;
-
-                bcc::Kprobe::new()
-                    .handler("trace_mark_page_accessed")
-                    .function("mark_page_accessed")
-                    .attach(&mut bpf)?;
-                bcc::Kprobe::new()
-                    .handler("trace_mark_buffer_dirty")
-                    .function("mark_buffer_dirty")
-                    .attach(&mut bpf)?;
-                bcc::Kprobe::new()
-                    .handler("trace_add_to_page_cache_lru")
-                    .function("add_to_page_cache_lru")
-                    .attach(&mut bpf)?;
-                bcc::Kprobe::new()
-                    .handler("trace_account_page_dirtied")
-                    .function("account_page_dirtied")
-                    .attach(&mut bpf)?;
-
-                self.bpf = Some(Arc::new(Mutex::new(BPF { inner: bpf })))
+                let program = BpfProgram::new("page_cache", code)
+                    .kprobe("trace_mark_page_accessed", "mark_page_accessed")
+                    .kprobe("trace_mark_buffer_dirty", "mark_buffer_dirty")
+                    .kprobe("trace_add_to_page_cache_lru", "add_to_page_cache_lru")
+                    .kprobe("trace_account_page_dirtied", "account_page_dirtied");
+
+                self.bpf = Some(self.common.bpf().load(program)?);
             }
         }
 
@@ -154,32 +133,21 @@ impl PageCache {
     #[cfg(feature = "bpf")]
     fn sample_bpf_counters(&mut self) -> Result<(), std::io::Error> {
         if let Some(ref bpf) = self.bpf {
-            let bpf = bpf.lock().unwrap();
-            let time = std::time::Instant::now();
-            let mut page_accessed = 0;
-            let mut buffer_dirty = 0;
-            let mut add_to_page_cache_lru = 0;
-            let mut page_dirtied = 0;
+            let time = self.common().timestamp();
 
             // to make things simple for wraparound behavior, clear each BPF
             // counter after reading it.
-            if let Ok(mut table) = (*bpf).inner.table("page_accessed") {
-                page_accessed = crate::common::bpf::parse_u64(table.iter().next().unwrap().value);
-                let _ = table.set(&mut [0, 0, 0, 0], &mut [0, 0, 0, 0, 0, 0, 0, 0]);
-            }
-            if let Ok(mut table) = (*bpf).inner.table("buffer_dirty") {
-                buffer_dirty = crate::common::bpf::parse_u64(table.iter().next().unwrap().value);
+            let read_and_clear = |table: &mut bcc::table::Table| {
+                let value = crate::common::bpf::parse_u64(table.iter().next().unwrap().value);
                 let _ = table.set(&mut [0, 0, 0, 0], &mut [0, 0, 0, 0, 0, 0, 0, 0]);
-            }
-            if let Ok(mut table) = (*bpf).inner.table("add_to_page_cache_lru") {
-                add_to_page_cache_lru =
-                    crate::common::bpf::parse_u64(table.iter().next().unwrap().value);
-                let _ = table.set(&mut [0, 0, 0, 0], &mut [0, 0, 0, 0, 0, 0, 0, 0]);
-            }
-            if let Ok(mut table) = (*bpf).inner.table("page_dirtied") {
-                page_dirtied = crate::common::bpf::parse_u64(table.iter().next().unwrap().value);
-                let _ = table.set(&mut [0, 0, 0, 0], &mut [0, 0, 0, 0, 0, 0, 0, 0]);
-            }
+                value
+            };
+            let page_accessed = bpf.with_table("page_accessed", read_and_clear).unwrap_or(0);
+            let buffer_dirty = bpf.with_table("buffer_dirty", read_and_clear).unwrap_or(0);
+            let add_to_page_cache_lru = bpf
+                .with_table("add_to_page_cache_lru", read_and_clear)
+                .unwrap_or(0);
+            let page_dirtied = bpf.with_table("page_dirtied", read_and_clear).unwrap_or(0);
 
             // the logic here is taken from https://github.com/iovisor/bcc/blob/master/tools/cachestat.py
             let total = page_accessed.saturating_sub(buffer_dirty);
@@ -5,11 +5,12 @@
 use core::convert::TryFrom;
 use core::str::FromStr;
 
-use rustcommon_metrics::*;
 use serde_derive::{Deserialize, Serialize};
 use strum::ParseError;
 use strum_macros::{EnumIter, EnumString, IntoStaticStr};
 
+use crate::metrics::*;
+
 #[derive(
     Clone,
     Copy,
@@ -45,7 +46,7 @@ impl TryFrom<&str> for PageCacheStatistic {
     }
 }
 
-impl Statistic<AtomicU64, AtomicU32> for PageCacheStatistic {
+impl Statistic for PageCacheStatistic {
     fn name(&self) -> &str {
         (*self).into()
     }
@@ -0,0 +1,70 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+//! Reloading the config at runtime on SIGHUP.
+//!
+//! The config file is read again and the interval of each sampler, the
+//! general interval, and whether each sampler is enabled are applied to the
+//! running config, which the samplers check on every tick. A sampler whose
+//! interval changed takes a new ticker. A sampler which is disabled stops
+//! sampling and its BPF probes are detached, and enabling it again attaches
+//! them, or starts the sampler if it was not running. Any other change to the
+//! config needs a restart.
+
+use tokio::signal::unix::{signal, SignalKind};
+
+use crate::samplers::{Common, SAMPLERS};
+
+/// Reloads the config whenever the process receives SIGHUP
+pub fn listen(common: Common) {
+    let mut hangup = {
+        let _guard = common.runtime().enter();
+        match signal(SignalKind::hangup()) {
+            Ok(hangup) => hangup,
+            Err(e) => {
+                error!("failed to set handler for SIGHUP: {}", e);
+                return;
+            }
+        }
+    };
+    let reloader = common.clone();
+    common.runtime().spawn(async move {
+        while hangup.recv().await.is_some() {
+            // compiling bpf programs blocks the worker
+            tokio::task::block_in_place(|| reload(&reloader));
+        }
+    });
+}
+
+fn reload(common: &Common) {
+    info!("reloading config");
+    let changed = match common.config().reload() {
+        Ok(changed) => changed,
+        Err(e) => {
+            error!("failed to reload config: {}", e);
+            return;
+        }
+    };
+    // samplers which have ticked at least once
+    let running: Vec<&'static str> = common
+        .clock()
+        .samplers()
+        .iter()
+        .map(|stats| stats.name())
+        .collect();
+    for (name, enabled) in changed {
+        if !enabled {
+            info!("disabling {} sampler", name);
+            common.bpf().detach(name);
+        } else if running.contains(&name) {
+            info!("enabling {} sampler", name);
+            if let Err(e) = common.bpf().attach(name) {
+                error!("failed to attach bpf probes for {}: {}", name, e);
+            }
+        } else if let Some((_, spawn)) = SAMPLERS.iter().find(|(n, _)| *n == name) {
+            info!("starting {} sampler", name);
+            spawn(common.clone());
+        }
+    }
+}
@@ -0,0 +1,165 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+//! Replaying a captured archive through the samplers as a benchmark.
+//!
+//! Each of the samplers which only read procfs and sysfs is enabled and run
+//! over every tick of the archive, one sample after another without waiting
+//! for the interval. The files of each tick are extracted under `proc_root`
+//! and `sys_root` before the sample, outside of the time measured. The time
+//! of each sample, and its allocations with the `alloc_stats` feature, are
+//! reported for all but the first tick, which opens the files and registers
+//! the statistics. The samples parse and record the same contents on every
+//! run, without root, so results can be compared across builds.
+
+use std::io::{Error, ErrorKind};
+use std::path::Path;
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+use tokio::runtime::Builder;
+
+use crate::common::alloc::{self, Allocations};
+use crate::common::archive::Archive;
+use crate::config::{Config, SamplerConfig};
+use crate::metrics::Metrics;
+use crate::samplers::{
+    Common, Cpu, Disk, Interrupt, Memory, Network, Sampler, Scheduler, Softnet, Tcp, Udp,
+};
+
+struct Report {
+    name: &'static str,
+    durations: Vec<Duration>,
+    allocations: Allocations,
+}
+
+/// Runs the samplers over the archive and prints the cost of their samples
+pub fn run(config: Arc<Config>, archive: &Path) -> Result<(), Error> {
+    let archive = Archive::open(archive)?;
+    if archive.ticks() < 2 {
+        return Err(Error::new(
+            ErrorKind::InvalidData,
+            "archive needs at least two ticks",
+        ));
+    }
+    info!("replaying {} ticks", archive.ticks());
+
+    let samplers = config.samplers();
+    samplers.cpu().set_enabled(true);
+    samplers.disk().set_enabled(true);
+    samplers.interrupt().set_enabled(true);
+    samplers.memory().set_enabled(true);
+    samplers.network().set_enabled(true);
+    samplers.scheduler().set_enabled(true);
+    samplers.softnet().set_enabled(true);
+    samplers.tcp().set_enabled(true);
+    samplers.udp().set_enabled(true);
+
+    // the hardware info is read from the first tick
+    reset(&config, &archive)?;
+    let runtime = Arc::new(Builder::new_current_thread().enable_all().build()?);
+    let common = Common::new(config.clone(), Arc::new(Metrics::new()), runtime);
+
+    let reports = vec![
+        replay::<Cpu>(&common, &archive)?,
+        replay::<Disk>(&common, &archive)?,
+        replay::<Interrupt>(&common, &archive)?,
+        replay::<Memory>(&common, &archive)?,
+        replay::<Network>(&common, &archive)?,
+        replay::<Scheduler>(&common, &archive)?,
+        replay::<Softnet>(&common, &archive)?,
+        replay::<Tcp>(&common, &archive)?,
+        replay::<Udp>(&common, &archive)?,
+    ];
+
+    let general = config.general();
+    let _ = std::fs::remove_dir_all(general.proc_root());
+    let _ = std::fs::remove_dir_all(general.sys_root());
+    if let Some(dir) = general.proc_root().parent() {
+        let _ = std::fs::remove_dir(dir);
+    }
+
+    print(&reports);
+    Ok(())
+}
+
+// removes the files of the previous replay and extracts the first tick
+fn reset(config: &Config, archive: &Archive) -> Result<(), Error> {
+    let general = config.general();
+    for root in &[general.proc_root(), general.sys_root()] {
+        if let Err(e) = std::fs::remove_dir_all(root) {
+            if e.kind() != ErrorKind::NotFound {
+                return Err(e);
+            }
+        }
+    }
+    archive.extract(0, general.proc_root(), general.sys_root())
+}
+
+fn replay<S: Sampler>(common: &Common, archive: &Archive) -> Result<Report, Error> {
+    let config = common.config();
+    reset(config, archive)?;
+    let mut sampler =
+        S::new(common.clone()).map_err(|e| Error::new(ErrorKind::Other, e.to_string()))?;
+    let mut report = Report {
+        name: S::NAME,
+        durations: Vec::with_capacity(archive.ticks()),
+        allocations: Allocations::default(),
+    };
+    for tick in 0..archive.ticks() {
+        if tick > 0 {
+            archive.extract(
+                tick,
+                config.general().proc_root(),
+                config.general().sys_root(),
+            )?;
+        }
+        let start = Instant::now();
+        let allocations = Allocations::current();
+        common.runtime().block_on(sampler.sample())?;
+        if tick > 0 {
+            report.durations.push(start.elapsed());
+            let allocated = Allocations::current().since(allocations);
+            report.allocations.count += allocated.count;
+            report.allocations.bytes += allocated.bytes;
+        }
+    }
+    Ok(report)
+}
+
+fn print(reports: &[Report]) {
+    print!(
+        "{:<12} {:>8} {:>12} {:>12} {:>12}",
+        "sampler", "ticks", "mean (ns)", "p50 (ns)", "max (ns)"
+    );
+    if alloc::ENABLED {
+        print!(" {:>14} {:>14}", "allocs/tick", "bytes/tick");
+    }
+    println!();
+    for report in reports {
+        let mut nanos: Vec<u64> = report
+            .durations
+            .iter()
+            .map(|duration| duration.as_nanos() as u64)
+            .collect();
+        nanos.sort_unstable();
+        let ticks = nanos.len() as u64;
+        print!(
+            "{:<12} {:>8} {:>12} {:>12} {:>12}",
+            report.name,
+            ticks,
+            nanos.iter().sum::<u64>() / ticks,
+            nanos[nanos.len() / 2],
+            nanos[nanos.len() - 1]
+        );
+        if alloc::ENABLED {
+            print!(
+                " {:>14} {:>14}",
+                report.allocations.count / ticks,
+                report.allocations.bytes / ticks
+            );
+        }
+        println!();
+    }
+}
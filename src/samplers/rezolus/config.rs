@@ -2,10 +2,11 @@
 // Licensed under the Apache License, Version 2.0
 // http://www.apache.org/licenses/LICENSE-2.0
 
+use rustcommon_atomics::{AtomicBool, AtomicUsize};
 use serde_derive::Deserialize;
 use strum::IntoEnumIterator;
 
-use crate::config::SamplerConfig;
+use crate::config::{SamplerConfig, SummaryKind};
 
 use super::stat::*;
 
@@ -13,9 +14,15 @@ use super::stat::*;
 #[serde(deny_unknown_fields)]
 pub struct RezolusConfig {
     #[serde(default)]
-    enabled: bool,
+    bpf_stats: bool,
+    #[serde(default = "crate::config::disabled")]
+    enabled: AtomicBool,
+    #[serde(default = "crate::config::unset_interval")]
+    interval: AtomicUsize,
     #[serde(default)]
-    interval: Option<usize>,
+    priority: u8,
+    #[serde(default)]
+    summary: SummaryKind,
     #[serde(default = "crate::common::default_percentiles")]
     percentiles: Vec<f64>,
     #[serde(default = "default_statistics")]
@@ -25,14 +32,24 @@ pub struct RezolusConfig {
 impl Default for RezolusConfig {
     fn default() -> Self {
         Self {
-            enabled: Default::default(),
-            interval: Default::default(),
+            bpf_stats: Default::default(),
+            enabled: crate::config::disabled(),
+            interval: crate::config::unset_interval(),
+            priority: Default::default(),
+            summary: Default::default(),
             percentiles: crate::common::default_percentiles(),
             statistics: default_statistics(),
         }
     }
 }
 
+impl RezolusConfig {
+    /// enable kernel accounting of the runtime of BPF programs
+    pub fn bpf_stats(&self) -> bool {
+        self.bpf_stats
+    }
+}
+
 fn default_statistics() -> Vec<RezolusStatistic> {
     RezolusStatistic::iter().collect()
 }
@@ -40,12 +57,14 @@ fn default_statistics() -> Vec<RezolusStatistic> {
 impl SamplerConfig for RezolusConfig {
     type Statistic = RezolusStatistic;
 
-    fn enabled(&self) -> bool {
-        self.enabled
+    reloadable!();
+
+    fn priority(&self) -> u8 {
+        self.priority
     }
 
-    fn interval(&self) -> Option<usize> {
-        self.interval
+    fn summary(&self) -> SummaryKind {
+        self.summary
     }
 
     fn percentiles(&self) -> &[f64] {
@@ -53,6 +72,10 @@ impl SamplerConfig for RezolusConfig {
     }
 
     fn statistics(&self) -> Vec<<Self as SamplerConfig>::Statistic> {
-        self.statistics.clone()
+        self.statistics
+            .iter()
+            .filter(|statistic| crate::common::alloc::ENABLED || !statistic.is_allocation())
+            .copied()
+            .collect()
     }
 }
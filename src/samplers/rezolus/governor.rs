@@ -0,0 +1,128 @@
+// Copyright 2021 Twitter, Inc.
+// Licensed under the Apache License, Version 2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+
+use std::collections::HashMap;
+use std::sync::Arc;
+use std::time::Instant;
+
+use crate::common::clock::SamplerStats;
+
+// limit on how far an interval is stretched
+const MAX_SCALE: u64 = 16;
+
+// usage below this fraction of the budget restores stretched intervals, so
+// that an interval is not restored and stretched again on every update
+const RESTORE: f64 = 0.75;
+
+/// Keeps the CPU used by Rezolus within a budget by doubling the interval of
+/// one sampler per update while over budget, starting with the lowest
+/// priority and most expensive, and halving them again, highest priority
+/// first, once usage drops.
+pub struct Governor {
+    budget: f64,
+    // cpu time of the process and of each sampler at the last update
+    last: Option<(Instant, u64)>,
+    cpu_time: HashMap<&'static str, u64>,
+}
+
+impl Governor {
+    pub fn new(budget: f64) -> Self {
+        Self {
+            budget,
+            last: None,
+            cpu_time: HashMap::new(),
+        }
+    }
+
+    /// Updates with the total cpu time in nanoseconds used by the process
+    pub fn update(&mut self, time: Instant, cpu_time: u64, samplers: &[Arc<SamplerStats>]) {
+        // cost of each sampler since the last update. the rezolus sampler runs
+        // the governor and is never stretched.
+        let costs: Vec<(&SamplerStats, u64)> = samplers
+            .iter()
+            .filter(|s| s.name() != "rezolus")
+            .map(|s| {
+                let current = s.cpu_time();
+                let previous = self.cpu_time.insert(s.name(), current).unwrap_or(current);
+                (s.as_ref(), current.saturating_sub(previous))
+            })
+            .collect();
+
+        let usage = match self.last.replace((time, cpu_time)) {
+            Some((previous_time, previous)) => {
+                let elapsed = time.saturating_duration_since(previous_time).as_nanos();
+                if elapsed == 0 {
+                    return;
+                }
+                cpu_time.saturating_sub(previous) as f64 / elapsed as f64
+            }
+            None => return,
+        };
+
+        if usage > self.budget {
+            let sampler = costs
+                .iter()
+                .filter(|(s, _)| s.scale() < MAX_SCALE)
+                .min_by(|a, b| a.0.priority().cmp(&b.0.priority()).then(b.1.cmp(&a.1)));
+            if let Some((sampler, _)) = sampler {
+                sampler.set_scale(sampler.scale() * 2);
+                info!(
+                    "cpu usage {:.3} over budget of {:.3} cores, {} interval is now {}ms",
+                    usage,
+                    self.budget,
+                    sampler.name(),
+                    sampler.interval().as_millis()
+                );
+            }
+        } else if usage < self.budget * RESTORE {
+            let sampler = costs
+                .iter()
+                .filter(|(s, _)| s.scale() > 1)
+                .max_by(|a, b| a.0.priority().cmp(&b.0.priority()).then(b.1.cmp(&a.1)));
+            if let Some((sampler, _)) = sampler {
+                sampler.set_scale(sampler.scale() / 2);
+                info!(
+                    "cpu usage {:.3} under budget of {:.3} cores, {} interval is now {}ms",
+                    usage,
+                    self.budget,
+                    sampler.name(),
+                    sampler.interval().as_millis()
+                );
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use std::time::Duration;
+
+    #[test]
+    fn stretch_and_restore() {
+        let second = Duration::from_secs(1);
+        let low = Arc::new(SamplerStats::new("low", second, 0));
+        let high = Arc::new(SamplerStats::new("high", second, 1));
+        let samplers = vec![low.clone(), high.clone()];
+
+        let mut governor = Governor::new(0.1);
+        let start = Instant::now();
+        governor.update(start, 0, &samplers);
+
+        // half a core, the low priority sampler is stretched first
+        for i in 1..=5 {
+            governor.update(start + second * i, i as u64 * 500_000_000, &samplers);
+        }
+        assert_eq!(low.scale(), MAX_SCALE);
+        assert_eq!(high.scale(), 2);
+        assert_eq!(high.interval(), second * 2);
+
+        // idle, the high priority sampler is restored first
+        governor.update(start + second * 6, 2_500_000_000, &samplers);
+        assert_eq!(high.scale(), 1);
+        assert_eq!(low.scale(), MAX_SCALE);
+        governor.update(start + second * 7, 2_500_000_000, &samplers);
+        assert_eq!(low.scale(), MAX_SCALE / 2);
+    }
+}
@@ -2,25 +2,27 @@
 // Licensed under the Apache License, Version 2.0
 // http://www.apache.org/licenses/LICENSE-2.0
 
-use std::collections::HashMap;
-use std::io::SeekFrom;
+use std::collections::{HashMap, HashSet};
 
 use async_trait::async_trait;
-use tokio::fs::File;
-use tokio::io::{AsyncBufReadExt, AsyncSeekExt, BufReader};
 
+use crate::common::procfs::{self, ProcFile};
 use crate::common::*;
 use crate::config::SamplerConfig;
+use crate::metrics::{Output, Source, Statistic};
 use crate::samplers::Common;
 use crate::Sampler;
 use std::time::*;
 
 mod config;
+mod governor;
 mod stat;
 
 pub use config::*;
 pub use stat::*;
 
+use governor::Governor;
+
 pub fn nanos_per_tick() -> u64 {
     let ticks_per_second = sysconf::raw::sysconf(sysconf::raw::SysconfVariable::ScClkTck)
         .expect("Failed to get Clock Ticks per Second") as u64;
@@ -28,24 +30,71 @@ pub fn nanos_per_tick() -> u64 {
 }
 
 pub struct Rezolus {
+    // holds kernel accounting of bpf program runtime enabled while open
+    #[cfg(feature = "bpf")]
+    _bpf_stats: Option<std::fs::File>,
+    #[cfg(feature = "bpf")]
+    bpf_programs: HashSet<(String, RezolusStatistic)>,
+    // run count and time of each loaded program by id, and those of programs
+    // which have since been unloaded by name, so that the counters do not go
+    // backwards when a sampler detaches its programs
+    #[cfg(feature = "bpf")]
+    bpf_loaded: HashMap<u32, (String, u64, u64)>,
+    #[cfg(feature = "bpf")]
+    bpf_unloaded: HashMap<String, (u64, u64)>,
     common: Common,
+    cpu_time: Option<u64>,
+    durations: Vec<u64>,
+    governor: Option<Governor>,
     nanos_per_tick: u64,
-    proc_stat: Option<File>,
-    proc_statm: Option<File>,
+    proc_stat: Option<ProcFile>,
+    proc_statm: Option<ProcFile>,
+    samplers: HashSet<(&'static str, RezolusStatistic)>,
     statistics: Vec<RezolusStatistic>,
 }
 
 #[async_trait]
 impl Sampler for Rezolus {
     type Statistic = RezolusStatistic;
+    const NAME: &'static str = "rezolus";
 
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let statistics = common.config().samplers().rezolus().statistics();
+
+        #[cfg(feature = "bpf")]
+        let bpf_stats = if common.config().samplers().rezolus().bpf_stats() {
+            match crate::common::bpf::stats::enable() {
+                Ok(fd) => fd,
+                Err(e) => {
+                    if !common.config().general().fault_tolerant() {
+                        fatal!("failed to enable bpf stats: {}", e);
+                    } else {
+                        error!("failed to enable bpf stats: {}", e);
+                    }
+                    None
+                }
+            }
+        } else {
+            None
+        };
+
         let sampler = Self {
+            #[cfg(feature = "bpf")]
+            _bpf_stats: bpf_stats,
+            #[cfg(feature = "bpf")]
+            bpf_programs: HashSet::new(),
+            #[cfg(feature = "bpf")]
+            bpf_loaded: HashMap::new(),
+            #[cfg(feature = "bpf")]
+            bpf_unloaded: HashMap::new(),
+            governor: common.config().general().cpu_budget().map(Governor::new),
             common,
+            cpu_time: None,
+            durations: Vec::new(),
             nanos_per_tick: nanos_per_tick() as u64,
             proc_stat: None,
             proc_statm: None,
+            samplers: HashSet::new(),
             statistics,
         };
         if sampler.sampler_config().enabled() {
@@ -56,12 +105,8 @@ impl Sampler for Rezolus {
 
     fn spawn(common: Common) {
         if common.config().samplers().rezolus().enabled() {
-            if let Ok(mut sampler) = Self::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = sampler.sample().await;
-                    }
-                });
+            if let Ok(sampler) = Self::new(common.clone()) {
+                common.runtime().spawn(sampler.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize rezolus sampler");
             } else {
@@ -83,51 +128,219 @@ impl Sampler for Rezolus {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
 
         debug!("sampling");
-        let r = self.sample_memory().await;
+        let r = self.sample_memory();
         self.map_result(r)?;
 
-        let r = self.sample_cpu().await;
+        let r = self.sample_cpu();
         self.map_result(r)?;
 
+        if let (Some(governor), Some(cpu_time)) = (&mut self.governor, self.cpu_time) {
+            governor.update(
+                self.common.timestamp(),
+                cpu_time,
+                &self.common.clock().samplers(),
+            );
+        }
+
+        self.sample_samplers();
+        self.sample_metrics();
+
+        #[cfg(feature = "bpf")]
+        {
+            let r = self.sample_bpf();
+            self.map_result(r)?;
+        }
+
         Ok(())
     }
 }
 
 impl Rezolus {
-    async fn sample_cpu(&mut self) -> Result<(), std::io::Error> {
+    fn sample_samplers(&mut self) {
+        let statistics: Vec<RezolusStatistic> = self
+            .statistics
+            .iter()
+            .filter(|s| s.is_sampler())
+            .copied()
+            .collect();
+        if statistics.is_empty() {
+            return;
+        }
+
+        let time = self.common().timestamp();
+        let mut totals = HashMap::new();
+        for sampler in self.common().clock().samplers() {
+            sampler.take_durations(&mut self.durations);
+            for statistic in &statistics {
+                let per_sampler = SamplerStatistic::new(sampler.name(), *statistic);
+                if self.samplers.insert((sampler.name(), *statistic)) {
+                    self.register_sampler(&per_sampler);
+                }
+                let value = match statistic {
+                    RezolusStatistic::SamplerDuration => {
+                        for duration in &self.durations {
+                            let _ = self
+                                .metrics()
+                                .record_bucket(&per_sampler, time, *duration, 1);
+                            let _ = self.metrics().record_bucket(statistic, time, *duration, 1);
+                        }
+                        continue;
+                    }
+                    RezolusStatistic::SamplerCpuTime => sampler.cpu_time(),
+                    RezolusStatistic::SamplerMissedTicks => sampler.missed(),
+                    RezolusStatistic::SamplerLateTicks => sampler.late(),
+                    RezolusStatistic::SamplerSkipped => sampler.skipped(),
+                    RezolusStatistic::SamplerAllocations => sampler.allocations(),
+                    RezolusStatistic::SamplerAllocatedBytes => sampler.allocated_bytes(),
+                    RezolusStatistic::SamplerInterval => {
+                        let value = sampler.interval().as_millis() as u64;
+                        let _ = self.metrics().record_gauge(&per_sampler, time, value);
+                        let max = totals.entry(*statistic).or_insert(0);
+                        *max = value.max(*max);
+                        continue;
+                    }
+                    _ => continue,
+                };
+                let _ = self.metrics().record_counter(&per_sampler, time, value);
+                *totals.entry(*statistic).or_insert(0) += value;
+            }
+        }
+        for (statistic, value) in totals {
+            if statistic.source() == Source::Gauge {
+                let _ = self.metrics().record_gauge(&statistic, time, value);
+            } else {
+                let _ = self.metrics().record_counter(&statistic, time, value);
+            }
+        }
+    }
+
+    // registers the statistic of one sampler, with percentiles for the
+    // duration histogram
+    fn register_sampler(&self, statistic: &SamplerStatistic) {
+        let metrics = self.common().metrics();
+        metrics.register(statistic);
+        metrics.add_output(statistic, Output::Reading);
+        if statistic.source() == Source::Distribution {
+            metrics.add_summary(statistic, self.heatmap());
+            self.add_percentiles(statistic);
+        }
+    }
+
+    #[cfg(feature = "bpf")]
+    fn sample_bpf(&mut self) -> Result<(), std::io::Error> {
+        let statistics: Vec<RezolusStatistic> = self
+            .statistics
+            .iter()
+            .filter(|s| {
+                matches!(
+                    s,
+                    RezolusStatistic::BpfRunCount | RezolusStatistic::BpfRunTime
+                )
+            })
+            .copied()
+            .collect();
+        if statistics.is_empty() {
+            return Ok(());
+        }
+
+        // a program which is unloaded keeps the counts it had when last
+        // sampled. ids are not reused, so a program loaded again is new.
+        let current = crate::common::bpf::stats::programs()?;
+        let ids: HashSet<u32> = current.iter().map(|program| program.id).collect();
+        let unloaded = &mut self.bpf_unloaded;
+        self.bpf_loaded.retain(|id, (name, count, run_time)| {
+            if ids.contains(id) {
+                return true;
+            }
+            let entry = unloaded.entry(name.clone()).or_default();
+            entry.0 += *count;
+            entry.1 += *run_time;
+            false
+        });
+        for program in current {
+            self.bpf_loaded.insert(
+                program.id,
+                (program.name, program.run_cnt, program.run_time_ns),
+            );
+        }
+
+        // programs with the same name, such as a handler loaded by more than
+        // one sampler, are reported together
+        let mut programs = self.bpf_unloaded.clone();
+        for (name, count, run_time) in self.bpf_loaded.values() {
+            let entry = programs.entry(name.clone()).or_default();
+            entry.0 += count;
+            entry.1 += run_time;
+        }
+
+        let time = self.common().timestamp();
+        for statistic in statistics {
+            let value = |&(count, run_time): &(u64, u64)| {
+                if statistic == RezolusStatistic::BpfRunTime {
+                    run_time
+                } else {
+                    count
+                }
+            };
+            let total: u64 = programs.values().map(value).sum();
+            let _ = self.metrics().record_counter(&statistic, time, total);
+
+            for (name, values) in &programs {
+                let program = BpfProgramStatistic::new(name, statistic);
+                if self.bpf_programs.insert((name.clone(), statistic)) {
+                    self.common().metrics().register(&program);
+                    self.common()
+                        .metrics()
+                        .add_output(&program, Output::Reading);
+                }
+                let _ = self
+                    .common()
+                    .metrics()
+                    .record_counter(&program, time, value(values));
+            }
+        }
+
+        Ok(())
+    }
+
+    fn sample_cpu(&mut self) -> Result<(), std::io::Error> {
         if self.proc_stat.is_none() {
+            // the process is looked up in its own procfs rather than under
+            // `proc_root`, where its pid may belong to another process
             let pid: u32 = std::process::id();
             let path = format!("/proc/{}/stat", pid);
-            let file = File::open(path).await?;
+            let file = ProcFile::open(path)?;
             self.proc_stat = Some(file);
         }
 
         if let Some(file) = &mut self.proc_stat {
-            file.seek(SeekFrom::Start(0)).await?;
-            let mut reader = BufReader::new(file);
             let mut result = HashMap::new();
-            let mut line = String::new();
-            if reader.read_line(&mut line).await? > 0 {
-                let parts: Vec<&str> = line.split_whitespace().collect();
-                let user = parts.get(13).map(|v| v.parse().unwrap_or(0)).unwrap_or(0)
-                    + parts.get(15).map(|v| v.parse().unwrap_or(0)).unwrap_or(0);
-                let system = parts.get(14).map(|v| v.parse().unwrap_or(0)).unwrap_or(0)
-                    + parts.get(16).map(|v| v.parse().unwrap_or(0)).unwrap_or(0);
-                result.insert(RezolusStatistic::CpuUser, user * self.nanos_per_tick);
-                result.insert(RezolusStatistic::CpuSystem, system * self.nanos_per_tick);
-                line.clear();
+            if let Some(line) = file.lines()?.next() {
+                // utime, stime, cutime and cstime are fields 13 to 16
+                let mut parts = procfs::fields(line)
+                    .skip(13)
+                    .map(|v| procfs::parse_u64(v).unwrap_or(0));
+                let utime = parts.next().unwrap_or(0);
+                let stime = parts.next().unwrap_or(0);
+                let cutime = parts.next().unwrap_or(0);
+                let cstime = parts.next().unwrap_or(0);
+                self.cpu_time = Some((utime + stime + cutime + cstime) * self.nanos_per_tick);
+                result.insert(
+                    RezolusStatistic::CpuUser,
+                    (utime + cutime) * self.nanos_per_tick,
+                );
+                result.insert(
+                    RezolusStatistic::CpuSystem,
+                    (stime + cstime) * self.nanos_per_tick,
+                );
             }
 
-            let time = Instant::now();
+            let time = self.common().timestamp();
             for statistic in &self.statistics {
                 if let Some(value) = result.get(statistic) {
                     let _ = self.metrics().record_counter(statistic, time, *value);
@@ -138,29 +351,58 @@ impl Rezolus {
         Ok(())
     }
 
-    async fn sample_memory(&mut self) -> Result<(), std::io::Error> {
+    // reports the size of the metrics registry and its limits on dynamic
+    // series, and the allocations made by the exposition
+    fn sample_metrics(&self) {
+        let time = self.common().timestamp();
+        let metrics = self.metrics();
+        for statistic in &self.statistics {
+            let _ = match statistic {
+                RezolusStatistic::MetricsSeries => {
+                    metrics.record_gauge(statistic, time, metrics.series() as u64)
+                }
+                RezolusStatistic::MetricsBytes => {
+                    metrics.record_gauge(statistic, time, metrics.bytes() as u64)
+                }
+                RezolusStatistic::MetricsEvicted => {
+                    metrics.record_counter(statistic, time, metrics.evicted())
+                }
+                RezolusStatistic::MetricsRejected => {
+                    metrics.record_counter(statistic, time, metrics.rejected())
+                }
+                RezolusStatistic::ExpositionRequests => {
+                    metrics.record_counter(statistic, time, alloc::exposition().events())
+                }
+                RezolusStatistic::ExpositionAllocations => {
+                    metrics.record_counter(statistic, time, alloc::exposition().allocations())
+                }
+                RezolusStatistic::ExpositionAllocatedBytes => {
+                    metrics.record_counter(statistic, time, alloc::exposition().bytes())
+                }
+                _ => continue,
+            };
+        }
+    }
+
+    fn sample_memory(&mut self) -> Result<(), std::io::Error> {
         if self.proc_statm.is_none() {
             let pid: u32 = std::process::id();
             let path = format!("/proc/{}/statm", pid);
-            let file = File::open(path).await?;
+            let file = ProcFile::open(path)?;
             self.proc_statm = Some(file);
         }
 
         if let Some(file) = &mut self.proc_statm {
-            file.seek(SeekFrom::Start(0)).await?;
             let mut result_memory = HashMap::new();
-            let mut reader = BufReader::new(file);
-            let mut line = String::new();
-            if reader.read_line(&mut line).await? > 0 {
-                let parts: Vec<&str> = line.split_whitespace().collect();
-                let vm = parts.get(0).map(|v| v.parse().unwrap_or(0)).unwrap_or(0);
-                let rss = parts.get(1).map(|v| v.parse().unwrap_or(0)).unwrap_or(0);
+            if let Some(line) = file.lines()?.next() {
+                let mut parts = procfs::fields(line).map(|v| procfs::parse_u64(v).unwrap_or(0));
+                let vm = parts.next().unwrap_or(0);
+                let rss = parts.next().unwrap_or(0);
                 result_memory.insert(RezolusStatistic::MemoryVirtual, vm);
                 result_memory.insert(RezolusStatistic::MemoryResident, rss);
-                line.clear();
             }
 
-            let time = Instant::now();
+            let time = self.common().timestamp();
             for statistic in &self.statistics {
                 if let Some(value) = result_memory.get(statistic) {
                     let _ = self.metrics().record_gauge(statistic, time, *value * 4096);
@@ -5,11 +5,12 @@
 use core::convert::TryFrom;
 use core::str::FromStr;
 
-use rustcommon_metrics::*;
 use serde_derive::{Deserialize, Serialize};
 use strum::ParseError;
 use strum_macros::{EnumIter, EnumString, IntoStaticStr};
 
+use crate::metrics::*;
+
 #[derive(
     Clone,
     Copy,
@@ -33,21 +34,148 @@ pub enum RezolusStatistic {
     MemoryVirtual,
     #[strum(serialize = "rezolus/memory/resident")]
     MemoryResident,
+    #[strum(serialize = "rezolus/bpf/run_count")]
+    BpfRunCount,
+    #[strum(serialize = "rezolus/bpf/run_time")]
+    BpfRunTime,
+    #[strum(serialize = "rezolus/sampler/duration")]
+    SamplerDuration,
+    #[strum(serialize = "rezolus/sampler/cpu_time")]
+    SamplerCpuTime,
+    #[strum(serialize = "rezolus/sampler/missed_ticks")]
+    SamplerMissedTicks,
+    #[strum(serialize = "rezolus/sampler/late_ticks")]
+    SamplerLateTicks,
+    #[strum(serialize = "rezolus/sampler/skipped")]
+    SamplerSkipped,
+    #[strum(serialize = "rezolus/sampler/interval")]
+    SamplerInterval,
+    #[strum(serialize = "rezolus/sampler/allocations")]
+    SamplerAllocations,
+    #[strum(serialize = "rezolus/sampler/allocated_bytes")]
+    SamplerAllocatedBytes,
+    #[strum(serialize = "rezolus/exposition/requests")]
+    ExpositionRequests,
+    #[strum(serialize = "rezolus/exposition/allocations")]
+    ExpositionAllocations,
+    #[strum(serialize = "rezolus/exposition/allocated_bytes")]
+    ExpositionAllocatedBytes,
+    #[strum(serialize = "rezolus/metrics/series")]
+    MetricsSeries,
+    #[strum(serialize = "rezolus/metrics/bytes")]
+    MetricsBytes,
+    #[strum(serialize = "rezolus/metrics/evicted")]
+    MetricsEvicted,
+    #[strum(serialize = "rezolus/metrics/rejected")]
+    MetricsRejected,
+}
+
+impl RezolusStatistic {
+    /// Statistics which are reported for each sampler
+    pub fn is_sampler(self) -> bool {
+        matches!(
+            self,
+            Self::SamplerDuration
+                | Self::SamplerCpuTime
+                | Self::SamplerMissedTicks
+                | Self::SamplerLateTicks
+                | Self::SamplerSkipped
+                | Self::SamplerInterval
+                | Self::SamplerAllocations
+                | Self::SamplerAllocatedBytes
+        )
+    }
+
+    /// Statistics which are only available with the `alloc_stats` feature
+    pub fn is_allocation(self) -> bool {
+        matches!(
+            self,
+            Self::SamplerAllocations
+                | Self::SamplerAllocatedBytes
+                | Self::ExpositionRequests
+                | Self::ExpositionAllocations
+                | Self::ExpositionAllocatedBytes
+        )
+    }
 }
 
-impl Statistic<AtomicU64, AtomicU32> for RezolusStatistic {
+impl Statistic for RezolusStatistic {
     fn name(&self) -> &str {
         (*self).into()
     }
 
     fn source(&self) -> Source {
         match self {
-            Self::MemoryVirtual | Self::MemoryResident => Source::Gauge,
+            Self::MemoryVirtual
+            | Self::MemoryResident
+            | Self::SamplerInterval
+            | Self::MetricsSeries
+            | Self::MetricsBytes => Source::Gauge,
+            Self::SamplerDuration => Source::Distribution,
             _ => Source::Counter,
         }
     }
 }
 
+/// Per-program BPF runtime, named `rezolus/bpf/<program>/run_count` or
+/// `rezolus/bpf/<program>/run_time`
+#[derive(Debug, Eq, PartialEq, Hash)]
+pub struct BpfProgramStatistic {
+    inner: String,
+}
+
+impl BpfProgramStatistic {
+    pub fn new(program: &str, statistic: RezolusStatistic) -> Self {
+        let suffix = match statistic {
+            RezolusStatistic::BpfRunTime => "run_time",
+            _ => "run_count",
+        };
+        Self {
+            inner: format!("rezolus/bpf/{}/{}", program, suffix),
+        }
+    }
+}
+
+impl Statistic for BpfProgramStatistic {
+    fn name(&self) -> &str {
+        &self.inner
+    }
+
+    fn source(&self) -> Source {
+        Source::Counter
+    }
+}
+
+/// Self-instrumentation of one sampler, named `rezolus/sampler/<sampler>/`
+/// followed by `duration`, `cpu_time`, `missed_ticks`, `late_ticks`,
+/// `skipped`, `interval`, `allocations` or `allocated_bytes`
+#[derive(Debug, Eq, PartialEq, Hash)]
+pub struct SamplerStatistic {
+    inner: String,
+    statistic: RezolusStatistic,
+}
+
+impl SamplerStatistic {
+    pub fn new(sampler: &str, statistic: RezolusStatistic) -> Self {
+        let name: &str = statistic.into();
+        let suffix = name.rsplit('/').next().unwrap_or(name);
+        Self {
+            inner: format!("rezolus/sampler/{}/{}", sampler, suffix),
+            statistic,
+        }
+    }
+}
+
+impl Statistic for SamplerStatistic {
+    fn name(&self) -> &str {
+        &self.inner
+    }
+
+    fn source(&self) -> Source {
+        self.statistic.source()
+    }
+}
+
 impl TryFrom<&str> for RezolusStatistic {
     type Error = ParseError;
 
@@ -5,25 +5,25 @@
 #include <linux/nsproxy.h>
 #include <linux/pid_namespace.h>
 
-typedef struct pid_key {
+typedef struct NS(pid_key) {
     u64 id;
     u64 slot;
-} pid_key_t;
+} NS(pid_key_t);
 
-typedef struct pidns_key {
+typedef struct NS(pidns_key) {
     u64 id;
     u64 slot;
-} pidns_key_t;
+} NS(pidns_key_t);
 
-BPF_TABLE("hash", u32, u64, start, 65536);
+BPF_TABLE("hash", u32, u64, NS(start), 65536);
 
 // value_to_index() gives us from 0-460 as the index
-BPF_HISTOGRAM(runqueue_latency, int, 461);
+BPF_HISTOGRAM(NS(runqueue_latency), int, 461);
 
 struct rq;
 
 // from /sys/kernel/debug/tracing/events/sched/sched_wakeup/format
-struct sched_wakeup_arg {
+struct NS(sched_wakeup_arg) {
     u64 __unused__;
     char comm[16];
     pid_t pid;
@@ -32,26 +32,26 @@ struct sched_wakeup_arg {
     int target_cpu;
 };
 
-static int trace_enqueue(u32 tgid, u32 pid)
+static int NS(trace_enqueue)(u32 tgid, u32 pid)
 {
     u64 ts = bpf_ktime_get_ns();
-    start.update(&pid, &ts);
+    NS(start).update(&pid, &ts);
     return 0;
 }
 
-int trace_wake_up_new_task(struct pt_regs *ctx, struct task_struct *p)
+int NS(trace_wake_up_new_task)(struct pt_regs *ctx, struct task_struct *p)
 {
-    return trace_enqueue(p->tgid, p->pid);
+    return NS(trace_enqueue)(p->tgid, p->pid);
 }
 
-int trace_ttwu_do_wakeup(struct pt_regs *ctx, struct rq *rq, struct task_struct *p,
+int NS(trace_ttwu_do_wakeup)(struct pt_regs *ctx, struct rq *rq, struct task_struct *p,
     int wake_flags)
 {
-    return trace_enqueue(p->tgid, p->pid);
+    return NS(trace_enqueue)(p->tgid, p->pid);
 }
 
 // from /sys/kernel/debug/tracing/events/sched/sched_switch/format
-struct sched_switch_arg {
+struct NS(sched_switch_arg) {
     u64 __unused__;
     char prev_comm[16];
     pid_t prev_pid;
@@ -63,7 +63,7 @@ struct sched_switch_arg {
 };
 
 // histogram indexing
-static unsigned int value_to_index2(unsigned int value) {
+static unsigned int NS(value_to_index2)(unsigned int value) {
     unsigned int index = 460;
     if (value < 100) {
         // 0-99 => [0..100)
@@ -96,14 +96,14 @@ static unsigned int value_to_index2(unsigned int value) {
     return index;
 }
 
-int trace_run(struct pt_regs *ctx, struct task_struct *prev)
+int NS(trace_run)(struct pt_regs *ctx, struct task_struct *prev)
 {
     // handle involuntary context switch
     if (prev->state == TASK_RUNNING) {
         u32 tgid = prev->tgid;
         u32 pid = prev->pid;
         u64 ts = bpf_ktime_get_ns();
-        start.update(&pid, &ts);
+        NS(start).update(&pid, &ts);
     }
 
     // get tgid and pid
@@ -111,7 +111,7 @@ int trace_run(struct pt_regs *ctx, struct task_struct *prev)
     u32 pid = bpf_get_current_pid_tgid();
 
     // lookup start time
-    u64 *tsp = start.lookup(&pid);
+    u64 *tsp = NS(start).lookup(&pid);
 
     // skip events with unknown start
     if (tsp == 0) {
@@ -122,10 +122,10 @@ int trace_run(struct pt_regs *ctx, struct task_struct *prev)
     u64 delta = (bpf_ktime_get_ns() - *tsp) / 1000;
 
     // calculate index and increment histogram
-    unsigned int index = value_to_index2(delta);
-    runqueue_latency.increment(index);
+    unsigned int index = NS(value_to_index2)(delta);
+    NS(runqueue_latency).increment(index);
 
     // clear the start time
-    start.delete(&pid);
+    NS(start).delete(&pid);
     return 0;
 }
@@ -3,7 +3,6 @@
 // http://www.apache.org/licenses/LICENSE-2.0
 
 use std::collections::HashMap;
-use std::io::SeekFrom;
 use std::sync::{Arc, Mutex};
 use std::time::*;
 
@@ -12,12 +11,11 @@ use async_trait::async_trait;
 use bcc::perf_event::{Event, SoftwareEvent};
 #[cfg(feature = "bpf")]
 use bcc::{PerfEvent, PerfEventArray};
-use rustcommon_metrics::{Source, Statistic};
-use tokio::fs::File;
-use tokio::io::{AsyncBufReadExt, AsyncSeekExt, BufReader};
 
 use crate::common::bpf::*;
+use crate::common::procfs::{self, ProcFile};
 use crate::config::SamplerConfig;
+use crate::metrics::{Handle, Source, Statistic};
 use crate::samplers::Common;
 use crate::Sampler;
 
@@ -29,17 +27,19 @@ pub use stat::*;
 
 #[allow(dead_code)]
 pub struct Scheduler {
-    bpf: Option<Arc<Mutex<BPF>>>,
+    bpf: Option<BpfHandle>,
     bpf_last: Arc<Mutex<Instant>>,
     common: Common,
     perf: Option<Arc<Mutex<BPF>>>,
-    proc_stat: Option<File>,
+    proc_stat: Option<ProcFile>,
+    handles: Vec<Handle>,
     statistics: Vec<SchedulerStatistic>,
 }
 
 #[async_trait]
 impl Sampler for Scheduler {
     type Statistic = SchedulerStatistic;
+    const NAME: &'static str = "scheduler";
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let fault_tolerant = common.config.general().fault_tolerant();
         let statistics = common.config().samplers().scheduler().statistics();
@@ -51,11 +51,17 @@ impl Sampler for Scheduler {
             common,
             perf: None,
             proc_stat: None,
+            handles: Vec::new(),
             statistics,
         };
 
         if sampler.sampler_config().enabled() {
             sampler.register();
+            #[cfg(feature = "bpf")]
+            {
+                sampler.handles =
+                    sampler.resolve_histograms(&sampler.statistics, crate::MICROSECOND);
+            }
         }
 
         if let Err(e) = sampler.initialize_bpf() {
@@ -89,12 +95,8 @@ impl Sampler for Scheduler {
 
     fn spawn(common: Common) {
         if common.config().samplers().scheduler().enabled() {
-            if let Ok(mut sampler) = Self::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = sampler.sample().await;
-                    }
-                });
+            if let Ok(sampler) = Self::new(common.clone()) {
+                common.runtime().spawn(sampler.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize scheduler sampler");
             } else {
@@ -116,10 +118,6 @@ impl Sampler for Scheduler {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
@@ -131,7 +129,7 @@ impl Sampler for Scheduler {
         #[cfg(feature = "bpf")]
         self.map_result(self.sample_bpf_perf_counters())?;
 
-        let r = self.sample_proc_stat().await;
+        let r = self.sample_proc_stat();
         self.map_result(r)?;
         #[cfg(feature = "bpf")]
         self.map_result(self.sample_bpf())?;
@@ -143,7 +141,7 @@ impl Sampler for Scheduler {
 impl Scheduler {
     #[cfg(feature = "bpf")]
     fn initialize_bpf_perf(&mut self) -> Result<(), std::io::Error> {
-        let cpus = crate::common::hardware_threads().unwrap();
+        let cpus = crate::common::hardware_threads(self.general_config().sys_root()).unwrap();
         let interval = self.interval() as u64;
         let frequency = if interval > 1000 {
             1
@@ -200,20 +198,17 @@ impl Scheduler {
         Ok(())
     }
 
-    async fn sample_proc_stat(&mut self) -> Result<(), std::io::Error> {
+    fn sample_proc_stat(&mut self) -> Result<(), std::io::Error> {
         if self.proc_stat.is_none() {
-            let file = File::open("/proc/stat").await?;
+            let file = ProcFile::open(self.proc_path("stat"))?;
             self.proc_stat = Some(file);
         }
 
         if let Some(file) = &mut self.proc_stat {
-            file.seek(SeekFrom::Start(0)).await?;
-            let mut reader = BufReader::new(file);
-            let mut line = String::new();
             let mut result = HashMap::new();
 
-            while reader.read_line(&mut line).await? > 0 {
-                let mut split = line.split_whitespace();
+            for line in file.lines()? {
+                let mut split = procfs::fields(line).map(procfs::as_str);
                 if let Some(stat) = match split.next() {
                     Some("ctxt") => Some(SchedulerStatistic::ContextSwitches),
                     Some("processes") => Some(SchedulerStatistic::ProcessesCreated),
@@ -224,9 +219,8 @@ impl Scheduler {
                     let value = split.next().map(|v| v.parse().unwrap_or(0)).unwrap_or(0);
                     result.insert(stat, value);
                 }
-                line.clear();
             }
-            let time = Instant::now();
+            let time = self.common().timestamp();
             for statistic in &self.statistics {
                 if let Some(value) = result.get(statistic) {
                     match statistic.source() {
@@ -247,28 +241,23 @@ impl Scheduler {
 
     #[cfg(feature = "bpf")]
     fn sample_bpf(&self) -> Result<(), std::io::Error> {
-        use crate::common::MICROSECOND;
-
         // sample bpf
         {
             if self.bpf_last.lock().unwrap().elapsed()
                 >= Duration::new(self.general_config().window() as u64, 0)
             {
                 if let Some(ref bpf) = self.bpf {
-                    let bpf = bpf.lock().unwrap();
-                    let time = Instant::now();
-                    for statistic in self.statistics.iter().filter(|s| s.bpf_table().is_some()) {
-                        if let Ok(mut table) = (*bpf).inner.table(statistic.bpf_table().unwrap()) {
-                            for (&value, &count) in &map_from_table(&mut table) {
-                                if count > 0 {
-                                    let _ = self.metrics().record_bucket(
-                                        statistic,
-                                        time,
-                                        value * MICROSECOND,
-                                        count,
-                                    );
-                                }
-                            }
+                    let time = self.common().timestamp();
+                    for (statistic, handle) in self
+                        .statistics
+                        .iter()
+                        .zip(&self.handles)
+                        .filter(|(s, _)| s.bpf_table().is_some())
+                    {
+                        if let Some(counts) =
+                            bpf.with_table(statistic.bpf_table().unwrap(), histogram_from_table)
+                        {
+                            handle.record_histogram(time, &counts);
                         }
                     }
                 }
@@ -283,7 +272,7 @@ impl Scheduler {
     fn sample_bpf_perf_counters(&self) -> Result<(), std::io::Error> {
         if let Some(ref bpf) = self.perf {
             let bpf = bpf.lock().unwrap();
-            let time = Instant::now();
+            let time = self.common().timestamp();
             for stat in self.statistics.iter().filter(|s| s.perf_table().is_some()) {
                 if let Ok(table) = &(*bpf).inner.table(stat.perf_table().unwrap()) {
                     let map = crate::common::bpf::perf_table_to_map(table);
@@ -321,23 +310,14 @@ impl Scheduler {
                 debug!("initializing bpf");
                 // load the code and compile
                 let code = include_str!("bpf.c");
-                let mut bpf = bcc::BPF::new(code)?;
 
                 // load + attach kprobes!
-                bcc::Kprobe::new()
-                    .handler("trace_run")
-                    .function("finish_task_switch")
-                    .attach(&mut bpf)?;
-                bcc::Kprobe::new()
-                    .handler("trace_ttwu_do_wakeup")
-                    .function("ttwu_do_wakeup")
-                    .attach(&mut bpf)?;
-                bcc::Kprobe::new()
-                    .handler("trace_wake_up_new_task")
-                    .function("wake_up_new_task")
-                    .attach(&mut bpf)?;
-
-                self.bpf = Some(Arc::new(Mutex::new(BPF { inner: bpf })));
+                let program = BpfProgram::new("scheduler", code)
+                    .kprobe("trace_run", "finish_task_switch")
+                    .kprobe("trace_ttwu_do_wakeup", "ttwu_do_wakeup")
+                    .kprobe("trace_wake_up_new_task", "wake_up_new_task");
+
+                self.bpf = Some(self.common.bpf().load(program)?);
             }
         }
 
@@ -3,14 +3,11 @@
 // http://www.apache.org/licenses/LICENSE-2.0
 
 use std::collections::HashMap;
-use std::io::SeekFrom;
 use std::time::*;
 
 use async_trait::async_trait;
 
-use tokio::fs::File;
-use tokio::io::{AsyncBufReadExt, AsyncSeekExt, BufReader};
-
+use crate::common::procfs::{self, ProcFile};
 use crate::config::SamplerConfig;
 use crate::samplers::Common;
 use crate::Sampler;
@@ -23,13 +20,14 @@ pub use stat::*;
 
 pub struct Softnet {
     common: Common,
-    softnet_stat: Option<File>,
+    softnet_stat: Option<ProcFile>,
     statistics: Vec<SoftnetStatistic>,
 }
 
 #[async_trait]
 impl Sampler for Softnet {
     type Statistic = SoftnetStatistic;
+    const NAME: &'static str = "softnet";
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let statistics = common.config().samplers().softnet().statistics();
         let sampler = Self {
@@ -45,12 +43,8 @@ impl Sampler for Softnet {
 
     fn spawn(common: Common) {
         if common.config().samplers().softnet().enabled() {
-            if let Ok(mut sampler) = Self::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = sampler.sample().await;
-                    }
-                });
+            if let Ok(sampler) = Self::new(common.clone()) {
+                common.runtime().spawn(sampler.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize softnet sampler");
             } else {
@@ -72,17 +66,13 @@ impl Sampler for Softnet {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
 
         debug!("sampling");
 
-        let r = self.sample_softnet_stats().await;
+        let r = self.sample_softnet_stats();
         self.map_result(r)?;
 
         Ok(())
@@ -90,30 +80,26 @@ impl Sampler for Softnet {
 }
 
 impl Softnet {
-    async fn sample_softnet_stats(&mut self) -> Result<(), std::io::Error> {
+    fn sample_softnet_stats(&mut self) -> Result<(), std::io::Error> {
         if self.softnet_stat.is_none() {
-            let file = File::open("/proc/net/softnet_stat").await?;
+            let file = ProcFile::open(self.proc_path("net/softnet_stat"))?;
             self.softnet_stat = Some(file);
         }
 
         if let Some(file) = &mut self.softnet_stat {
-            file.seek(SeekFrom::Start(0)).await?;
-            let mut reader = BufReader::new(file);
-            let mut line = String::new();
             let mut result = HashMap::<SoftnetStatistic, u64>::new();
 
-            while reader.read_line(&mut line).await? > 0 {
-                for (id, part) in line.split_whitespace().enumerate() {
+            for line in file.lines()? {
+                for (id, part) in procfs::fields(line).enumerate() {
                     if let Some(statistic) = num::FromPrimitive::from_usize(id) {
                         result.entry(statistic).or_insert(0);
                         let current = result.get_mut(&statistic).unwrap();
-                        *current += u64::from_str_radix(part, 16).unwrap_or(0);
+                        *current += u64::from_str_radix(procfs::as_str(part), 16).unwrap_or(0);
                     }
                 }
-                line.clear();
             }
 
-            let time = Instant::now();
+            let time = self.common().timestamp();
             for statistic in &self.statistics {
                 if let Some(value) = result.get(statistic) {
                     let _ = self.metrics().record_counter(statistic, time, *value);
@@ -6,11 +6,12 @@ use core::convert::TryFrom;
 use core::str::FromStr;
 
 use num_derive::FromPrimitive;
-use rustcommon_metrics::*;
 use serde_derive::{Deserialize, Serialize};
 use strum::ParseError;
 use strum_macros::{EnumIter, EnumString, IntoStaticStr};
 
+use crate::metrics::*;
+
 #[derive(
     Clone,
     Copy,
@@ -41,7 +42,7 @@ pub enum SoftnetStatistic {
     FlowLimitCount = 5,
 }
 
-impl Statistic<AtomicU64, AtomicU32> for SoftnetStatistic {
+impl Statistic for SoftnetStatistic {
     fn name(&self) -> &str {
         (*self).into()
     }
@@ -9,18 +9,18 @@
 #include <net/tcp_states.h>
 #include <bcc/proto.h>
 
-struct info_t {
+struct NS(info_t) {
     u64 ts;
     u32 pid;
     char task[TASK_COMM_LEN];
 };
 
-BPF_HASH(start, struct sock *, struct info_t);
+BPF_HASH(NS(start), struct sock *, struct NS(info_t));
 
-BPF_HISTOGRAM(connlat, int, 461);
+BPF_HISTOGRAM(NS(connlat), int, 461);
 
 // histogram indexing
-static unsigned int value_to_index2(unsigned int value) {
+static unsigned int NS(value_to_index2)(unsigned int value) {
     unsigned int index = 460;
     if (value < 100) {
         // 0-99 => [0..100)
@@ -53,13 +53,13 @@ static unsigned int value_to_index2(unsigned int value) {
     return index;
 }
 
-int trace_connect(struct pt_regs *ctx, struct sock *sk)
+int NS(trace_connect)(struct pt_regs *ctx, struct sock *sk)
 {
     u32 pid = bpf_get_current_pid_tgid();
-    struct info_t info = {.pid = pid};
+    struct NS(info_t) info = {.pid = pid};
     info.ts = bpf_ktime_get_ns();
     bpf_get_current_comm(&info.task, sizeof(info.task));
-    start.update(&sk, &info);
+    NS(start).update(&sk, &info);
     return 0;
 };
 
@@ -67,22 +67,22 @@ int trace_connect(struct pt_regs *ctx, struct sock *sk)
 // are fast path and processed elsewhere, and leftovers are processed by
 // tcp_rcv_state_process(). We can trace this for handshake completion.
 // This should all be switched to static tracepoints when available.
-int trace_tcp_rcv_state_process(struct pt_regs *ctx, struct sock *skp)
+int NS(trace_tcp_rcv_state_process)(struct pt_regs *ctx, struct sock *skp)
 {
     // will be in TCP_SYN_SENT for handshake
     if (skp->__sk_common.skc_state != TCP_SYN_SENT)
         return 0;
     // check start and calculate delta
-    struct info_t *infop = start.lookup(&skp);
+    struct NS(info_t) *infop = NS(start).lookup(&skp);
     if (infop == 0) {
         return 0;   // missed entry or filtered
     }
     u64 ts = infop->ts;
     u64 now = bpf_ktime_get_ns();
     u64 delta_us = (now - ts) / 1000ul;
-    u64 index = value_to_index2(delta_us);
-    connlat.increment(index);
+    u64 index = NS(value_to_index2)(delta_us);
+    NS(connlat).increment(index);
 
-    start.delete(&skp);
+    NS(start).delete(&skp);
     return 0;
 }
\ No newline at end of file
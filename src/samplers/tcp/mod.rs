@@ -4,12 +4,13 @@
 
 use std::sync::{Arc, Mutex};
 use std::time::*;
-use tokio::fs::File;
 
 use async_trait::async_trait;
 
 use crate::common::bpf::*;
+use crate::common::procfs::ProcFile;
 use crate::config::SamplerConfig;
+use crate::metrics::Handle;
 use crate::samplers::{Common, Sampler};
 
 mod config;
@@ -20,17 +21,19 @@ pub use stat::*;
 
 #[allow(dead_code)]
 pub struct Tcp {
-    bpf: Option<Arc<Mutex<BPF>>>,
+    bpf: Option<BpfHandle>,
     bpf_last: Arc<Mutex<Instant>>,
     common: Common,
-    proc_net_snmp: Option<File>,
-    proc_net_netstat: Option<File>,
+    proc_net_snmp: Option<ProcFile>,
+    proc_net_netstat: Option<ProcFile>,
+    handles: Vec<Handle>,
     statistics: Vec<TcpStatistic>,
 }
 
 #[async_trait]
 impl Sampler for Tcp {
     type Statistic = TcpStatistic;
+    const NAME: &'static str = "tcp";
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let fault_tolerant = common.config.general().fault_tolerant();
         let statistics = common.config().samplers().tcp().statistics();
@@ -42,6 +45,7 @@ impl Sampler for Tcp {
             common,
             proc_net_snmp: None,
             proc_net_netstat: None,
+            handles: Vec::new(),
             statistics,
         };
 
@@ -54,6 +58,11 @@ impl Sampler for Tcp {
 
         if sampler.sampler_config().enabled() {
             sampler.register();
+            #[cfg(feature = "bpf")]
+            {
+                sampler.handles =
+                    sampler.resolve_histograms(&sampler.statistics, crate::MICROSECOND);
+            }
         }
 
         Ok(sampler)
@@ -61,12 +70,8 @@ impl Sampler for Tcp {
 
     fn spawn(common: Common) {
         if common.config().samplers().tcp().enabled() {
-            if let Ok(mut sampler) = Self::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = sampler.sample().await;
-                    }
-                });
+            if let Ok(sampler) = Self::new(common.clone()) {
+                common.runtime().spawn(sampler.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize tcp sampler");
             } else {
@@ -88,20 +93,16 @@ impl Sampler for Tcp {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
 
         debug!("sampling");
 
-        let r = self.sample_snmp().await;
+        let r = self.sample_snmp();
         self.map_result(r)?;
 
-        let r = self.sample_netstat().await;
+        let r = self.sample_netstat();
         self.map_result(r)?;
 
         // sample bpf
@@ -133,37 +134,28 @@ impl Tcp {
                 debug!("initializing bpf");
                 // load the code and compile
                 let code = include_str!("bpf.c");
-                let mut bpf = bcc::BPF::new(code)?;
 
                 // load + attach kprobes!
-                bcc::Kprobe::new()
-                    .handler("trace_connect")
-                    .function("tcp_v4_connect")
-                    .attach(&mut bpf)?;
-                bcc::Kprobe::new()
-                    .handler("trace_connect")
-                    .function("tcp_v6_connect")
-                    .attach(&mut bpf)?;
-                bcc::Kprobe::new()
-                    .handler("trace_tcp_rcv_state_process")
-                    .function("tcp_rcv_state_process")
-                    .attach(&mut bpf)?;
-
-                self.bpf = Some(Arc::new(Mutex::new(BPF { inner: bpf })))
+                let program = BpfProgram::new("tcp", code)
+                    .kprobe("trace_connect", "tcp_v4_connect")
+                    .kprobe("trace_connect", "tcp_v6_connect")
+                    .kprobe("trace_tcp_rcv_state_process", "tcp_rcv_state_process");
+
+                self.bpf = Some(self.common.bpf().load(program)?);
             }
         }
 
         Ok(())
     }
 
-    async fn sample_snmp(&mut self) -> Result<(), std::io::Error> {
+    fn sample_snmp(&mut self) -> Result<(), std::io::Error> {
         if self.proc_net_snmp.is_none() {
-            let file = File::open("/proc/net/snmp").await?;
+            let file = ProcFile::open(self.proc_path("net/snmp"))?;
             self.proc_net_snmp = Some(file);
         }
         if let Some(file) = &mut self.proc_net_snmp {
-            let parsed = crate::common::nested_map_from_file(file).await?;
-            let time = Instant::now();
+            let parsed = crate::common::nested_map_from_file(file)?;
+            let time = self.common().timestamp();
             for statistic in &self.statistics {
                 if let Some((pkey, lkey)) = statistic.keys() {
                     if let Some(inner) = parsed.get(pkey) {
@@ -178,14 +170,14 @@ impl Tcp {
         Ok(())
     }
 
-    async fn sample_netstat(&mut self) -> Result<(), std::io::Error> {
+    fn sample_netstat(&mut self) -> Result<(), std::io::Error> {
         if self.proc_net_netstat.is_none() {
-            let file = File::open("/proc/net/netstat").await?;
+            let file = ProcFile::open(self.proc_path("net/netstat"))?;
             self.proc_net_netstat = Some(file);
         }
         if let Some(file) = &mut self.proc_net_netstat {
-            let parsed = crate::common::nested_map_from_file(file).await?;
-            let time = Instant::now();
+            let parsed = crate::common::nested_map_from_file(file)?;
+            let time = self.common().timestamp();
             for statistic in &self.statistics {
                 if let Some((pkey, lkey)) = statistic.keys() {
                     if let Some(inner) = parsed.get(pkey) {
@@ -205,20 +197,17 @@ impl Tcp {
             >= Duration::new(self.general_config().window() as u64, 0)
         {
             if let Some(ref bpf) = self.bpf {
-                let bpf = bpf.lock().unwrap();
-                let time = Instant::now();
-                for statistic in self.statistics.iter().filter(|s| s.bpf_table().is_some()) {
-                    if let Ok(mut table) = (*bpf).inner.table(statistic.bpf_table().unwrap()) {
-                        for (&value, &count) in &map_from_table(&mut table) {
-                            if count > 0 {
-                                let _ = self.metrics().record_bucket(
-                                    statistic,
-                                    time,
-                                    value * 1000,
-                                    count,
-                                );
-                            }
-                        }
+                let time = self.common().timestamp();
+                for (statistic, handle) in self
+                    .statistics
+                    .iter()
+                    .zip(&self.handles)
+                    .filter(|(s, _)| s.bpf_table().is_some())
+                {
+                    if let Some(counts) =
+                        bpf.with_table(statistic.bpf_table().unwrap(), histogram_from_table)
+                    {
+                        handle.record_histogram(time, &counts);
                     }
                 }
             }
@@ -5,11 +5,12 @@
 use core::convert::TryFrom;
 use core::str::FromStr;
 
-use rustcommon_metrics::*;
 use serde_derive::{Deserialize, Serialize};
 use strum::ParseError;
 use strum_macros::{EnumIter, EnumString, IntoStaticStr};
 
+use crate::metrics::*;
+
 #[derive(
     Clone,
     Copy,
@@ -110,7 +111,7 @@ impl TcpStatistic {
     }
 }
 
-impl Statistic<AtomicU64, AtomicU32> for TcpStatistic {
+impl Statistic for TcpStatistic {
     fn name(&self) -> &str {
         (*self).into()
     }
@@ -3,9 +3,8 @@
 // http://www.apache.org/licenses/LICENSE-2.0
 
 use async_trait::async_trait;
-use std::time::Instant;
-use tokio::fs::File;
 
+use crate::common::procfs::ProcFile;
 use crate::config::SamplerConfig;
 use crate::samplers::Common;
 use crate::Sampler;
@@ -19,14 +18,15 @@ pub use stat::UdpStatistic;
 #[allow(dead_code)]
 pub struct Udp {
     common: Common,
-    proc_net_snmp: Option<File>,
-    proc_net_netstat: Option<File>,
+    proc_net_snmp: Option<ProcFile>,
+    proc_net_netstat: Option<ProcFile>,
     statistics: Vec<UdpStatistic>,
 }
 
 #[async_trait]
 impl Sampler for Udp {
     type Statistic = UdpStatistic;
+    const NAME: &'static str = "udp";
 
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let statistics = common.config().samplers().udp().statistics();
@@ -45,12 +45,8 @@ impl Sampler for Udp {
 
     fn spawn(common: Common) {
         if common.config().samplers().udp().enabled() {
-            if let Ok(mut sampler) = Self::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = sampler.sample().await;
-                    }
-                });
+            if let Ok(sampler) = Self::new(common.clone()) {
+                common.runtime().spawn(sampler.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize udp sampler");
             } else {
@@ -68,20 +64,16 @@ impl Sampler for Udp {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
 
         debug!("sampling");
 
-        let r = self.sample_snmp().await;
+        let r = self.sample_snmp();
         self.map_result(r)?;
 
-        let r = self.sample_netstat().await;
+        let r = self.sample_netstat();
         self.map_result(r)?;
 
         Ok(())
@@ -93,14 +85,14 @@ impl Sampler for Udp {
 }
 
 impl Udp {
-    async fn sample_snmp(&mut self) -> Result<(), std::io::Error> {
+    fn sample_snmp(&mut self) -> Result<(), std::io::Error> {
         if self.proc_net_snmp.is_none() {
-            let file = File::open("/proc/net/snmp").await?;
+            let file = ProcFile::open(self.proc_path("net/snmp"))?;
             self.proc_net_snmp = Some(file);
         }
         if let Some(file) = &mut self.proc_net_snmp {
-            let parsed = crate::common::nested_map_from_file(file).await?;
-            let time = Instant::now();
+            let parsed = crate::common::nested_map_from_file(file)?;
+            let time = self.common().timestamp();
             for statistic in &self.statistics {
                 if let Some((pkey, lkey)) = statistic.keys() {
                     if let Some(inner) = parsed.get(pkey) {
@@ -115,14 +107,14 @@ impl Udp {
         Ok(())
     }
 
-    async fn sample_netstat(&mut self) -> Result<(), std::io::Error> {
+    fn sample_netstat(&mut self) -> Result<(), std::io::Error> {
         if self.proc_net_netstat.is_none() {
-            let file = File::open("/proc/net/netstat").await?;
+            let file = ProcFile::open(self.proc_path("net/netstat"))?;
             self.proc_net_netstat = Some(file);
         }
         if let Some(file) = &mut self.proc_net_netstat {
-            let parsed = crate::common::nested_map_from_file(file).await?;
-            let time = Instant::now();
+            let parsed = crate::common::nested_map_from_file(file)?;
+            let time = self.common().timestamp();
             for statistic in &self.statistics {
                 if let Some((pkey, lkey)) = statistic.keys() {
                     if let Some(inner) = parsed.get(pkey) {
@@ -5,11 +5,12 @@
 use core::convert::TryFrom;
 use core::str::FromStr;
 
-use rustcommon_metrics::*;
 use serde_derive::{Deserialize, Serialize};
 use strum::ParseError;
 use strum_macros::{EnumIter, EnumString, IntoStaticStr};
 
+use crate::metrics::*;
+
 #[derive(
     Clone,
     Copy,
@@ -43,7 +44,7 @@ impl UdpStatistic {
     }
 }
 
-impl Statistic<AtomicU64, AtomicU32> for UdpStatistic {
+impl Statistic for UdpStatistic {
     fn name(&self) -> &str {
         (*self).into()
     }
@@ -2,10 +2,11 @@
 // Licensed under the Apache License, Version 2.0
 // http://www.apache.org/licenses/LICENSE-2.0
 
+use rustcommon_atomics::{AtomicBool, AtomicUsize};
 use serde_derive::Deserialize;
 use std::collections::BTreeMap;
 
-use crate::config::SamplerConfig;
+use crate::config::{SamplerConfig, SummaryKind};
 
 use super::stat::UsercallStatistic;
 
@@ -18,21 +19,39 @@ pub struct LibraryProbeConfig {
     pub functions: Vec<String>,
 }
 
-#[derive(Debug, Deserialize, Default)]
+#[derive(Debug, Deserialize)]
 #[serde(deny_unknown_fields)]
 pub struct UsercallConfig {
     #[serde(default)]
     bpf: bool,
+    #[serde(default = "crate::config::disabled")]
+    enabled: AtomicBool,
+    #[serde(default = "crate::config::unset_interval")]
+    interval: AtomicUsize,
     #[serde(default)]
-    enabled: bool,
+    priority: u8,
     #[serde(default)]
-    interval: Option<usize>,
+    summary: SummaryKind,
     #[serde(default)]
     percentiles: Vec<f64>,
     #[serde(default)]
     libraries: Vec<LibraryProbeConfig>,
 }
 
+impl Default for UsercallConfig {
+    fn default() -> Self {
+        Self {
+            bpf: Default::default(),
+            enabled: crate::config::disabled(),
+            interval: crate::config::unset_interval(),
+            priority: Default::default(),
+            summary: Default::default(),
+            percentiles: Default::default(),
+            libraries: Default::default(),
+        }
+    }
+}
+
 impl UsercallConfig {
     pub fn libraries(&self) -> Vec<LibraryProbeConfig> {
         let mut lib_map: BTreeMap<String, BTreeMap<Option<String>, LibraryProbeConfig>> =
@@ -81,12 +100,14 @@ impl SamplerConfig for UsercallConfig {
         self.bpf
     }
 
-    fn enabled(&self) -> bool {
-        self.enabled
+    reloadable!();
+
+    fn priority(&self) -> u8 {
+        self.priority
     }
 
-    fn interval(&self) -> Option<usize> {
-        self.interval
+    fn summary(&self) -> SummaryKind {
+        self.summary
     }
 
     fn percentiles(&self) -> &[f64] {
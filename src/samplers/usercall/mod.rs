@@ -221,6 +221,7 @@ impl Usercall {
 #[async_trait]
 impl Sampler for Usercall {
     type Statistic = UsercallStatistic;
+    const NAME: &'static str = "usercall";
 
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let statistics = common.config().samplers().usercall().statistics();
@@ -243,12 +244,8 @@ impl Sampler for Usercall {
     fn spawn(common: Common) {
         if common.config().samplers().usercall().enabled() {
             match Self::new(common.clone()) {
-                Ok(mut sampler) => {
-                    common.runtime().spawn(async move {
-                        loop {
-                            let _ = sampler.sample().await;
-                        }
-                    });
+                Ok(sampler) => {
+                    common.runtime().spawn(sampler.run());
                 }
                 Err(e) => {
                     if !common.config.fault_tolerant() {
@@ -274,10 +271,6 @@ impl Sampler for Usercall {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
@@ -293,7 +286,7 @@ impl Sampler for Usercall {
             for stat in self.statistics.iter() {
                 let val = stat_map.get(&stat.stat_path).unwrap_or(&0);
                 self.metrics()
-                    .record_counter(stat, Instant::now(), *val)
+                    .record_counter(stat, self.common().timestamp(), *val)
                     .map_err(|e| std::io::Error::new(std::io::ErrorKind::Other, e))?;
             }
         }
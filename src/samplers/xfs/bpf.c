@@ -10,21 +10,30 @@
 
 #define OP_NAME_LEN 8
 
-typedef struct dist_key {
+typedef struct NS(dist_key) {
     char op[OP_NAME_LEN];
     u64 slot;
-} dist_key_t;
+} NS(dist_key_t);
 
-BPF_HASH(start, u32);
+BPF_HASH(NS(start), u32);
 
 // value_to_index2() gives us from 0-460 as the index
-BPF_HISTOGRAM(read, int, 461);
-BPF_HISTOGRAM(write, int, 461);
-BPF_HISTOGRAM(open, int, 461);
-BPF_HISTOGRAM(fsync, int, 461);
+// only the histograms for enabled statistics are created
+#ifdef ENABLE_READ
+BPF_HISTOGRAM(NS(read), int, 461);
+#endif
+#ifdef ENABLE_WRITE
+BPF_HISTOGRAM(NS(write), int, 461);
+#endif
+#ifdef ENABLE_OPEN
+BPF_HISTOGRAM(NS(open), int, 461);
+#endif
+#ifdef ENABLE_FSYNC
+BPF_HISTOGRAM(NS(fsync), int, 461);
+#endif
 
 // histogram indexing
-static unsigned int value_to_index2(unsigned int value) {
+static unsigned int NS(value_to_index2)(unsigned int value) {
     unsigned int index = 460;
     if (value < 100) {
         // 0-99 => [0..100)
@@ -57,21 +66,21 @@ static unsigned int value_to_index2(unsigned int value) {
     return index;
 }
 
-int trace_entry(struct pt_regs *ctx)
+int NS(trace_entry)(struct pt_regs *ctx)
 {
     u32 pid = bpf_get_current_pid_tgid();
     u64 ts = bpf_ktime_get_ns();
-    start.update(&pid, &ts);
+    NS(start).update(&pid, &ts);
     return 0;
 }
 
-static int trace_return(struct pt_regs *ctx, int op)
+static int NS(trace_return)(struct pt_regs *ctx, int op)
 {
     // get pid
     u32 pid = bpf_get_current_pid_tgid();
 
     // lookup start time
-    u64 *tsp = start.lookup(&pid);
+    u64 *tsp = NS(start).lookup(&pid);
 
     // skip events without start
     if (tsp == 0) {
@@ -82,41 +91,52 @@ static int trace_return(struct pt_regs *ctx, int op)
     u64 delta = (bpf_ktime_get_ns() - *tsp) / 1000;
 
     // calculate index
-    u64 index = value_to_index2(delta);
+    u64 index = NS(value_to_index2)(delta);
 
     // store into correct histogram for OP
+#ifdef ENABLE_READ
     if (op == 0) {
-        read.increment(index);
-    } else if (op == 1) {
-        write.increment(index);
-    } else if (op == 2) {
-        open.increment(index);
-    } else if (op == 3) {
-        fsync.increment(index);
+        NS(read).increment(index);
     }
+#endif
+#ifdef ENABLE_WRITE
+    if (op == 1) {
+        NS(write).increment(index);
+    }
+#endif
+#ifdef ENABLE_OPEN
+    if (op == 2) {
+        NS(open).increment(index);
+    }
+#endif
+#ifdef ENABLE_FSYNC
+    if (op == 3) {
+        NS(fsync).increment(index);
+    }
+#endif
 
     // clear the start time
-    start.delete(&pid);
+    NS(start).delete(&pid);
 
     return 0;
 }
 
-int trace_read_return(struct pt_regs *ctx)
+int NS(trace_read_return)(struct pt_regs *ctx)
 {
-    return trace_return(ctx, 0);
+    return NS(trace_return)(ctx, 0);
 }
 
-int trace_write_return(struct pt_regs *ctx)
+int NS(trace_write_return)(struct pt_regs *ctx)
 {
-    return trace_return(ctx, 1);
+    return NS(trace_return)(ctx, 1);
 }
 
-int trace_open_return(struct pt_regs *ctx)
+int NS(trace_open_return)(struct pt_regs *ctx)
 {
-    return trace_return(ctx, 2);
+    return NS(trace_return)(ctx, 2);
 }
 
-int trace_fsync_return(struct pt_regs *ctx)
+int NS(trace_fsync_return)(struct pt_regs *ctx)
 {
-    return trace_return(ctx, 3);
+    return NS(trace_return)(ctx, 3);
 }
@@ -9,6 +9,7 @@ use async_trait::async_trait;
 
 use crate::common::bpf::*;
 use crate::config::SamplerConfig;
+use crate::metrics::Handle;
 use crate::samplers::Common;
 use crate::Sampler;
 
@@ -20,15 +21,17 @@ pub use stat::*;
 
 #[allow(dead_code)]
 pub struct Xfs {
-    bpf: Option<Arc<Mutex<BPF>>>,
+    bpf: Option<BpfHandle>,
     bpf_last: Arc<Mutex<Instant>>,
     common: Common,
+    handles: Vec<Handle>,
     statistics: Vec<XfsStatistic>,
 }
 
 #[async_trait]
 impl Sampler for Xfs {
     type Statistic = XfsStatistic;
+    const NAME: &'static str = "xfs";
     fn new(common: Common) -> Result<Self, anyhow::Error> {
         let fault_tolerant = common.config.general().fault_tolerant();
         let statistics = common.config().samplers().xfs().statistics();
@@ -38,6 +41,7 @@ impl Sampler for Xfs {
             bpf: None,
             bpf_last: Arc::new(Mutex::new(Instant::now())),
             common,
+            handles: Vec::new(),
             statistics,
         };
 
@@ -50,6 +54,11 @@ impl Sampler for Xfs {
 
         if sampler.sampler_config().enabled() {
             sampler.register();
+            #[cfg(feature = "bpf")]
+            {
+                sampler.handles =
+                    sampler.resolve_histograms(&sampler.statistics, crate::MICROSECOND);
+            }
         }
 
         Ok(sampler)
@@ -57,12 +66,8 @@ impl Sampler for Xfs {
 
     fn spawn(common: Common) {
         if common.config().samplers().xfs().enabled() {
-            if let Ok(mut sampler) = Self::new(common.clone()) {
-                common.runtime().spawn(async move {
-                    loop {
-                        let _ = sampler.sample().await;
-                    }
-                });
+            if let Ok(sampler) = Self::new(common.clone()) {
+                common.runtime().spawn(sampler.run());
             } else if !common.config.fault_tolerant() {
                 fatal!("failed to initialize xfs sampler");
             } else {
@@ -84,10 +89,6 @@ impl Sampler for Xfs {
     }
 
     async fn sample(&mut self) -> Result<(), std::io::Error> {
-        if let Some(ref mut delay) = self.delay() {
-            delay.tick().await;
-        }
-
         if !self.sampler_config().enabled() {
             return Ok(());
         }
@@ -124,42 +125,31 @@ impl Xfs {
 
                 // load the code and compile
                 let code = include_str!("bpf.c");
-                let mut bpf = bcc::BPF::new(code)?;
-
-                // load + attach kprobes!
-                bcc::Kprobe::new()
-                    .handler("trace_entry")
-                    .function("xfs_file_read_iter")
-                    .attach(&mut bpf)?;
-                bcc::Kprobe::new()
-                    .handler("trace_entry")
-                    .function("xfs_file_write_iter")
-                    .attach(&mut bpf)?;
-                bcc::Kprobe::new()
-                    .handler("trace_entry")
-                    .function("xfs_file_open")
-                    .attach(&mut bpf)?;
-                bcc::Kprobe::new()
-                    .handler("trace_entry")
-                    .function("xfs_file_fsync")
-                    .attach(&mut bpf)?;
-                bcc::Kretprobe::new()
-                    .handler("trace_read_return")
-                    .function("xfs_file_read_iter")
-                    .attach(&mut bpf)?;
-                bcc::Kretprobe::new()
-                    .handler("trace_write_return")
-                    .function("xfs_file_write_iter")
-                    .attach(&mut bpf)?;
-                bcc::Kretprobe::new()
-                    .handler("trace_open_return")
-                    .function("xfs_file_open")
-                    .attach(&mut bpf)?;
-                bcc::Kretprobe::new()
-                    .handler("trace_fsync_return")
-                    .function("xfs_file_fsync")
-                    .attach(&mut bpf)?;
-                self.bpf = Some(Arc::new(Mutex::new(BPF { inner: bpf })));
+
+                // only attach the probes for enabled statistics
+                let mut program = BpfProgram::new("xfs", code);
+                for statistic in &self.statistics {
+                    let table = statistic.bpf_table().unwrap();
+                    program = match statistic {
+                        XfsStatistic::ReadLatency => program
+                            .enable(table)
+                            .kprobe("trace_entry", "xfs_file_read_iter")
+                            .kretprobe("trace_read_return", "xfs_file_read_iter"),
+                        XfsStatistic::WriteLatency => program
+                            .enable(table)
+                            .kprobe("trace_entry", "xfs_file_write_iter")
+                            .kretprobe("trace_write_return", "xfs_file_write_iter"),
+                        XfsStatistic::OpenLatency => program
+                            .enable(table)
+                            .kprobe("trace_entry", "xfs_file_open")
+                            .kretprobe("trace_open_return", "xfs_file_open"),
+                        XfsStatistic::FsyncLatency => program
+                            .enable(table)
+                            .kprobe("trace_entry", "xfs_file_fsync")
+                            .kretprobe("trace_fsync_return", "xfs_file_fsync"),
+                    };
+                }
+                self.bpf = Some(self.common.bpf().load(program)?);
             }
         }
 
@@ -172,20 +162,17 @@ impl Xfs {
             >= Duration::new(self.general_config().window() as u64, 0)
         {
             if let Some(ref bpf) = self.bpf {
-                let bpf = bpf.lock().unwrap();
-                let time = Instant::now();
-                for statistic in self.statistics.iter().filter(|s| s.bpf_table().is_some()) {
-                    if let Ok(mut table) = (*bpf).inner.table(statistic.bpf_table().unwrap()) {
-                        for (&value, &count) in &map_from_table(&mut table) {
-                            if count > 0 {
-                                let _ = self.metrics().record_bucket(
-                                    statistic,
-                                    time,
-                                    value * crate::MICROSECOND,
-                                    count,
-                                );
-                            }
-                        }
+                let time = self.common().timestamp();
+                for (statistic, handle) in self
+                    .statistics
+                    .iter()
+                    .zip(&self.handles)
+                    .filter(|(s, _)| s.bpf_table().is_some())
+                {
+                    if let Some(counts) =
+                        bpf.with_table(statistic.bpf_table().unwrap(), histogram_from_table)
+                    {
+                        handle.record_histogram(time, &counts);
                     }
                 }
             }